@@ -0,0 +1,46 @@
+/*
+ * Count allocations for --stats by replacing the global operator new, which
+ * everything else, e.g. new[] and the standard containers, goes through
+ *
+ * This is only linked into fotoloc and the benchmarks, not libfotoloc.a, so
+ * programs using the library keep their own allocator.
+ */
+
+#include <new>
+#include <cstdlib>
+
+#include "stats.h"
+
+void* operator new(std::size_t size)
+{
+    countAllocation();
+
+    if (size == 0)
+        size = 1;
+
+    while (true)
+    {
+        void* p = std::malloc(size);
+
+        if (p)
+            return p;
+
+        std::new_handler handler = std::get_new_handler();
+
+        if (!handler)
+            throw std::bad_alloc();
+
+        handler();
+    }
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+// Since C++14 deletes may be told the size, which we don't need
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
@@ -0,0 +1,50 @@
+#include <cstdint>
+#include <algorithm>
+
+#include "arena.h"
+
+Arena::Arena(std::size_t block_size)
+    :first_size(std::max<std::size_t>(block_size, 1))
+{
+}
+
+void* Arena::allocate(std::size_t size, std::size_t alignment)
+{
+    // Round up to where it'd be aligned in the current block, if there is one
+    std::size_t start = used;
+
+    if (!blocks.empty())
+    {
+        const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(blocks.back().data.get()) + used;
+        start += (alignment - address%alignment)%alignment;
+    }
+
+    if (blocks.empty() || start + size > blocks.back().size)
+    {
+        const std::size_t doubled = blocks.empty()?first_size:
+            std::min(2*blocks.back().size, 16*first_size);
+        const std::size_t block_size = std::max(doubled, size + alignment - 1);
+
+        Block block;
+        block.data.reset(static_cast<unsigned char*>(BufferPool::allocate(block_size)));
+        block.size = block_size;
+        blocks.push_back(std::move(block));
+
+        const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(blocks.back().data.get());
+        start = (alignment - address%alignment)%alignment;
+    }
+
+    used = start + size;
+    total += size;
+
+    return blocks.back().data.get() + start;
+}
+
+void Arena::reset()
+{
+    if (blocks.size() > 1)
+        blocks.erase(blocks.begin() + 1, blocks.end());
+
+    used = 0;
+    total = 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * Memory for everything made while working on one page, given out in order
+ * from big blocks and all freed at once
+ *
+ *   Arena arena;
+ *   std::map<int, CoordPair, std::less<int>,
+ *       ArenaAllocator<std::pair<const int, CoordPair>>> objs(&arena);
+ *   ...
+ *   arena.reset(); // once nothing is using it anymore
+ *
+ * Freeing one thing does nothing, so this is for lots of small allocations
+ * that live about as long as each other, like the nodes of a map, rather than
+ * vectors that grow. It isn't thread safe; each page has its own. An
+ * ArenaAllocator without an arena uses new and delete, so containers using it
+ * work the same either way.
+ */
+
+#ifndef H_ARENA
+#define H_ARENA
+
+#include <new>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <type_traits>
+
+#include "bufferpool.h"
+
+class Arena
+{
+    struct Block
+    {
+        std::unique_ptr<unsigned char, BufferDeleter> data;
+        std::size_t size;
+    };
+
+    std::vector<Block> blocks;
+
+    // How much of the last block has been given out
+    std::size_t used = 0;
+    std::size_t first_size;
+    std::size_t total = 0;
+
+public:
+    // The first block is this big, and each after that twice as big as the
+    // last up to 16 times it, or bigger if it has to be for one allocation
+    explicit Arena(std::size_t block_size = 64*1024);
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(std::size_t size, std::size_t alignment = alignof(std::max_align_t));
+
+    // Free everything, keeping the first block to start over with
+    void reset();
+
+    // Bytes given out since the last reset
+    std::size_t size() const { return total; }
+};
+
+template<class T>
+class ArenaAllocator
+{
+    template<class U> friend class ArenaAllocator;
+
+    Arena* arena;
+
+public:
+    typedef T value_type;
+
+    // Moving or swapping containers keeps their memory with them
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    ArenaAllocator(Arena* a = nullptr)
+        :arena(a) { }
+
+    template<class U>
+    ArenaAllocator(const ArenaAllocator<U>& other)
+        :arena(other.arena) { }
+
+    T* allocate(std::size_t n)
+    {
+        if (arena)
+            return static_cast<T*>(arena->allocate(n*sizeof(T), alignof(T)));
+
+        return static_cast<T*>(::operator new(n*sizeof(T)));
+    }
+
+    void deallocate(T* p, std::size_t)
+    {
+        if (!arena)
+            ::operator delete(p);
+    }
+
+    template<class U>
+    bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+
+    template<class U>
+    bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+};
+
+// Best sized once, since growing leaves the old copies in the arena
+template<class T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+#endif
@@ -0,0 +1,271 @@
+#include "bandblobs.h"
+
+#include <limits>
+#include <utility>
+#include <algorithm>
+
+std::vector<Coord> BandObject::outline() const
+{
+    const int rows = left.size();
+    std::vector<Coord> points;
+    points.reserve(2*rows);
+
+    for (int i = 0; i < rows; ++i)
+        points.push_back(Coord(right[i], top+i));
+
+    for (int i = rows-1; i >= 0; --i)
+        points.push_back(Coord(left[i], top+i));
+
+    return points;
+}
+
+double BandObject::area() const
+{
+    auto inside = [this](int x, int y) -> bool
+    {
+        const int row = y - top;
+        const int column = x - leftmost;
+
+        return row >= 0 && row < static_cast<int>(left.size()) &&
+            x >= left[row] && x <= right[row] &&
+            column >= 0 && column < static_cast<int>(upper.size()) &&
+            y >= upper[column] && y <= lower[column];
+    };
+
+    long long pixels = 0;
+    long long border = 0;
+
+    for (std::vector<int>::size_type i = 0; i < left.size(); ++i)
+    {
+        const int y = top + i;
+
+        for (int x = left[i]; x <= right[i]; ++x)
+        {
+            if (!inside(x, y))
+                continue;
+
+            ++pixels;
+
+            if (!inside(x-1, y) || !inside(x+1, y) || !inside(x, y-1) || !inside(x, y+1))
+                ++border;
+        }
+    }
+
+    // Pick's theorem, for the area of the polygon through the middle of the
+    // border pixels like polygonArea() of a traced outline
+    return std::max(0.0, pixels - border/2.0 - 1);
+}
+
+void BandObject::addRun(int start, int end, int y)
+{
+    const int row = y - top;
+
+    if (row == static_cast<int>(left.size()))
+    {
+        left.push_back(start);
+        right.push_back(end);
+    }
+    else
+    {
+        // Another run in a row it's already in is always to the right
+        right[row] = end;
+    }
+
+    // The columns this object is in only ever grow outward
+    if (upper.empty())
+        leftmost = start;
+
+    while (start < leftmost)
+    {
+        upper.push_front(std::numeric_limits<int>::max());
+        lower.push_front(std::numeric_limits<int>::min());
+        --leftmost;
+    }
+
+    while (leftmost + static_cast<int>(upper.size()) <= end)
+    {
+        upper.push_back(std::numeric_limits<int>::max());
+        lower.push_back(std::numeric_limits<int>::min());
+    }
+
+    for (int x = start; x <= end; ++x)
+    {
+        upper[x-leftmost] = std::min(upper[x-leftmost], y);
+        lower[x-leftmost] = y;
+    }
+
+    last = Coord(end, y);
+}
+
+void BandObject::merge(BandObject& other)
+{
+    // Both go down to this row or the one before, so the one starting higher
+    // has rows for everything the other one does
+    if (other.top < top)
+    {
+        std::swap(top, other.top);
+        std::swap(left, other.left);
+        std::swap(right, other.right);
+    }
+
+    const int offset = other.top - top;
+
+    for (std::vector<int>::size_type i = 0; i < other.left.size(); ++i)
+    {
+        if (offset + i < left.size())
+        {
+            left[offset+i] = std::min(left[offset+i], other.left[i]);
+            right[offset+i] = std::max(right[offset+i], other.right[i]);
+        }
+        else
+        {
+            left.push_back(other.left[i]);
+            right.push_back(other.right[i]);
+        }
+    }
+
+    // Columns can go either way, so go through the narrower one
+    if (other.upper.size() > upper.size())
+    {
+        std::swap(leftmost, other.leftmost);
+        std::swap(upper, other.upper);
+        std::swap(lower, other.lower);
+    }
+
+    const int other_end = other.leftmost + other.upper.size();
+
+    while (other.leftmost < leftmost)
+    {
+        upper.push_front(std::numeric_limits<int>::max());
+        lower.push_front(std::numeric_limits<int>::min());
+        --leftmost;
+    }
+
+    while (leftmost + static_cast<int>(upper.size()) < other_end)
+    {
+        upper.push_back(std::numeric_limits<int>::max());
+        lower.push_back(std::numeric_limits<int>::min());
+    }
+
+    for (std::deque<int>::size_type i = 0; i < other.upper.size(); ++i)
+    {
+        const int x = other.leftmost + i - leftmost;
+        upper[x] = std::min(upper[x], other.upper[i]);
+        lower[x] = std::max(lower[x], other.lower[i]);
+    }
+
+    if (other.first.y < first.y ||
+        (other.first.y == first.y && other.first.x < first.x))
+        first = other.first;
+
+    if (other.last.y > last.y ||
+        (other.last.y == last.y && other.last.x > last.x))
+        last = other.last;
+
+    other = BandObject();
+}
+
+BandBlobs::BandBlobs(Callback done)
+    : done(done), objects(1), forest(0)
+{
+}
+
+void BandBlobs::addRuns()
+{
+    // Runs above that might touch the current one
+    std::vector<Run>::size_type above = 0;
+
+    for (Run& run : current)
+    {
+        // Skip the ones entirely to the left, not even touching at a corner
+        while (above < previous.size() && previous[above].end < run.start)
+            ++above;
+
+        int label = 0;
+
+        for (std::vector<Run>::size_type i = above;
+                i < previous.size() && previous[i].start <= run.end; ++i)
+        {
+            if (previous[i].color != run.color)
+                continue;
+
+            if (label == 0)
+                label = forest.find(previous[i].label);
+            else
+                label = join(label, previous[i].label);
+        }
+
+        if (label == 0)
+        {
+            label = objects.size();
+            objects.push_back(BandObject());
+            forest.add(label);
+
+            BandObject& obj = objects[label];
+            obj.first = Coord(run.start, y);
+            obj.top = y;
+        }
+
+        run.label = label;
+        objects[label].addRun(run.start, run.end-1, y);
+    }
+
+    previous.swap(current);
+    ++y;
+
+    // Most runs start a new label, but only those in the last row matter
+    // again, so renumber once there are a lot more labels than that
+    if (objects.size() > 4*previous.size() + 1024)
+        compact();
+}
+
+int BandBlobs::join(int a, int b)
+{
+    const int ra = forest.find(a);
+    const int rb = forest.find(b);
+
+    if (ra == rb)
+        return ra;
+
+    forest.join(ra, rb);
+
+    const int root = forest.find(ra);
+    objects[root].merge(objects[(root == ra)?rb:ra]);
+
+    return root;
+}
+
+void BandBlobs::compact()
+{
+    std::vector<int> renumbered(objects.size(), 0);
+    std::vector<BandObject> kept(1);
+    DisjointForest<int> relabeled(0);
+
+    for (Run& run : previous)
+    {
+        const int root = forest.find(run.label);
+
+        if (renumbered[root] == 0)
+        {
+            renumbered[root] = kept.size();
+            kept.push_back(std::move(objects[root]));
+            relabeled.add(renumbered[root]);
+        }
+
+        run.label = renumbered[root];
+    }
+
+    // Everything else is done
+    for (std::vector<BandObject>::size_type label = 1; label < objects.size(); ++label)
+        if (renumbered[label] == 0 && forest.find(label) == static_cast<int>(label))
+            done(objects[label]);
+
+    objects.swap(kept);
+    forest = std::move(relabeled);
+}
+
+void BandBlobs::finish()
+{
+    previous.clear();
+    compact();
+}
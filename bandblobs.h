@@ -0,0 +1,146 @@
+/*
+ * Find the same colored blobs/objects as Blobs, but given the image a row at
+ * a time and only keeping track of the row before, so the whole image never
+ * has to be in memory
+ *
+ *   BandBlobs blobs([](const BandObject& obj) { ... obj.outline() ... });
+ *
+ *   for (int y = 0; y < h; ++y)
+ *       blobs.add<3>(row(y), w);
+ *
+ *   blobs.finish();
+ *
+ * Each row is split into runs of one color, each joined to the runs of the
+ * same color touching it in the row above (including diagonally). Objects are
+ * handed to the function once no more rows can add to them, which isn't in
+ * any particular order.
+ *
+ * Rather than the border, what's kept of each object is the leftmost and
+ * rightmost pixel in every row and the top and bottom one in every column.
+ * The convex hull of those is the convex hull of the object, so it's enough
+ * to fit the corners of a photo to, and the area inside both is close to the
+ * area inside its outline.
+ */
+
+#ifndef H_BANDBLOBS
+#define H_BANDBLOBS
+
+#include <deque>
+#include <vector>
+#include <cstdint>
+#include <functional>
+
+#include "coord.h"
+#include "pixelbuffer.h"
+#include "disjointforest.h"
+
+struct BandObject
+{
+    // First and last pixels going row by row, as in CoordPair
+    Coord first;
+    Coord last;
+
+    // Leftmost and rightmost x of each row starting at the top one
+    int top = 0;
+    std::vector<int> left;
+    std::vector<int> right;
+
+    // Top and bottom y of each column starting at the leftmost one, or
+    // upper > lower if none of the object is in that column
+    int leftmost = 0;
+    std::deque<int> upper;
+    std::deque<int> lower;
+
+    // The sides going clockwise, down the right and back up the left, which
+    // for anything without holes in it from the side is its outline
+    std::vector<Coord> outline() const;
+
+    // Area of what's between the sides of both its row and its column,
+    // which is the area inside the outline unless parts of it are cut into
+    // diagonally
+    double area() const;
+
+    // Add pixels start to end (inclusive) of row y, the last row so far
+    void addRun(int start, int end, int y);
+
+    // Add everything in other, leaving it empty
+    void merge(BandObject& other);
+};
+
+class BandBlobs
+{
+public:
+    typedef std::function<void(const BandObject&)> Callback;
+
+private:
+    struct Run
+    {
+        int start;
+        int end; // One past the last pixel
+        std::uint32_t color;
+        int label;
+    };
+
+    Callback done;
+    int y = 0;
+
+    std::vector<Run> previous;
+    std::vector<Run> current;
+
+    // Objects by label, only meaningful for the labels that are
+    // representatives in the forest
+    std::vector<BandObject> objects;
+    DisjointForest<int> forest;
+
+public:
+    explicit BandBlobs(Callback done);
+
+    // Label the next row of w pixels with N channels
+    template<int N>
+    void add(const unsigned char* row, int w);
+
+    // Hand out the objects still touching the last row
+    void finish();
+
+private:
+    BandBlobs(const BandBlobs&) = delete;
+    BandBlobs& operator=(const BandBlobs&) = delete;
+
+    // Label the runs in current and join them to the runs above
+    void addRuns();
+
+    // Join the objects of two labels
+    int join(int a, int b);
+
+    // Hand out the objects no longer touching the last row and renumber the
+    // rest from one, so the labels don't keep growing
+    void compact();
+};
+
+template<int N>
+void BandBlobs::add(const unsigned char* row, int w)
+{
+    static_assert(N >= 1 && N <= 4, "Colors must fit in 32 bits");
+
+    auto color = [row](int x) -> std::uint32_t
+    {
+        return packPixel<N>(row + x*N);
+    };
+
+    current.clear();
+
+    for (int x = 0; x < w; )
+    {
+        const std::uint32_t c = color(x);
+        const int start = x;
+
+        while (x < w && color(x) == c)
+            ++x;
+
+        current.push_back(Run{ start, x, c, 0 });
+    }
+
+    addRuns();
+}
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ * Blur and quantize an image a band of rows at a time as it's read, rather
+ * than having all of it in memory
+ *
+ *   blurQuantizeBands<3>(w, h, 2, 10, 256,
+ *       [&](unsigned char* out, std::ptrdiff_t stride, int rows) { tiff.read(out, stride, rows); },
+ *       [&](int y, const unsigned char* row) { blobs.add<3>(row, w); });
+ *
+ * The rows given to out are the same as blurQuantize() on the whole image
+ * would give, and they're given in order. Each band is blurred with enough of
+ * the rows above and below it, which are kept from the band before or read
+ * ahead, so at most about rows plus a few times the blur radius are kept.
+ */
+
+#ifndef H_BANDS
+#define H_BANDS
+
+#include <array>
+#include <cstddef>
+#include <algorithm>
+
+#include "blur.h"
+#include "pixels.h"
+#include "threadpool.h"
+#include "pixelbuffer.h"
+
+// Read the image rows at a time with in(out, stride, count), which gets the
+// next count rows, blurring with radius r (if at least one) and quantizing
+// into amount bins, and then calling out(y, row) on each row in order
+template<int N, class Input, class Output>
+void blurQuantizeBands(int w, int h, int r, int amount, int rows,
+        Input in, Output out, ThreadPool& pool = ThreadPool::global())
+{
+    const std::array<unsigned char, 256> table = Pixels<N>::quantizeTable(amount);
+
+    // Same cases where blurQuantize() wouldn't blur
+    const bool blur = r >= 1 && r <= w && r <= h;
+
+    // How far outside a band the blur reaches, as in gaussBlurTiled
+    const std::array<int, 3> radii = blur?gaussBoxRadii(r):std::array<int, 3>{{ 0, 0, 0 }};
+    const int halo = radii[0] + radii[1] + radii[2];
+
+    rows = std::max(1, std::min(rows, h));
+
+    // The rows read so far that are still needed, starting at row top of the
+    // image, and the quantized rows of the current band
+    PixelBuffer<N> window(w, std::min(h, rows + 2*halo));
+    PixelBuffer<N> band(w, rows);
+    int top = 0;
+    int filled = 0;
+
+    for (int y0 = 0; y0 < h; y0 += rows)
+    {
+        const int y1 = std::min(h, y0 + rows);
+        const int first = std::max(0, y0 - halo);
+        const int last = std::min(h, y1 + halo);
+
+        // Move up what's still needed from the last band
+        const int drop = first - top;
+
+        for (int i = drop; i < filled; ++i)
+            std::copy(window.row(i), window.row(i) + w*N, window.row(i-drop));
+
+        filled -= drop;
+        top = first;
+
+        in(window.row(filled), window.stride(), last - top - filled);
+        filled = last - top;
+
+        auto quantize = [&](int y, const unsigned char* row)
+        {
+            // Rows near the edges of the window only have what's needed
+            // for the blur of the band
+            if (top + y < y0 || top + y >= y1)
+                return;
+
+            unsigned char* q = band.row(top + y - y0);
+
+            for (int x = 0; x < w*N; ++x)
+                q[x] = table[row[x]];
+        };
+
+        if (blur)
+            gaussBlurTiled<N>(window.row(0), window.stride(), w, filled, r, quantize, pool);
+        else
+            for (int y = 0; y < filled; ++y)
+                quantize(y, window.row(y));
+
+        for (int y = y0; y < y1; ++y)
+            out(y, band.row(y - y0));
+    }
+}
+
+#endif
@@ -0,0 +1,196 @@
+/*
+ * Time each of the kernels by itself on made up pages
+ *
+ *   make bench
+ *   ./bench/bench --dpi 600 --repeat 5 --only blur
+ *
+ * Each kernel is run a few times on the same page and the fastest is kept.
+ * Throughput is in millions of pixels of the page a second, or for those that
+ * work on outlines, millions of points on the outlines a second.
+ */
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <functional>
+
+#include "synthetic.h"
+
+#include "../quad.h"
+#include "../line.h"
+#include "../blobs.h"
+#include "../pixels.h"
+#include "../palette.h"
+#include "../outline.h"
+#include "../histogram.h"
+#include "../disjointset.h"
+#include "../disjointforest.h"
+
+struct Options
+{
+    int dpi = 300;
+    int repeat = 3;
+
+    // Only run the kernels with this in their name
+    std::string only;
+};
+
+// Fastest of the runs in seconds
+double fastest(int repeat, const std::function<void()>& f)
+{
+    double best = 0;
+
+    for (int i = 0; i < repeat; ++i)
+    {
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        f();
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        if (i == 0 || elapsed.count() < best)
+            best = elapsed.count();
+    }
+
+    return best;
+}
+
+void report(const Options& options, const std::string& name, int channels,
+        double items, const std::string& unit, const std::function<void()>& f)
+{
+    if (!options.only.empty() && name.find(options.only) == std::string::npos)
+        return;
+
+    const double seconds = fastest(options.repeat, f);
+
+    std::cout << std::left << std::setw(24) << name
+              << std::right << std::setw(4) << channels
+              << std::fixed << std::setprecision(2)
+              << std::setw(12) << seconds*1000 << " ms"
+              << std::setw(12) << ((seconds > 0)?items/seconds/1e6:0) << " " << unit
+              << std::endl;
+}
+
+// Keep the compiler from throwing away results that aren't used
+volatile long long sink = 0;
+
+template<int N>
+void benchChannels(const Options& options)
+{
+    const SyntheticPage<N> page = syntheticPage<N>(options.dpi);
+    const Pixels<N>& img = page.img;
+    const double pixels = 1.0*img.width()*img.height();
+
+    report(options, "blur", N, pixels, "MPix/s", [&]()
+        { sink += img.blur(2).width(); });
+    report(options, "quantize", N, pixels, "MPix/s", [&]()
+        { sink += img.quantize(10).width(); });
+    report(options, "blurQuantize", N, pixels, "MPix/s", [&]()
+        { sink += img.blurQuantize(2, 10).width(); });
+    report(options, "blurQuantizeIndices", N, pixels, "MPix/s", [&]()
+        { sink += img.blurQuantizeIndices(2, 10).width(); });
+    report(options, "downscale", N, pixels, "MPix/s", [&]()
+        { sink += img.downscale(4).width(); });
+    report(options, "histogram", N, pixels, "MPix/s", [&]()
+        { sink += Histogram<N>(img.ref().view()).threshold(127); });
+
+    // Labeling is always done on a quantized page
+    const Pixels<N> quantized = img.blurQuantize(2, 10);
+    const PaletteImage indices = img.blurQuantizeIndices(2, 10);
+
+    report(options, "blobs/neighbors/set", N, pixels, "MPix/s", [&]()
+        { sink += Blobs(quantized, UnionFind<DisjointSet<int>>(), LabelingMethod::Neighbors).size(); });
+    report(options, "blobs/neighbors", N, pixels, "MPix/s", [&]()
+        { sink += Blobs(quantized, LabelingMethod::Neighbors).size(); });
+    report(options, "blobs/tree", N, pixels, "MPix/s", [&]()
+        { sink += Blobs(quantized, LabelingMethod::DecisionTree).size(); });
+    report(options, "blobs/strips", N, pixels, "MPix/s", [&]()
+        { sink += Blobs(quantized, LabelingMethod::Strips).size(); });
+    report(options, "blobs/strips+contours", N, pixels, "MPix/s", [&]()
+        { sink += Blobs(quantized, LabelingMethod::Strips, ContourMode::Trace).size(); });
+    report(options, "blobs/tree/indices", N, pixels, "MPix/s", [&]()
+        { sink += Blobs(indices, LabelingMethod::DecisionTree).size(); });
+    report(options, "blobs/strips/indices", N, pixels, "MPix/s", [&]()
+        { sink += Blobs(indices, LabelingMethod::Strips).size(); });
+
+    // The outlines of the big objects, like the pipeline looks at
+    const Blobs blobs(quantized, LabelingMethod::Strips, ContourMode::Trace);
+    const int min_dist = options.dpi/3;
+    std::vector<Coord> starts;
+    std::vector<std::vector<Coord>> contours;
+    double points = 0;
+
+    for (const CoordPair& pair : blobs)
+    {
+        if (distance(pair.first, pair.last) > min_dist)
+        {
+            starts.push_back(pair.first);
+            contours.push_back(blobs.contour(blobs.label(pair.first)));
+            points += contours.back().size();
+        }
+    }
+
+    report(options, "outline", N, points, "Mpts/s", [&]()
+    {
+        for (const Coord& start : starts)
+            sink += Outline(blobs, start, 2*(img.width() + img.height())).points().size();
+    });
+    report(options, "findQuad", N, points, "Mpts/s", [&]()
+    {
+        for (const std::vector<Coord>& contour : contours)
+            sink += findQuad(contour).area;
+    });
+    report(options, "findLines", N, points, "Mpts/s", [&]()
+    {
+        for (const std::vector<Coord>& contour : contours)
+            sink += findLinesExtendingDecreasingError(contour, 0.04).size();
+    });
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const std::string value = (i+1 < argc)?argv[i+1]:"";
+
+        if (arg == "--dpi")
+        {
+            options.dpi = std::atoi(value.c_str());
+            ++i;
+        }
+        else if (arg == "--repeat")
+        {
+            options.repeat = std::atoi(value.c_str());
+            ++i;
+        }
+        else if (arg == "--only")
+        {
+            options.only = value;
+            ++i;
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--dpi N] [--repeat N] [--only NAME]" << std::endl;
+            return 1;
+        }
+    }
+
+    if (options.dpi < 10 || options.repeat < 1)
+    {
+        std::cerr << "Error: --dpi needs to be at least 10 and --repeat at least 1" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Letter-size page at " << options.dpi << " dpi, fastest of "
+              << options.repeat << std::endl;
+
+    benchChannels<1>(options);
+    benchChannels<3>(options);
+    benchChannels<4>(options);
+
+    return 0;
+}
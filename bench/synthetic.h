@@ -0,0 +1,161 @@
+/*
+ * Made up scans of a letter-size page with photos on it, for benchmarking
+ *
+ *   const SyntheticPage<3> page = syntheticPage<3>(300);
+ *   const Pixels<3> quantized = page.img.blurQuantize(2, 10);
+ *
+ * The background is a light gray with noise in it like a scanner's, and each
+ * photo is a rectangle a few inches on a side, rotated up to 15 degrees, with
+ * a gradient and noise across it so that it isn't all one color. The same
+ * seed always gives the same page.
+ */
+
+#ifndef H_SYNTHETIC
+#define H_SYNTHETIC
+
+#include <cmath>
+#include <array>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include "../math.h"
+#include "../quad.h"
+#include "../pixels.h"
+#include "../pixelbuffer.h"
+
+template<int N>
+struct SyntheticPage
+{
+    Pixels<N> img;
+
+    // Where each photo really is
+    std::vector<Quad> photos;
+};
+
+template<int N>
+SyntheticPage<N> syntheticPage(int dpi, int photo_count = 4, unsigned int seed = 1)
+{
+    const int w = std::max(1, static_cast<int>(8.5*dpi));
+    const int h = std::max(1, 11*dpi);
+
+    std::mt19937 rng(seed);
+    std::normal_distribution<double> noise(0, 4);
+    std::uniform_real_distribution<double> uniform(0, 1);
+
+    // An RGB copy is drawn on first, then converted to N channels
+    std::vector<std::array<double, 3>> page(static_cast<std::size_t>(w)*h);
+
+    for (std::array<double, 3>& p : page)
+    {
+        const double gray = 235 + noise(rng);
+        p = {{ gray, gray, gray }};
+    }
+
+    SyntheticPage<N> result;
+
+    // Photos go left to right in two columns, top to bottom, so they don't
+    // overlap much
+    for (int i = 0; i < photo_count; ++i)
+    {
+        const int columns = 2;
+        const int rows = std::max(1, (photo_count + columns - 1)/columns);
+        const double cell_w = 1.0*w/columns;
+        const double cell_h = 1.0*h/rows;
+
+        const double center_x = cell_w*(i%columns + 0.5);
+        const double center_y = cell_h*(i/columns + 0.5);
+        const double half_w = 0.35*cell_w*(0.8 + 0.2*uniform(rng));
+        const double half_h = 0.35*cell_h*(0.8 + 0.2*uniform(rng));
+        const double angle = (uniform(rng) - 0.5)*2*15*pi/180;
+        const double s = std::sin(angle);
+        const double c = std::cos(angle);
+
+        const std::array<double, 3> base = {{
+            40 + 160*uniform(rng), 40 + 160*uniform(rng), 40 + 160*uniform(rng)
+        }};
+
+        // Corners clockwise from the top left before rotating
+        const std::array<std::array<double, 2>, 4> corners = {{
+            {{ -half_w, -half_h }}, {{ half_w, -half_h }},
+            {{ half_w, half_h }}, {{ -half_w, half_h }}
+        }};
+
+        Quad quad;
+        double min_x = w, min_y = h, max_x = 0, max_y = 0;
+
+        for (int j = 0; j < 4; ++j)
+        {
+            const double x = center_x + corners[j][0]*c - corners[j][1]*s;
+            const double y = center_y + corners[j][0]*s + corners[j][1]*c;
+
+            quad.corners[j] = Coord(std::lround(x), std::lround(y));
+            min_x = std::min(min_x, x);
+            min_y = std::min(min_y, y);
+            max_x = std::max(max_x, x);
+            max_y = std::max(max_y, y);
+        }
+
+        quad.area = 4*half_w*half_h;
+        quad.fill = 1;
+        result.photos.push_back(quad);
+
+        const int x0 = std::max(0, static_cast<int>(min_x));
+        const int y0 = std::max(0, static_cast<int>(min_y));
+        const int x1 = std::min(w-1, static_cast<int>(max_x) + 1);
+        const int y1 = std::min(h-1, static_cast<int>(max_y) + 1);
+
+        for (int y = y0; y <= y1; ++y)
+        {
+            for (int x = x0; x <= x1; ++x)
+            {
+                // Back into the photo's own coordinates
+                const double u = (x - center_x)*c + (y - center_y)*s;
+                const double v = -(x - center_x)*s + (y - center_y)*c;
+
+                if (std::abs(u) > half_w || std::abs(v) > half_h)
+                    continue;
+
+                const double shade = 30*(u/half_w) - 20*(v/half_h);
+                std::array<double, 3>& p = page[static_cast<std::size_t>(y)*w + x];
+
+                for (int k = 0; k < 3; ++k)
+                    p[k] = base[k] + shade + 3*noise(rng);
+            }
+        }
+    }
+
+    typename Pixels<N>::PixelArray pixels(w, h);
+
+    for (int y = 0; y < h; ++y)
+    {
+        unsigned char* row = pixels.row(y);
+
+        for (int x = 0; x < w; ++x, row += N)
+        {
+            const std::array<double, 3>& p = page[static_cast<std::size_t>(y)*w + x];
+            std::array<unsigned char, 3> rgb;
+
+            for (int k = 0; k < 3; ++k)
+                rgb[k] = static_cast<unsigned char>(std::min(255.0, std::max(0.0, std::round(p[k]))));
+
+            if (N == 1)
+            {
+                row[0] = (rgb[0] + rgb[1] + rgb[2])/3;
+            }
+            else
+            {
+                for (int k = 0; k < 3; ++k)
+                    row[k] = rgb[k];
+
+                if (N == 4)
+                    row[N-1] = 255;
+            }
+        }
+    }
+
+    result.img = Pixels<N>(std::move(pixels), "synthetic");
+    return result;
+}
+
+#endif
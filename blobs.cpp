@@ -1,10 +1,33 @@
+#include <limits>
+
 #include "blobs.h"
 
 const int Blobs::default_label = 0;
 
+// Big enough that most objects are in only one or a few cells
+const int Blobs::cell_size = 64;
+
+Blobs::Blobs(Arena* arena)
+    : objects(arena), cell_starts(arena), cell_labels(arena)
+{
+    objects.reset(0);
+}
+
+Blobs::Blobs(const PaletteImage& img, LabelingMethod method, ContourMode contours,
+        Arena* arena)
+    : Blobs(img, UnionFind<DisjointForest<int>>(), method, contours, arena)
+{
+}
+
 Blobs::Blobs(Blobs&& other)
-    : w(other.w), h(other.h), set(std::move(other.set)),
-      objs(std::move(other.objs)), labels(std::move(other.labels))
+    : w(other.w), h(other.h), objects(std::move(other.objects)),
+      labels(std::move(other.labels)), labels16(std::move(other.labels16)),
+      labels8(std::move(other.labels8)), label_bytes(other.label_bytes),
+      grid_w(other.grid_w), grid_h(other.grid_h),
+      cell_starts(std::move(other.cell_starts)),
+      cell_labels(std::move(other.cell_labels)),
+      contour_points(std::move(other.contour_points)),
+      contour_starts(std::move(other.contour_starts))
 {
 }
 
@@ -12,47 +35,158 @@ Blobs& Blobs::operator=(Blobs&& other)
 {
     w = other.w;
     h = other.h;
-    set = std::move(other.set);
-    objs = std::move(other.objs);
+    objects = std::move(other.objects);
     labels = std::move(other.labels);
+    labels16 = std::move(other.labels16);
+    labels8 = std::move(other.labels8);
+    label_bytes = other.label_bytes;
+    grid_w = other.grid_w;
+    grid_h = other.grid_h;
+    cell_starts = std::move(other.cell_starts);
+    cell_labels = std::move(other.cell_labels);
+    contour_points = std::move(other.contour_points);
+    contour_starts = std::move(other.contour_starts);
 
     return *this;
 }
 
+void Blobs::write(CacheWriter& out) const
+{
+    out.value(w);
+    out.value(h);
+    out.value(label_bytes);
+
+    if (label_bytes == 1)
+        out.array(labels8);
+    else if (label_bytes == 2)
+        out.array(labels16);
+    else
+        out.array(labels);
+
+    out.array(objects.ends);
+    out.array(objects.boxes);
+    out.array(objects.moments);
+    out.array(objects.colors);
+    out.array(contour_starts);
+    out.array(contour_points);
+}
+
+void Blobs::read(CacheReader& in)
+{
+    w = in.value<int>();
+    h = in.value<int>();
+    label_bytes = in.value<int>();
+
+    labels.clear();
+    labels16.clear();
+    labels8.clear();
+
+    if (label_bytes == 1)
+        in.array(labels8);
+    else if (label_bytes == 2)
+        in.array(labels16);
+    else
+        in.array(labels);
+
+    in.array(objects.ends);
+    in.array(objects.boxes);
+    in.array(objects.moments);
+    in.array(objects.colors);
+    in.array(contour_starts);
+    in.array(contour_points);
+
+    const std::size_t count = objects.ends.size();
+    const std::size_t pixels = labels.size() + labels16.size() + labels8.size();
+
+    if (w < 0 || h < 0 || pixels != static_cast<std::size_t>(w)*h || count == 0 ||
+        (label_bytes != 1 && label_bytes != 2 && label_bytes != static_cast<int>(sizeof(int))) ||
+        label_bytes < labelBytes(count-1) ||
+        objects.boxes.size() != count || objects.moments.size() != count ||
+        objects.colors.size() != count ||
+        (!contour_starts.empty() && (contour_starts.size() != count+1 ||
+            contour_starts.back() != contour_points.size())))
+        throw std::runtime_error("blobs don't fit together");
+
+    // The index is built from the boxes and the outlines are cut out between
+    // the starts, so those have to be in range
+    for (std::size_t label = 1; label < count; ++label)
+    {
+        const Rect& box = objects.boxes[label];
+
+        if (box.tl.x < 0 || box.tl.y < 0 || box.tl.x > box.br.x || box.tl.y > box.br.y ||
+            box.br.x >= w || box.br.y >= h)
+            throw std::runtime_error("blobs don't fit together");
+    }
+
+    if (!contour_starts.empty() && contour_starts.front() != 0)
+        throw std::runtime_error("blobs don't fit together");
+
+    for (std::size_t i = 1; i < contour_starts.size(); ++i)
+        if (contour_starts[i] < contour_starts[i-1])
+            throw std::runtime_error("blobs don't fit together");
+
+    // Labels are used to look up objects and outline points to look up
+    // labels, so every one of those has to be in range too
+    auto checkLabels = [count](const auto& values)
+    {
+        for (const auto value : values)
+            if (value < 0 || static_cast<std::size_t>(value) >= count)
+                throw std::runtime_error("blobs don't fit together");
+    };
+
+    if (label_bytes == 1)
+        checkLabels(labels8);
+    else if (label_bytes == 2)
+        checkLabels(labels16);
+    else
+        checkLabels(labels);
+
+    for (const Coord& p : contour_points)
+        if (p.x < 0 || p.y < 0 || p.x >= w || p.y >= h)
+            throw std::runtime_error("blobs don't fit together");
+
+    buildIndex();
+}
+
 int Blobs::label(const Coord& p) const
 {
     if (p.x >= 0 && p.x < w &&
         p.y >= 0 && p.y < h)
-        return labels[p.y][p.x];
+        return labelAt(static_cast<std::size_t>(p.y)*w+p.x);
     else
         return default_label;
 }
 
 std::vector<Coord> Blobs::in(const Coord& p1, const Coord& p2) const
 {
-    std::set<int> used_labels;
     std::vector<Coord> subset;
 
-    for (int y = p1.y; y < p2.y; ++y)
+    if (p1.x >= p2.x || p1.y >= p2.y)
+        return subset;
+
+    // Not including p2
+    const Rect rect(p1, Coord(p2.x-1, p2.y-1));
+
+    for (const int label : overlapping(rect))
     {
-        for (int x = p1.x; x < p2.x; ++x)
-        {
-            if (labels[y][x] != default_label &&
-                    used_labels.find(labels[y][x]) == used_labels.end())
-            {
-                const std::map<int, CoordPair>::const_iterator obj = objs.find(labels[y][x]);
-
-                if (obj != objs.end())
-                {
-                    subset.push_back(obj->second.first);
-                    used_labels.insert(labels[y][x]);
-                }
-                else
-                {
-                    log("couldn't find object with label");
-                }
-            }
-        }
+        const Rect& box = objects.boxes[label];
+
+        // If it's all inside, some of it has to be, otherwise look for a pixel
+        // of it where the box and rectangle overlap
+        bool found = box.tl.x >= rect.tl.x && box.tl.y >= rect.tl.y &&
+                     box.br.x <= rect.br.x && box.br.y <= rect.br.y;
+
+        const int min_x = std::max(std::max(box.tl.x, rect.tl.x), 0);
+        const int max_x = std::min(std::min(box.br.x, rect.br.x), w-1);
+        const int min_y = std::max(std::max(box.tl.y, rect.tl.y), 0);
+        const int max_y = std::min(std::min(box.br.y, rect.br.y), h-1);
+
+        for (int y = min_y; y <= max_y && !found; ++y)
+            for (int x = min_x; x <= max_x && !found; ++x)
+                found = labelAt(static_cast<std::size_t>(y)*w+x) == label;
+
+        if (found)
+            subset.push_back(objects.ends[label].first);
     }
 
     return subset;
@@ -62,15 +196,14 @@ std::vector<Coord> Blobs::startIn(const Coord& p1, const Coord& p2) const
 {
     std::vector<Coord> subset;
 
-    for (const std::pair<int, CoordPair>& p : objs)
+    // The first point is in the box, so only these could start in it
+    for (const int label : overlapping(Rect(p1, p2)))
     {
-        if (p.second.first.y >= p1.y && p.second.first.y <= p2.y &&
-            p.second.first.x >= p1.x && p.second.first.x <= p2.x)
-            subset.push_back(p.second.first);
+        const Coord& first = objects.ends[label].first;
 
-        // Break early when we've gone past it
-        else if (p.second.first.y > p2.y)
-            break;
+        if (first.y >= p1.y && first.y <= p2.y &&
+            first.x >= p1.x && first.x <= p2.x)
+            subset.push_back(first);
     }
 
     return subset;
@@ -78,10 +211,382 @@ std::vector<Coord> Blobs::startIn(const Coord& p1, const Coord& p2) const
 
 CoordPair Blobs::object(int label) const
 {
-    const std::map<int, CoordPair>::const_iterator obj = objs.find(label);
-
-    if (obj != objs.end())
-        return obj->second;
+    if (label > 0 && label < static_cast<int>(objects.ends.size()))
+        return objects.ends[label];
     else
         return CoordPair();
 }
+
+Rect Blobs::bounds(int label) const
+{
+    if (label > 0 && label < static_cast<int>(objects.boxes.size()))
+        return objects.boxes[label];
+    else
+        return default_rect;
+}
+
+int Blobs::area(int label) const
+{
+    if (label > 0 && label < static_cast<int>(objects.moments.size()))
+        return objects.moments[label].area;
+    else
+        return 0;
+}
+
+Coord Blobs::center(int label) const
+{
+    if (label > 0 && label < static_cast<int>(objects.moments.size()))
+    {
+        const Moments& m = objects.moments[label];
+        return Coord(std::lround(1.0*m.x/m.area), std::lround(1.0*m.y/m.area));
+    }
+    else
+    {
+        return default_coord;
+    }
+}
+
+Moments Blobs::moments(int label) const
+{
+    if (label > 0 && label < static_cast<int>(objects.moments.size()))
+        return objects.moments[label];
+    else
+        return Moments();
+}
+
+BlobShape Blobs::shape(int label) const
+{
+    BlobShape shape;
+    const Moments m = moments(label);
+
+    if (m.area == 0)
+        return shape;
+
+    // Central moments, with each pixel being a unit square rather than a
+    // point, so a single pixel is 1 by 1
+    const double n = m.area;
+    const double cx = m.x/n;
+    const double cy = m.y/n;
+    const double xx = m.xx/n - cx*cx + 1.0/12;
+    const double yy = m.yy/n - cy*cy + 1.0/12;
+    const double xy = m.xy/n - cx*cy;
+
+    // How spread out it is along its long and short axes. A solid rectangle
+    // l long has l*l/12 along that side.
+    const double middle = (xx + yy)/2;
+    const double spread = std::sqrt((xx - yy)*(xx - yy)/4 + xy*xy);
+
+    shape.angle = std::atan2(2*xy, xx - yy)/2;
+    shape.length = std::sqrt(12*(middle + spread));
+    shape.width = std::sqrt(12*std::max(0.0, middle - spread));
+
+    if (shape.length*shape.width > 0)
+        shape.rectangularity = n/(shape.length*shape.width);
+
+    return shape;
+}
+
+std::vector<int> Blobs::overlapping(const Rect& rect) const
+{
+    std::vector<int> found;
+
+    if (grid_w == 0 || grid_h == 0 || rect.br.x < 0 || rect.br.y < 0 ||
+        rect.tl.x >= w || rect.tl.y >= h || rect.tl.x > rect.br.x || rect.tl.y > rect.br.y)
+        return found;
+
+    const int first_x = std::max(rect.tl.x, 0)/cell_size;
+    const int first_y = std::max(rect.tl.y, 0)/cell_size;
+    const int last_x = std::min(rect.br.x, w-1)/cell_size;
+    const int last_y = std::min(rect.br.y, h-1)/cell_size;
+
+    for (int cy = first_y; cy <= last_y; ++cy)
+    {
+        for (int cx = first_x; cx <= last_x; ++cx)
+        {
+            const int cell = cy*grid_w + cx;
+
+            for (int i = cell_starts[cell]; i < cell_starts[cell+1]; ++i)
+            {
+                const int label = cell_labels[i];
+                const Rect& box = objects.boxes[label];
+
+                if (box.br.x < rect.tl.x || box.tl.x > rect.br.x ||
+                    box.br.y < rect.tl.y || box.tl.y > rect.br.y)
+                    continue;
+
+                // Objects are in every cell their box is in, so only count
+                // each in the first cell where it and the rectangle both are
+                if (cx == std::max(first_x, box.tl.x/cell_size) &&
+                    cy == std::max(first_y, box.tl.y/cell_size))
+                    found.push_back(label);
+            }
+        }
+    }
+
+    std::sort(found.begin(), found.end());
+
+    return found;
+}
+
+Blobs::Objects::Objects(Arena* arena)
+    : ends(arena), boxes(arena), moments(arena), colors(arena)
+{
+}
+
+void Blobs::Objects::reset(std::size_t count)
+{
+    ends.clear();
+    boxes.clear();
+    moments.clear();
+    colors.clear();
+
+    ends.reserve(count+1);
+    boxes.reserve(count+1);
+    moments.reserve(count+1);
+
+    // Label 0 isn't an object
+    add(CoordPair(), default_rect, Moments());
+}
+
+int Blobs::Objects::add(const CoordPair& pair, const Rect& box, const Moments& m)
+{
+    ends.push_back(pair);
+    boxes.push_back(box);
+    moments.push_back(m);
+
+    return ends.size() - 1;
+}
+
+void Blobs::Objects::extend(int label, const Coord& p)
+{
+    ends[label].last = p;
+    growBox(boxes[label], p);
+    moments[label].add(p);
+}
+
+int Blobs::labelBytes(std::size_t count)
+{
+    if (count <= std::numeric_limits<std::uint8_t>::max())
+        return 1;
+    else if (count <= std::numeric_limits<std::uint16_t>::max())
+        return 2;
+    else
+        return sizeof(int);
+}
+
+void Blobs::narrowLabels(ThreadPool& pool)
+{
+    label_bytes = labelBytes(size());
+
+    if (label_bytes == static_cast<int>(sizeof(int)))
+        return;
+
+    if (label_bytes == 1)
+        labels8.resize(labels.size());
+    else
+        labels16.resize(labels.size());
+
+    parallelFor(0, h, 64, [&](int start, int end)
+    {
+        const std::size_t first = static_cast<std::size_t>(start)*w;
+        const std::size_t last = static_cast<std::size_t>(end)*w;
+
+        auto narrow = [&](auto* out)
+        {
+            for (std::size_t i = first; i < last; ++i)
+                out[i] = labels[i];
+        };
+
+        if (label_bytes == 1)
+            narrow(labels8.data());
+        else
+            narrow(labels16.data());
+    }, pool);
+
+    PoolVector<int>().swap(labels);
+}
+
+void Blobs::buildIndex()
+{
+    grid_w = (w + cell_size - 1)/cell_size;
+    grid_h = (h + cell_size - 1)/cell_size;
+
+    const int count = size();
+    cell_starts.assign(static_cast<std::size_t>(grid_w)*grid_h + 1, 0);
+
+    // Count how many are in each cell, then put them in place, which keeps
+    // them in label order in each cell
+    for (int label = 1; label <= count; ++label)
+    {
+        const Rect& box = objects.boxes[label];
+
+        for (int cy = box.tl.y/cell_size; cy <= box.br.y/cell_size; ++cy)
+            for (int cx = box.tl.x/cell_size; cx <= box.br.x/cell_size; ++cx)
+                ++cell_starts[cy*grid_w + cx + 1];
+    }
+
+    for (std::size_t i = 1; i < cell_starts.size(); ++i)
+        cell_starts[i] += cell_starts[i-1];
+
+    std::vector<int> next(cell_starts.begin(), cell_starts.end() - 1);
+    cell_labels.assign(cell_starts.back(), default_label);
+
+    for (int label = 1; label <= count; ++label)
+    {
+        const Rect& box = objects.boxes[label];
+
+        for (int cy = box.tl.y/cell_size; cy <= box.br.y/cell_size; ++cy)
+            for (int cx = box.tl.x/cell_size; cx <= box.br.x/cell_size; ++cx)
+                cell_labels[next[cy*grid_w + cx]++] = label;
+    }
+}
+
+void Blobs::growBox(Rect& box, const Coord& p)
+{
+    box.tl.x = std::min(box.tl.x, p.x);
+    box.tl.y = std::min(box.tl.y, p.y);
+    box.br.x = std::max(box.br.x, p.x);
+    box.br.y = std::max(box.br.y, p.y);
+}
+
+std::vector<Coord> Blobs::contour(int label) const
+{
+    if (label > 0 && label+1 < static_cast<int>(contour_starts.size()))
+        return std::vector<Coord>(contour_points.begin() + contour_starts[label],
+                                  contour_points.begin() + contour_starts[label+1]);
+    else
+        return std::vector<Coord>();
+}
+
+void Blobs::traceContours(const std::vector<int>& wanted)
+{
+    // In order, so the borders end up in label order
+    std::vector<int> which;
+    which.reserve(wanted.size());
+
+    for (const int label : wanted)
+        if (label > 0 && label <= static_cast<int>(size()))
+            which.push_back(label);
+
+    std::sort(which.begin(), which.end());
+    which.erase(std::unique(which.begin(), which.end()), which.end());
+
+    traceContours(which, ThreadPool::global());
+}
+
+void Blobs::traceContours(const std::vector<int>& which, ThreadPool& pool)
+{
+    typedef std::vector<Coord>::size_type size_type;
+
+    const int count = size();
+    const int traced = which.size();
+
+    // A few more pieces than threads, each with its own labels and its own
+    // output, so the borders can be put together in order afterwards
+    const int pieces = std::max(1, std::min(traced, 4*(pool.size()+1)));
+    std::vector<std::vector<Coord>> borders(pieces);
+    std::vector<size_type> lengths(count+1, 0);
+
+    parallelFor(0, pieces, 1, [&](int start, int end)
+    {
+        for (int piece = start; piece < end; ++piece)
+        {
+            const int first = static_cast<long long>(traced)*piece/pieces;
+            const int last  = static_cast<long long>(traced)*(piece+1)/pieces;
+
+            for (int i = first; i < last; ++i)
+            {
+                const int label = which[i];
+                const size_type before = borders[piece].size();
+                traceContour(label, objects.ends[label].first, borders[piece]);
+                lengths[label] = borders[piece].size() - before;
+            }
+        }
+    }, pool);
+
+    contour_starts.assign(count+2, 0);
+
+    for (int label = 1; label <= count; ++label)
+        contour_starts[label+1] = contour_starts[label] + lengths[label];
+
+    // The lengths aren't known until the pieces are traced, so they're copied
+    // over after. Reserving doesn't touch the memory yet, and each piece is
+    // freed as soon as it's copied, so only about one piece more than all the
+    // points is in use at once rather than twice as many.
+    contour_points.clear();
+    contour_points.reserve(contour_starts[count+1]);
+
+    for (std::vector<Coord>& border : borders)
+    {
+        contour_points.insert(contour_points.end(), border.begin(), border.end());
+        std::vector<Coord>().swap(border);
+    }
+}
+
+void Blobs::traceContour(int label, const Coord& first, std::vector<Coord>& border) const
+{
+    // Clockwise, starting to the right
+    //  5 6 7
+    //  4   0
+    //  3 2 1
+    static const std::array<Coord, 8> around = {{
+        Coord( 1,  0),
+        Coord( 1,  1),
+        Coord( 0,  1),
+        Coord(-1,  1),
+        Coord(-1,  0),
+        Coord(-1, -1),
+        Coord( 0, -1),
+        Coord( 1, -1)
+    }};
+
+    auto inside = [&](const Coord& p) -> bool
+    {
+        return p.x >= 0 && p.x < w && p.y >= 0 && p.y < h &&
+            labelAt(static_cast<std::size_t>(p.y)*w+p.x) == label;
+    };
+
+    // Nothing to the left of the first point is part of the object, so go
+    // clockwise from there to find the last point of the border
+    int back = -1;
+
+    for (int i = 0; i < 8 && back == -1; ++i)
+        if (inside(first + around[(4+i)%8]))
+            back = (4+i)%8;
+
+    // Just one pixel
+    if (back == -1)
+    {
+        border.push_back(first);
+        return;
+    }
+
+    const Coord last = first + around[back];
+    Coord current = first;
+
+    while (true)
+    {
+        border.push_back(current);
+
+        // Go counterclockwise from the previous point to find the next
+        int next = back;
+
+        for (int i = 1; i <= 8; ++i)
+        {
+            next = (back + 8 - i)%8;
+
+            if (inside(current + around[next]))
+                break;
+        }
+
+        const Coord position = current + around[next];
+
+        // Back where we started, going the same way
+        if (position == first && current == last)
+            break;
+
+        // The direction from the new point back to this one
+        back = (next + 4)%8;
+        current = position;
+    }
+}
@@ -4,18 +4,67 @@
  *   const Blobs blobs(img);
  *   for (const CoordPair& b : blobs)
  *     std::cout << b.first << std::endl;
+ *
+ * Objects are numbered 1, 2, ... in the order their first points appear when
+ * going through the image row by row, and iterating goes in that order.
+ *
+ * Both the labeling algorithm and the union find used to keep track of
+ * equivalent labels can be picked, e.g. to compare against the original
+ * neighbor checking and std::set implementation:
+ *   const Blobs blobs(img, UnionFind<DisjointSet<int>>(), LabelingMethod::Neighbors);
+ *
+ * or to label on all cores:
+ *   const Blobs blobs(img, LabelingMethod::Strips);
+ *
+ * The outer border of every object can also be found while labeling, rather
+ * than walking around each one afterwards with Outline:
+ *   const Blobs blobs(img, LabelingMethod::Strips, ContourMode::Trace);
+ *   std::vector<Coord> border = blobs.contour(blobs.label(b.first));
+ *
+ * Along with the first and last point, the bounding box, color, and moments
+ * (number of pixels, center, and spread) of each object are found while
+ * labeling. They're kept in an array for each, indexed by label, and a grid
+ * over the image is made of which objects' boxes are in each cell, so finding
+ * the objects in part of the image doesn't look at the pixels:
+ *   for (int label : blobs.overlapping(Rect(Coord(0, 0), Coord(99, 99))))
+ *       std::cout << blobs.area(label) << " " << blobs.center(label) << std::endl;
+ *
+ * The moments also say about what shape an object is without finding its
+ * outline, e.g. to skip those too thin to be a photo:
+ *   if (blobs.shape(label).width < 20)
+ *       continue;
+ *
+ * These can be kept in an arena, in which case it has to outlive the blobs:
+ *   const Blobs blobs(img, LabelingMethod::Strips, ContourMode::Trace, &page_arena);
+ *
+ * A quantized image can be labeled from the index of each pixel's color,
+ * which is less to read than all of its channels:
+ *   const Blobs blobs(img.blurQuantizeIndices(2, 10), LabelingMethod::Strips);
+ *
+ * Once labeled, each pixel's label is kept in as few bytes as fit the number
+ * of objects, so usually two.
  */
 
 #ifndef H_BLOBS
 #define H_BLOBS
 
-#include <map>
+#include <array>
 #include <vector>
+#include <cstdint>
+#include <numeric>
+#include <algorithm>
+#include <type_traits>
 
 #include "log.h"
+#include "arena.h"
+#include "bufferpool.h"
+#include "cache.h"
+#include "rect.h"
 #include "pixels.h"
-#include "maputils.h"
+#include "palette.h"
+#include "threadpool.h"
 #include "disjointset.h"
+#include "disjointforest.h"
 
 // Remember the first and last times we saw a label so we can search just part
 // of the image when updating a label.
@@ -29,31 +78,279 @@ struct CoordPair
         :first(f), last(l) { }
 };
 
+// Sums over the pixels of an object
+struct Moments
+{
+    long long area = 0;
+    long long x = 0;
+    long long y = 0;
+    long long xx = 0;
+    long long yy = 0;
+    long long xy = 0;
+
+    void add(const Coord& p)
+    {
+        ++area;
+        x += p.x;
+        y += p.y;
+        xx += 1LL*p.x*p.x;
+        yy += 1LL*p.y*p.y;
+        xy += 1LL*p.x*p.y;
+    }
+
+    Moments& operator+=(const Moments& other)
+    {
+        area += other.area;
+        x += other.x;
+        y += other.y;
+        xx += other.xx;
+        yy += other.yy;
+        xy += other.xy;
+
+        return *this;
+    }
+};
+
+// The solid rectangle with the same moments as an object, which is exactly
+// the object if it's a solid rectangle
+struct BlobShape
+{
+    // Of the long side, in radians clockwise from the x axis (since y goes
+    // down), between -pi/2 and pi/2
+    double angle = 0;
+
+    // Lengths of the sides
+    double length = 0;
+    double width = 0;
+
+    // Number of pixels over the area of the rectangle, about 1 for anything
+    // solid and convex, and less if there are holes or it's spread out
+    double rectangularity = 0;
+};
+
+// Used to pick the disjoint set when labeling. Set can be anything with the
+// same interface as DisjointSet<int>.
+template<class Set>
+struct UnionFind { };
+
+// How to do the first labeling pass, both give the same objects
+enum class LabelingMethod
+{
+    // Look at all four previous neighbors of every pixel and join all the
+    // labels of those that are the same color
+    Neighbors,
+
+    // Go through a decision tree on the scan mask to look at as few
+    // neighbors as possible, with separate loops for the image border
+    DecisionTree,
+
+    // Use the decision tree on horizontal strips of the image, each on its
+    // own thread, then join labels across the seams between strips
+    Strips
+};
+
+// Whether to find the border of every object after labeling
+enum class ContourMode
+{
+    None,
+
+    // Follow the outer border of each object starting from its first point
+    // (Suzuki and Abe, "Topological structural analysis of digitized binary
+    // images by border following"), all in parallel
+    Trace
+};
+
+// An image as labeling sees it, a row at a time with each pixel one integer
+// that's the same wherever the colors are, so comparing colors is one compare
+// rather than one for each channel
+template<class Image>
+class PackedImage;
+
+template<int N>
+class PackedImage<Pixels<N>>
+{
+    const typename Pixels<N>::PixelArray& pixels;
+
+public:
+    // With one channel the pixels already are
+    typedef typename std::conditional<N == 1, unsigned char, std::uint32_t>::type value_type;
+
+    explicit PackedImage(const Pixels<N>& img)
+        :pixels(img.ref()) { }
+
+    int width() const { return pixels.width(); }
+    int height() const { return pixels.height(); }
+
+    // Row y, packed into buffer if it needs to be, which has to have room for
+    // the whole row
+    const value_type* row(int y, value_type* buffer) const
+    {
+        if constexpr (N == 1)
+        {
+            return pixels.row(y);
+        }
+        else
+        {
+            const std::array<unsigned char, N>* in = pixels[y];
+
+            for (int x = 0; x < pixels.width(); ++x)
+                buffer[x] = packPixel<N>(in[x]);
+
+            return buffer;
+        }
+    }
+
+    // With the channels past N left zero
+    std::array<unsigned char, 4> color(const Coord& p) const
+    {
+        std::array<unsigned char, 4> c = {};
+        std::copy(pixels.row(p.y) + p.x*N, pixels.row(p.y) + (p.x+1)*N, c.begin());
+
+        return c;
+    }
+};
+
+template<>
+class PackedImage<PaletteImage>
+{
+    const PaletteImage& indices;
+
+public:
+    typedef PaletteImage::Index value_type;
+
+    explicit PackedImage(const PaletteImage& img)
+        :indices(img) { }
+
+    int width() const { return indices.width(); }
+    int height() const { return indices.height(); }
+
+    const value_type* row(int y, value_type*) const { return indices.row(y); }
+
+    std::array<unsigned char, 4> color(const Coord& p) const
+    {
+        return indices.color(indices.row(p.y)[p.x]);
+    }
+};
+
 class Blobs
 {
 public:
     static const int default_label;
-    typedef std::map<int, CoordPair>::size_type size_type;
-    typedef MapValueIterator<std::map<int, CoordPair>> const_iterator;
+    typedef ArenaVector<CoordPair>::size_type size_type;
+    typedef ArenaVector<CoordPair>::const_iterator const_iterator;
 
 private:
+    // Everything about the objects, with the label as the index into each of
+    // these and 0 unused
+    struct Objects
+    {
+        ArenaVector<CoordPair> ends;
+        ArenaVector<Rect> boxes;
+        ArenaVector<Moments> moments;
+
+        // Every pixel of an object is exactly the same color, so this is the
+        // color of its first pixel, with the channels past N left zero
+        ArenaVector<std::array<unsigned char, 4>> colors;
+
+        explicit Objects(Arena* arena = nullptr);
+
+        // Start over with room for count objects
+        void reset(std::size_t count);
+
+        // Returns the new label
+        int add(const CoordPair& ends, const Rect& box, const Moments& moments);
+
+        // Add a point after all the others seen so far
+        void extend(int label, const Coord& p);
+    };
+
     int w = 0;
     int h = 0;
-    DisjointSet<int> set;
-    std::map<int, CoordPair> objs;
-    std::vector<std::vector<int>> labels;
+    Objects objects;
+
+    // Every pixel's label row by row, w*h of them. While labeling they're in
+    // labels, and afterwards in whichever of these is the narrowest that fits
+    // all of them, which label_bytes says.
+    PoolVector<int> labels;
+    PoolVector<std::uint16_t> labels16;
+    PoolVector<std::uint8_t> labels8;
+    int label_bytes = sizeof(int);
+
+    // The labels of the objects whose boxes are in each cell of the grid,
+    // row by row, where cell i has those from cell_starts[i] up to
+    // cell_starts[i+1]
+    static const int cell_size;
+    int grid_w = 0;
+    int grid_h = 0;
+    ArenaVector<int> cell_starts;
+    ArenaVector<int> cell_labels;
+
+    // All the borders one after the other, where the border of label i is
+    // from contour_starts[i] up to contour_starts[i+1]
+    PoolVector<Coord> contour_points;
+    std::vector<std::size_t> contour_starts;
 
 public:
-    template<int N> Blobs(const Pixels<N>& img);
+    // No objects, e.g. to read into
+    explicit Blobs(Arena* arena = nullptr);
+    template<int N> Blobs(const Pixels<N>& img,
+        LabelingMethod method = LabelingMethod::DecisionTree,
+        ContourMode contours = ContourMode::None, Arena* arena = nullptr);
+    template<int N, class Set> Blobs(const Pixels<N>& img, UnionFind<Set>,
+        LabelingMethod method = LabelingMethod::DecisionTree,
+        ContourMode contours = ContourMode::None, Arena* arena = nullptr);
+    Blobs(const PaletteImage& img,
+        LabelingMethod method = LabelingMethod::DecisionTree,
+        ContourMode contours = ContourMode::None, Arena* arena = nullptr);
+    template<class Set> Blobs(const PaletteImage& img, UnionFind<Set>,
+        LabelingMethod method = LabelingMethod::DecisionTree,
+        ContourMode contours = ContourMode::None, Arena* arena = nullptr);
     int label(const Coord& p) const;
     CoordPair object(int label) const;
 
+    // Smallest rectangle containing every pixel of the object, including
+    // both corners, or default_rect if there's no such object
+    Rect bounds(int label) const;
+
+    // Number of pixels in the object, and their average position rounded
+    int area(int label) const;
+    Coord center(int label) const;
+
+    // Sums over the pixels, and the rectangle they'd be if it were solid
+    Moments moments(int label) const;
+    BlobShape shape(int label) const;
+
+    // Of every pixel in the object
+    template<int N> std::array<unsigned char, N> color(int label) const;
+
+    // Labels of the objects with bounding boxes overlapping the rectangle
+    // (including both corners), in order
+    std::vector<int> overlapping(const Rect& rect) const;
+
+    // Pixels of the object along its outer border, clockwise from its first
+    // point. Empty unless constructed with ContourMode::Trace or traced with
+    // traceContours.
+    std::vector<Coord> contour(int label) const;
+
+    // Find the borders of only these objects, replacing any found before,
+    // e.g. the few worth outlining after ruling the rest out by their
+    // moments. The others are left empty.
+    void traceContours(const std::vector<int>& wanted);
+
     // Allow moving
     Blobs(Blobs&&);
     Blobs& operator=(Blobs&& other);
 
+    // Everything found, to read back in later rather than labeling again.
+    // Reading replaces these blobs with what was written, or throws
+    // std::runtime_error if it doesn't make sense.
+    void write(CacheWriter& out) const;
+    void read(CacheReader& in);
+
     // Get all first points that have part of the object in the rectangle
-    // around p1 and p2 (with p1 to the left and above p2).
+    // around p1 and p2 (with p1 to the left and above p2), in label order.
+    // Only the objects overlapping it are looked at, and only the pixels of
+    // those whose boxes aren't entirely inside it.
     std::vector<Coord> in(const Coord& p1, const Coord& p2) const;
 
     // Get all the first points of the label within a rectangle around
@@ -61,36 +358,162 @@ public:
     // of p1.
     std::vector<Coord> startIn(const Coord& p1, const Coord& p2) const;
 
-    // Standard functions
-    const_iterator begin() const { return objs.begin(); }
-    const_iterator end() const { return objs.end(); }
-    size_type size() const { return objs.size(); }
+    // Standard functions, going through the first and last points in label
+    // order, starting at 1
+    const_iterator begin() const { return objects.ends.begin() + 1; }
+    const_iterator end() const { return objects.ends.end(); }
+    size_type size() const { return objects.ends.size() - 1; }
 
 private:
+    // Label a PackedImage and find everything about the objects
+    template<class Image, class Set>
+    void find(const Image& img, LabelingMethod method, ContourMode contours);
+
     // Merge object o into object n by changing labels and updating object
     void switchLabel(int old_label, int new_label);
+
+    // Of pixel y*w+x, from whichever labels they're in
+    inline int labelAt(std::size_t i) const;
+
+    // Bytes needed for each label with this many objects
+    static int labelBytes(std::size_t count);
+
+    // Move the final labels from labels to the narrowest type that fits them
+    void narrowLabels(ThreadPool& pool);
+
+    // Make the box big enough to include the point
+    static void growBox(Rect& box, const Coord& p);
+
+    // First pass, giving every pixel a provisional label and saving which
+    // are equivalent in the set. Returns one past the largest label used.
+    template<class Image, class Set>
+    int labelNeighbors(const Image& img, Set& set);
+    // Only rows start to end, treating start as if it were the first row
+    template<class Image, class Set>
+    int labelDecisionTree(const Image& img, Set& set, int start, int end);
+
+    // Second pass, replacing the provisional labels with the final ones and
+    // finding the objects
+    template<class Set>
+    void resolve(const Set& set, int label_count);
+
+    // Both passes, in parallel
+    template<class Image, class Set>
+    void labelStrips(const Image& img, ThreadPool& pool);
+
+    // Put the objects into the grid after labeling
+    void buildIndex();
+
+    // Find the border of each of these objects, which are in order
+    void traceContours(const std::vector<int>& which, ThreadPool& pool);
+
+    // Append the outer border of the object starting at its first point
+    void traceContour(int label, const Coord& first, std::vector<Coord>& border) const;
 };
 
-// We only need to template this one function because it is the only one that
-// depends on the number of channels in a passed in image
+// By default use the flat union find since it's much faster
 template<int N>
-Blobs::Blobs(const Pixels<N>& img)
-    : set(default_label)
+Blobs::Blobs(const Pixels<N>& img, LabelingMethod method, ContourMode contours,
+        Arena* arena)
+    : Blobs(img, UnionFind<DisjointForest<int>>(), method, contours, arena)
 {
+}
+
+// We only need to template these functions because they are the only ones
+// that depend on the number of channels in a passed in image
+template<int N, class Set>
+Blobs::Blobs(const Pixels<N>& img, UnionFind<Set>, LabelingMethod method,
+        ContourMode contours, Arena* arena)
+    : objects(arena), cell_starts(arena), cell_labels(arena)
+{
+    find<PackedImage<Pixels<N>>, Set>(PackedImage<Pixels<N>>(img), method, contours);
+}
+
+template<class Set>
+Blobs::Blobs(const PaletteImage& img, UnionFind<Set>, LabelingMethod method,
+        ContourMode contours, Arena* arena)
+    : objects(arena), cell_starts(arena), cell_labels(arena)
+{
+    find<PackedImage<PaletteImage>, Set>(PackedImage<PaletteImage>(img), method, contours);
+}
+
+template<class Image, class Set>
+void Blobs::find(const Image& img, LabelingMethod method, ContourMode contours)
+{
+    Set set(default_label);
+
     w = img.width();
     h = img.height();
-    labels = std::vector<std::vector<int>>(h, std::vector<int>(w, default_label));
+    labels = PoolVector<int>(static_cast<std::vector<int>::size_type>(w)*h,
+            default_label);
+    objects.reset(0);
+
+    if (method == LabelingMethod::Strips)
+    {
+        labelStrips<Image, Set>(img, ThreadPool::global());
+    }
+    else
+    {
+        int next_label;
+
+        if (method == LabelingMethod::Neighbors)
+            next_label = labelNeighbors(img, set);
+        else
+            next_label = labelDecisionTree(img, set, 0, h);
+
+        resolve(set, next_label);
+        narrowLabels(ThreadPool::global());
+    }
+
+    objects.colors.assign(objects.ends.size(), std::array<unsigned char, 4>());
 
+    for (size_type label = 1; label < objects.ends.size(); ++label)
+        objects.colors[label] = img.color(objects.ends[label].first);
+
+    buildIndex();
+
+    if (contours == ContourMode::Trace)
+    {
+        std::vector<int> all(objects.ends.size() - 1);
+        std::iota(all.begin(), all.end(), 1);
+        traceContours(all, ThreadPool::global());
+    }
+}
+
+template<int N>
+std::array<unsigned char, N> Blobs::color(int label) const
+{
+    std::array<unsigned char, N> c = {};
+
+    if (label > 0 && label < static_cast<int>(objects.colors.size()))
+        std::copy(objects.colors[label].begin(), objects.colors[label].begin() + N, c.begin());
+
+    return c;
+}
+
+template<class Image, class Set>
+int Blobs::labelNeighbors(const Image& img, Set& set)
+{
+    typedef typename Image::value_type value_type;
     int next_label = default_label+1;
 
+    // Look at the pixels a row at a time, this one and the one above it,
+    // rather than through img.color()
+    std::vector<value_type> row_buffer(w);
+    std::vector<value_type> up_buffer(w);
+    const value_type* up = nullptr;
+
     // Go through points making them part of bordering objects if next to one
     // already and otherwise a new object
     for (int y = 0; y < h; ++y)
     {
+        row_buffer.swap(up_buffer);
+        const value_type* row = img.row(y, row_buffer.data());
+
         for (int x = 0; x < w; ++x)
         {
-            const Coord point(x, y);
-            const std::array<unsigned char, N> current_color = img.color(point);
+            const value_type current_color = row[x];
+            int& current_label = labels[y*w+x];
 
             const std::array<Coord, 4> points = {{
                 Coord(x-1, y),   // Left
@@ -121,18 +544,20 @@ Blobs::Blobs(const Pixels<N>& img)
                 // and we don't want to access memory outside of our arrays
                 if (p.x >= 0 && p.y >= 0 &&
                     p.x < w  && p.y < h &&
-                    img.color(p) == current_color)
+                    ((p.y == y)?row:up)[p.x] == current_color)
                 {
+                    const int neighbor_label = labels[p.y*w+p.x];
+
                     if (count == 0)
                     {
-                        labels[y][x] = labels[p.y][p.x];
+                        current_label = neighbor_label;
                     }
                     // Detect when we have multiple pixels of this color around
                     // us with different labels
-                    else if (labels[y][x] != labels[p.y][p.x])
+                    else if (current_label != neighbor_label)
                     {
                         different = true;
-                        equivalent_labels.push_back(labels[p.y][p.x]);
+                        equivalent_labels.push_back(neighbor_label);
                     }
 
                     ++count;
@@ -143,7 +568,7 @@ Blobs::Blobs(const Pixels<N>& img)
             if (count == 0)
             {
                 // New label for a potentially new object
-                labels[y][x] = next_label;
+                current_label = next_label;
                 set.add(next_label);
 
                 ++next_label;
@@ -153,20 +578,161 @@ Blobs::Blobs(const Pixels<N>& img)
             {
                 // Save that these are all equivalent to the current one
                 for (int label : equivalent_labels)
-                    set.join(labels[y][x], label);
+                    set.join(current_label, label);
             }
             // Otherwise: One neighbor same color or multiple but all same
             // label, and we already set the current pixel's label
         }
+
+        up = row;
     }
 
+    return next_label;
+}
+
+// Same result as labelNeighbors(), but rather than checking all the neighbors
+// this uses the decision tree from Wu, Otoo, and Suzuki, "Optimizing two-pass
+// connected-component labeling algorithms." With the scan mask
+//   a b c
+//   d x
+// the neighbors that touch each other (a-b, b-c, a-d, b-d) have already been
+// joined if they're the same color as x, so if b is the same color we're done,
+// and otherwise we need at most one join, of c with a or d.
+//
+// Note that the 2x2 block version of this doesn't apply here since we're
+// labeling every color rather than just black pixels, so the pixels in one
+// block are often different colors and can't share a label.
+template<class Image, class Set>
+int Blobs::labelDecisionTree(const Image& img, Set& set, int start, int end)
+{
+    typedef typename Image::value_type value_type;
+    int next_label = default_label+1;
+
+    // A new object, which may be joined with others later
+    auto newLabel = [&]() -> int
+    {
+        set.add(next_label);
+        return next_label++;
+    };
+
+    // c and one of a or d are the same color but may not have the same label
+    auto merge = [&](int c, int other) -> int
+    {
+        if (c != other)
+            set.join(c, other);
+
+        return c;
+    };
+
+    if (w == 0 || start >= end)
+        return next_label;
+
+    // This row and the one above it
+    std::vector<value_type> row_buffer(w);
+    std::vector<value_type> up_buffer(w);
+    const value_type* row = nullptr;
+    const value_type* up = nullptr;
+
+    auto next = [&](int y) -> const value_type*
+    {
+        row_buffer.swap(up_buffer);
+        return img.row(y, row_buffer.data());
+    };
+
+    // First row, only d exists
+    {
+        row = next(start);
+        int* lrow = &labels[static_cast<std::vector<int>::size_type>(start)*w];
+
+        lrow[0] = newLabel();
+
+        for (int x = 1; x < w; ++x)
+            lrow[x] = (row[x] == row[x-1])?lrow[x-1]:newLabel();
+    }
+
+    for (int y = start+1; y < end; ++y)
+    {
+        up = row;
+        row = next(y);
+        int* lrow = &labels[static_cast<std::vector<int>::size_type>(y)*w];
+        const int* lup = lrow - w;
+
+        // First column, only b and c exist
+        if (row[0] == up[0])
+            lrow[0] = lup[0];
+        else if (w > 1 && row[0] == up[1])
+            lrow[0] = lup[1];
+        else
+            lrow[0] = newLabel();
+
+        // Interior, all of a, b, c, and d exist
+        for (int x = 1; x < w-1; ++x)
+        {
+            const value_type current = row[x];
+
+            if (current == up[x])
+                lrow[x] = lup[x];
+            else if (current == up[x+1])
+            {
+                if (current == up[x-1])
+                    lrow[x] = merge(lup[x+1], lup[x-1]);
+                else if (current == row[x-1])
+                    lrow[x] = merge(lup[x+1], lrow[x-1]);
+                else
+                    lrow[x] = lup[x+1];
+            }
+            else if (current == up[x-1])
+                lrow[x] = lup[x-1];
+            else if (current == row[x-1])
+                lrow[x] = lrow[x-1];
+            else
+                lrow[x] = newLabel();
+        }
+
+        // Last column, c doesn't exist
+        if (w > 1)
+        {
+            const int x = w-1;
+            const value_type current = row[x];
+
+            if (current == up[x])
+                lrow[x] = lup[x];
+            else if (current == up[x-1])
+                lrow[x] = lup[x-1];
+            else if (current == row[x-1])
+                lrow[x] = lrow[x-1];
+            else
+                lrow[x] = newLabel();
+        }
+    }
+
+    return next_label;
+}
+
+template<class Set>
+void Blobs::resolve(const Set& set, int label_count)
+{
+    // Final label of each representative, numbered in the order we see them
+    std::vector<int> final_labels(label_count, default_label);
+
+    // One object for each representative, which is often far fewer than the
+    // provisional labels, so only make room for those
+    std::size_t object_count = 0;
+
+    for (int label = default_label+1; label < label_count; ++label)
+        if (set.find(label) == label)
+            ++object_count;
+
+    objects.reset(object_count);
+
     // Go through again reducing the labeling equivalences
     for (int y = 0; y < h; ++y)
     {
+        int* lrow = &labels[static_cast<std::vector<int>::size_type>(y)*w];
+
         for (int x = 0; x < w; ++x)
         {
-            const Coord point(x, y);
-            int currentLabel = labels[y][x];
+            int currentLabel = lrow[x];
 
             if (currentLabel != default_label)
             {
@@ -174,14 +740,22 @@ Blobs::Blobs(const Pixels<N>& img)
 
                 if (repLabel != set.notfound())
                 {
-                    labels[y][x] = repLabel;
+                    const Coord point(x, y);
+                    int& finalLabel = final_labels[repLabel];
 
                     // If not found, add this object
-                    if (objs.find(repLabel) == objs.end())
-                        objs[repLabel] = CoordPair(point, point);
+                    if (finalLabel == default_label)
+                    {
+                        Moments moments;
+                        moments.add(point);
+                        finalLabel = objects.add(CoordPair(point, point),
+                                Rect(point, point), moments);
+                    }
                     // If it is found, this is the last place we've seen the object
                     else
-                        objs[repLabel].last = point;
+                        objects.extend(finalLabel, point);
+
+                    lrow[x] = finalLabel;
                 }
                 else
                 {
@@ -192,4 +766,228 @@ Blobs::Blobs(const Pixels<N>& img)
     }
 }
 
+template<class Image, class Set>
+void Blobs::labelStrips(const Image& img, ThreadPool& pool)
+{
+    typedef std::vector<int>::size_type index;
+    typedef typename Image::value_type value_type;
+
+    if (w == 0 || h == 0)
+        return;
+
+    // Don't bother with tiny strips
+    const int min_rows = 64;
+    const int strips = std::max(1, std::min(pool.size(), h/min_rows));
+
+    // Strip i is rows starts[i] to starts[i+1]
+    std::vector<int> starts(strips+1);
+
+    for (int i = 0; i <= strips; ++i)
+        starts[i] = static_cast<long long>(h)*i/strips;
+
+    // Label each strip separately with its own labels starting at one
+    std::vector<Set> sets;
+    std::vector<int> counts(strips);
+    sets.reserve(strips);
+
+    for (int i = 0; i < strips; ++i)
+        sets.emplace_back(default_label);
+
+    parallelFor(0, strips, 1, [&](int first, int last)
+    {
+        for (int i = first; i < last; ++i)
+            counts[i] = labelDecisionTree(img, sets[i], starts[i], starts[i+1]) - 1;
+    }, pool);
+
+    // Strip i's labels come after all of the labels in the previous strips
+    std::vector<int> offsets(strips+1, 0);
+
+    for (int i = 0; i < strips; ++i)
+        offsets[i+1] = offsets[i] + counts[i];
+
+    const int total = offsets[strips];
+
+    // Put all the equivalences in one set using these combined labels
+    Set set(default_label);
+
+    for (int label = 1; label <= total; ++label)
+        set.add(label);
+
+    for (int i = 0; i < strips; ++i)
+    {
+        for (int label = 1; label <= counts[i]; ++label)
+        {
+            const int rep = sets[i].find(label);
+
+            if (rep != label && rep != sets[i].notfound())
+                set.join(offsets[i]+label, offsets[i]+rep);
+        }
+    }
+
+    sets.clear();
+
+    // Join across the seams, where the first row of each strip is next to
+    // the last row of the previous one. Unlike in the decision tree, we have
+    // to look at all of a, b, and c since they're in a different strip.
+    std::vector<value_type> row_buffer(w);
+    std::vector<value_type> up_buffer(w);
+
+    for (int i = 1; i < strips; ++i)
+    {
+        const int y = starts[i];
+        const value_type* row = img.row(y, row_buffer.data());
+        const value_type* up = img.row(y-1, up_buffer.data());
+        const int* lrow = &labels[static_cast<index>(y)*w];
+        const int* lup = lrow - w;
+
+        for (int x = 0; x < w; ++x)
+        {
+            const int current = offsets[i] + lrow[x];
+
+            for (int nx = std::max(0, x-1); nx <= x+1 && nx < w; ++nx)
+                if (row[x] == up[nx])
+                    set.join(current, offsets[i-1] + lup[nx]);
+        }
+    }
+
+    // What each combined label resolves to, so that we can look it up from
+    // multiple threads
+    std::vector<int> final_labels(total+1, default_label);
+
+    for (int label = 1; label <= total; ++label)
+        final_labels[label] = set.find(label);
+
+    // First and last points, bounding box, and moments of each label in each
+    // strip. Since every label was created at a pixel in its strip, they'll
+    // all be set.
+    std::vector<CoordPair> points(total+1);
+    std::vector<Rect> strip_boxes(total+1);
+    std::vector<Moments> moments(total+1);
+
+    parallelFor(0, strips, 1, [&](int first, int last)
+    {
+        for (int i = first; i < last; ++i)
+        {
+            std::vector<bool> seen(counts[i]+1, false);
+
+            for (int y = starts[i]; y < starts[i+1]; ++y)
+            {
+                const int* lrow = &labels[static_cast<index>(y)*w];
+
+                for (int x = 0; x < w; ++x)
+                {
+                    const int label = lrow[x];
+                    CoordPair& pair = points[offsets[i]+label];
+                    Rect& box = strip_boxes[offsets[i]+label];
+
+                    moments[offsets[i]+label].add(Coord(x, y));
+
+                    if (!seen[label])
+                    {
+                        pair.first = Coord(x, y);
+                        box = Rect(pair.first, pair.first);
+                        seen[label] = true;
+                    }
+                    else
+                    {
+                        growBox(box, Coord(x, y));
+                    }
+
+                    pair.last = Coord(x, y);
+                }
+            }
+        }
+    }, pool);
+
+    // Combine the points into the representatives. Going through the labels
+    // in order is going through the strips in order, so the first point is
+    // from whichever label we see first and the last from the one we see last.
+    std::vector<int> reps;
+
+    for (int label = 1; label <= total; ++label)
+    {
+        const int rep = final_labels[label];
+
+        if (rep == label)
+        {
+            reps.push_back(rep);
+        }
+        else
+        {
+            CoordPair& pair = points[rep];
+            const CoordPair& other = points[label];
+
+            if (other.first < pair.first)
+                pair.first = other.first;
+            if (pair.last < other.last)
+                pair.last = other.last;
+
+            growBox(strip_boxes[rep], strip_boxes[label].tl);
+            growBox(strip_boxes[rep], strip_boxes[label].br);
+
+            moments[rep] += moments[label];
+        }
+    }
+
+    // Number the objects in the order their first points appear, like the
+    // serial version
+    std::sort(reps.begin(), reps.end(), [&](int a, int b)
+    {
+        return points[a].first < points[b].first;
+    });
+
+    std::vector<int> numbers(total+1, default_label);
+    objects.reset(reps.size());
+
+    for (const int rep : reps)
+        numbers[rep] = objects.add(points[rep], strip_boxes[rep], moments[rep]);
+
+    for (int label = 1; label <= total; ++label)
+        final_labels[label] = numbers[final_labels[label]];
+
+    // Finally, relabel all the pixels, straight into the narrowest type that
+    // fits now that we know how many objects there are
+    label_bytes = labelBytes(reps.size());
+
+    if (label_bytes == 1)
+        labels8.resize(labels.size());
+    else if (label_bytes == 2)
+        labels16.resize(labels.size());
+
+    parallelFor(0, strips, 1, [&](int first, int last)
+    {
+        for (int i = first; i < last; ++i)
+        {
+            const index start = static_cast<index>(starts[i])*w;
+            const index end = static_cast<index>(starts[i+1])*w;
+
+            auto relabel = [&](auto* out)
+            {
+                for (index j = start; j < end; ++j)
+                    out[j] = final_labels[offsets[i] + labels[j]];
+            };
+
+            if (label_bytes == 1)
+                relabel(labels8.data());
+            else if (label_bytes == 2)
+                relabel(labels16.data());
+            else
+                relabel(labels.data());
+        }
+    }, pool);
+
+    if (label_bytes < static_cast<int>(sizeof(int)))
+        PoolVector<int>().swap(labels);
+}
+
+inline int Blobs::labelAt(std::size_t i) const
+{
+    if (label_bytes == 1)
+        return labels8[i];
+    else if (label_bytes == 2)
+        return labels16[i];
+    else
+        return labels[i];
+}
+
 #endif
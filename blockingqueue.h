@@ -0,0 +1,93 @@
+/*
+ * A queue with a maximum size for passing work between threads
+ *
+ *   BlockingQueue<int> q(4);
+ *
+ *   // Producer
+ *   q.push(1); // Waits if there are already 4 in the queue
+ *   q.close();
+ *
+ *   // Consumer
+ *   int i;
+ *   while (q.pop(i)) { ... }
+ *
+ * Once closed, everything already in the queue can still be popped, but
+ * nothing more can be pushed, and pop() returns false when it's empty.
+ */
+
+#ifndef H_BLOCKINGQUEUE
+#define H_BLOCKINGQUEUE
+
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <algorithm>
+#include <condition_variable>
+
+template<class T>
+class BlockingQueue
+{
+    std::deque<T> items;
+    std::size_t capacity;
+    bool closed = false;
+
+    std::mutex lock;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+
+public:
+    explicit BlockingQueue(std::size_t capacity)
+        : capacity(std::max<std::size_t>(1, capacity)) { }
+
+    // Wait for space and add an item. Returns false, dropping the item, if
+    // the queue was closed.
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> lck(lock);
+        not_full.wait(lck, [this]() { return closed || items.size() < capacity; });
+
+        if (closed)
+            return false;
+
+        items.push_back(std::move(item));
+        lck.unlock();
+        not_empty.notify_one();
+
+        return true;
+    }
+
+    // Wait for an item. Returns false if the queue is closed and empty.
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lck(lock);
+        not_empty.wait(lck, [this]() { return closed || !items.empty(); });
+
+        if (items.empty())
+            return false;
+
+        item = std::move(items.front());
+        items.pop_front();
+        lck.unlock();
+        not_full.notify_one();
+
+        return true;
+    }
+
+    // No more items will be added
+    void close()
+    {
+        {
+            std::unique_lock<std::mutex> lck(lock);
+            closed = true;
+        }
+
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+
+private:
+    BlockingQueue(const BlockingQueue&) = delete;
+    BlockingQueue& operator=(const BlockingQueue&) = delete;
+};
+
+#endif
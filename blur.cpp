@@ -0,0 +1,295 @@
+#include <cmath>
+
+#include "blur.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define BLUR_AVX2
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+BoxDivider::BoxDivider(int r)
+    : width(2*r+1)
+{
+    // With m = ceil(2^32/d), floor(n*m/2^32) = floor(n/d) as long as
+    // n < 2^32/d. Here d = 2*width and n is at most 511*width, so this works
+    // for boxes up to about 2000 pixels wide, far more than we'll use.
+    const std::uint64_t d = 2*static_cast<std::uint64_t>(width);
+    mul = ((static_cast<std::uint64_t>(1) << 32) + d - 1)/d;
+    exact = 511*static_cast<std::uint64_t>(width)*d < (static_cast<std::uint64_t>(1) << 32);
+}
+
+// sigma = standard deviation, n = number of boxes
+std::vector<int> boxesForGauss(int sigma, int n)
+{
+    // Ideal averaging filter width
+    double wIdeal = std::sqrt((12.0*sigma*sigma/n)+1);
+
+    int wl = std::floor(wIdeal);
+
+    if (wl%2 == 0)
+        wl--;
+
+    int wu = wl+2;
+    double mIdeal = (12.0*sigma*sigma - n*wl*wl - 4*n*wl - 3*n)/(-4*wl - 4);
+    int m = std::round(mIdeal);
+
+    std::vector<int> sizes(n);
+
+    for (int i = 0; i < n; ++i)
+        sizes[i] = (i<m)?wl:wu;
+
+    return sizes;
+}
+
+std::array<int, 3> gaussBoxRadii(int r)
+{
+    const std::vector<int> boxes = boxesForGauss(r, 3);
+    std::array<int, 3> radii;
+
+    for (int i = 0; i < 3; ++i)
+        radii[i] = std::round((1.0*boxes[i]-1)/2);
+
+    return radii;
+}
+
+namespace
+{
+
+// Add one row and remove another from the sums, then write out the averages,
+// for bytes start to end. Returns where it stopped, since the SIMD versions
+// only do multiples of their width and leave the rest for the plain version.
+typedef int (*BlurStep)(std::uint32_t* sums, const unsigned char* add,
+        const unsigned char* sub, unsigned char* out, int start, int end,
+        const BoxDivider& divide);
+
+int stepPlain(std::uint32_t* sums, const unsigned char* add,
+        const unsigned char* sub, unsigned char* out, int start, int end,
+        const BoxDivider& divide)
+{
+    for (int i = start; i < end; ++i)
+    {
+        sums[i] += add[i] - sub[i];
+        out[i] = divide(sums[i]);
+    }
+
+    return end;
+}
+
+#if defined(__SSE2__)
+// Multiply each 32 bit lane by m and keep the high 32 bits of the result
+inline __m128i mulhi32(__m128i n, __m128i m)
+{
+    const __m128i even = _mm_mul_epu32(n, m);
+    const __m128i odd  = _mm_mul_epu32(_mm_srli_epi64(n, 32), m);
+    const __m128i high = _mm_set_epi32(-1, 0, -1, 0);
+
+    return _mm_or_si128(_mm_srli_epi64(even, 32), _mm_and_si128(odd, high));
+}
+
+int stepSSE2(std::uint32_t* sums, const unsigned char* add,
+        const unsigned char* sub, unsigned char* out, int start, int end,
+        const BoxDivider& divide)
+{
+    // Only exact when the multiplier is
+    if (!divide.usesMultiplier())
+        return start;
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i width = _mm_set1_epi32(divide.divisor());
+    const __m128i mul = _mm_set1_epi32(divide.multiplier());
+
+    int i = start;
+
+    for ( ; i+16 <= end; i += 16)
+    {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(add+i));
+        const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sub+i));
+
+        // Differences as 16 bit signed integers
+        const __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(s, zero));
+        const __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(s, zero));
+
+        // Sign extend to 32 bits
+        const __m128i diff[4] = {
+            _mm_srai_epi32(_mm_unpacklo_epi16(lo, lo), 16),
+            _mm_srai_epi32(_mm_unpackhi_epi16(lo, lo), 16),
+            _mm_srai_epi32(_mm_unpacklo_epi16(hi, hi), 16),
+            _mm_srai_epi32(_mm_unpackhi_epi16(hi, hi), 16)
+        };
+
+        __m128i q[4];
+
+        for (int j = 0; j < 4; ++j)
+        {
+            __m128i* p = reinterpret_cast<__m128i*>(sums+i+4*j);
+            const __m128i sum = _mm_add_epi32(_mm_loadu_si128(p), diff[j]);
+            _mm_storeu_si128(p, sum);
+
+            q[j] = mulhi32(_mm_add_epi32(_mm_add_epi32(sum, sum), width), mul);
+        }
+
+        // All of these are at most 255, so saturating doesn't change anything
+        const __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]),
+                                               _mm_packs_epi32(q[2], q[3]));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out+i), bytes);
+    }
+
+    return i;
+}
+#endif
+
+#if defined(BLUR_AVX2)
+__attribute__((target("avx2")))
+inline __m256i mulhi32AVX2(__m256i n, __m256i m)
+{
+    const __m256i even = _mm256_mul_epu32(n, m);
+    const __m256i odd  = _mm256_mul_epu32(_mm256_srli_epi64(n, 32), m);
+    const __m256i high = _mm256_set_epi32(-1, 0, -1, 0, -1, 0, -1, 0);
+
+    return _mm256_or_si256(_mm256_srli_epi64(even, 32), _mm256_and_si256(odd, high));
+}
+
+__attribute__((target("avx2")))
+int stepAVX2(std::uint32_t* sums, const unsigned char* add,
+        const unsigned char* sub, unsigned char* out, int start, int end,
+        const BoxDivider& divide)
+{
+    if (!divide.usesMultiplier())
+        return start;
+
+    const __m256i width = _mm256_set1_epi32(divide.divisor());
+    const __m256i mul = _mm256_set1_epi32(divide.multiplier());
+
+    int i = start;
+
+    for ( ; i+8 <= end; i += 8)
+    {
+        const __m256i a = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(add+i)));
+        const __m256i s = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(sub+i)));
+
+        __m256i* p = reinterpret_cast<__m256i*>(sums+i);
+        const __m256i sum = _mm256_add_epi32(_mm256_loadu_si256(p), _mm256_sub_epi32(a, s));
+        _mm256_storeu_si256(p, sum);
+
+        const __m256i q = mulhi32AVX2(_mm256_add_epi32(_mm256_add_epi32(sum, sum), width), mul);
+
+        // Pack the eight results down to bytes
+        const __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(q),
+                                              _mm256_extracti128_si256(q, 1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out+i), _mm_packus_epi16(words, words));
+    }
+
+    return i;
+}
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+inline uint32x4_t mulhi32NEON(uint32x4_t n, uint32x2_t m)
+{
+    return vcombine_u32(vshrn_n_u64(vmull_u32(vget_low_u32(n), m), 32),
+                        vshrn_n_u64(vmull_u32(vget_high_u32(n), m), 32));
+}
+
+int stepNEON(std::uint32_t* sums, const unsigned char* add,
+        const unsigned char* sub, unsigned char* out, int start, int end,
+        const BoxDivider& divide)
+{
+    if (!divide.usesMultiplier())
+        return start;
+
+    const uint32x4_t width = vdupq_n_u32(divide.divisor());
+    const uint32x2_t mul = vdup_n_u32(divide.multiplier());
+
+    int i = start;
+
+    for ( ; i+16 <= end; i += 16)
+    {
+        const uint8x16_t a = vld1q_u8(add+i);
+        const uint8x16_t s = vld1q_u8(sub+i);
+
+        // Wrapping 16 bit differences are the right signed differences
+        const int16x8_t lo = vreinterpretq_s16_u16(vsubl_u8(vget_low_u8(a), vget_low_u8(s)));
+        const int16x8_t hi = vreinterpretq_s16_u16(vsubl_u8(vget_high_u8(a), vget_high_u8(s)));
+
+        const int16x4_t diff[4] = {
+            vget_low_s16(lo), vget_high_s16(lo), vget_low_s16(hi), vget_high_s16(hi)
+        };
+
+        uint16x4_t q[4];
+
+        for (int j = 0; j < 4; ++j)
+        {
+            std::uint32_t* p = sums+i+4*j;
+            const uint32x4_t sum = vreinterpretq_u32_s32(
+                    vaddw_s16(vreinterpretq_s32_u32(vld1q_u32(p)), diff[j]));
+            vst1q_u32(p, sum);
+
+            q[j] = vqmovn_u32(mulhi32NEON(vaddq_u32(vshlq_n_u32(sum, 1), width), mul));
+        }
+
+        vst1q_u8(out+i, vcombine_u8(vqmovn_u16(vcombine_u16(q[0], q[1])),
+                                    vqmovn_u16(vcombine_u16(q[2], q[3]))));
+    }
+
+    return i;
+}
+#endif
+
+// Pick the widest version this processor supports
+BlurStep bestStep()
+{
+#if defined(BLUR_AVX2)
+    if (__builtin_cpu_supports("avx2"))
+        return stepAVX2;
+#endif
+#if defined(__SSE2__)
+    return stepSSE2;
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    return stepNEON;
+#else
+    return stepPlain;
+#endif
+}
+
+}
+
+void boxBlurVertical(const unsigned char* src, std::ptrdiff_t src_stride,
+        unsigned char* dst, std::ptrdiff_t dst_stride,
+        int rows, int bytes, int r)
+{
+    static const BlurStep step = bestStep();
+
+    if (rows < 1 || bytes < 1)
+        return;
+
+    const BoxDivider divide(r);
+    std::vector<std::uint32_t> sums(bytes);
+
+    // Sum before the first row, i.e. from -r-1 to r-1
+    for (int i = 0; i < bytes; ++i)
+        sums[i] = (r+1)*src[i];
+
+    for (int j = 0; j < r; ++j)
+    {
+        const unsigned char* in = src + std::min(j, rows-1)*src_stride;
+
+        for (int i = 0; i < bytes; ++i)
+            sums[i] += in[i];
+    }
+
+    for (int y = 0; y < rows; ++y)
+    {
+        const unsigned char* add = src + std::min(y+r, rows-1)*src_stride;
+        const unsigned char* sub = src + std::max(y-r-1, 0)*src_stride;
+        unsigned char* out = dst + y*dst_stride;
+
+        const int done = step(&sums[0], add, sub, out, 0, bytes, divide);
+        stepPlain(&sums[0], add, sub, out, done, bytes, divide);
+    }
+}
@@ -0,0 +1,281 @@
+/*
+ * Fast approximate gaussian blur using three box blurs
+ *   See: http://blog.ivank.net/fastest-gaussian-blur.html
+ *
+ *   PixelBuffer<3> blurred(w, h);
+ *   gaussBlur(img, blurred, 2);
+ *
+ * Each box blur is a running sum, first along rows and then along columns.
+ * Everything is done with integers, and the rounding division by the width of
+ * the box gives exactly what std::round(sum/width) would.
+ *
+ * The horizontal pass goes through each row once, doing all the channels at
+ * the same time. The vertical pass adds a whole row of samples at a time to a
+ * block of sums, which is done with SSE2/AVX2/NEON when available. Rows (for
+ * the horizontal pass) and blocks of columns (for the vertical pass) are
+ * spread across the thread pool.
+ */
+
+#ifndef H_BLUR
+#define H_BLUR
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+#include "threadpool.h"
+#include "pixelbuffer.h"
+
+// Rounding division of a box sum by the box width, which is always odd
+class BoxDivider
+{
+    std::uint32_t width;
+    std::uint32_t mul;
+    bool exact; // Whether mul gives exact results for all sums
+
+public:
+    explicit BoxDivider(int r);
+
+    std::uint32_t divisor()    const { return width; }
+    std::uint32_t multiplier() const { return mul; }
+    bool usesMultiplier() const { return exact; }
+
+    // round(sum/width) is floor((2*sum + width)/(2*width)), and for the sums
+    // we get (at most 255*width) multiplying by the reciprocal is exact
+    unsigned char operator()(std::uint32_t sum) const
+    {
+        const std::uint64_t n = 2*sum + width;
+
+        if (exact)
+            return (n*mul) >> 32;
+        else
+            return n/(2*width);
+    }
+};
+
+// Widths of n boxes that together approximate a gaussian with this standard
+// deviation
+std::vector<int> boxesForGauss(int sigma, int n);
+
+// Radii of the three box blurs for a gaussian blur of radius r
+std::array<int, 3> gaussBoxRadii(int r);
+
+// Box blur of radius r down each column of the rows of bytes, treating
+// everything above the first row as the first row and everything below the
+// last as the last. Only bytes 0 to bytes of each row are used.
+void boxBlurVertical(const unsigned char* src, std::ptrdiff_t src_stride,
+        unsigned char* dst, std::ptrdiff_t dst_stride,
+        int rows, int bytes, int r);
+
+// Box blur of radius r along each row of w pixels with N channels
+template<int N>
+void boxBlurHorizontal(const unsigned char* src, std::ptrdiff_t src_stride,
+        unsigned char* dst, std::ptrdiff_t dst_stride,
+        int rows, int w, int r);
+
+// Blur rows 0 to rows of src with the three boxes, leaving the result in dst
+// and using tmp for the in between steps. dst and tmp must be separate from
+// src and each other. This all runs on one thread, so it's what is used on
+// pieces of an image.
+template<int N>
+void gaussBlurRows(const unsigned char* src, std::ptrdiff_t src_stride,
+        unsigned char* tmp, std::ptrdiff_t tmp_stride,
+        unsigned char* dst, std::ptrdiff_t dst_stride,
+        int rows, int w, const std::array<int, 3>& radii);
+
+// Blur a whole image, with dst having the same size as src
+template<int N>
+void gaussBlur(const PixelBuffer<N>& src, PixelBuffer<N>& dst, int r,
+        ThreadPool& pool = ThreadPool::global());
+
+// Blur a whole image a tile of rows at a time, calling out(y, row) with each
+// blurred row rather than keeping the whole blurred image around. Each tile is
+// blurred with enough extra rows above and below that the result is the same
+// as gaussBlur(). Tiles are done in parallel, so out must be fine with being
+// called from several threads at once (for different rows).
+template<int N, class Output>
+void gaussBlurTiled(const PixelBuffer<N>& src, int r, Output out,
+        ThreadPool& pool = ThreadPool::global());
+
+// The same on h rows of w pixels starting at src, e.g. just part of a buffer
+template<int N, class Output>
+void gaussBlurTiled(const unsigned char* src, std::ptrdiff_t src_stride,
+        int w, int h, int r, Output out,
+        ThreadPool& pool = ThreadPool::global());
+
+/*
+ * Implementation
+ */
+
+template<int N>
+void boxBlurHorizontal(const unsigned char* src, std::ptrdiff_t src_stride,
+        unsigned char* dst, std::ptrdiff_t dst_stride,
+        int rows, int w, int r)
+{
+    if (w < 1)
+        return;
+
+    const BoxDivider divide(r);
+
+    for (int y = 0; y < rows; ++y)
+    {
+        const unsigned char* in = src + y*src_stride;
+        unsigned char* out = dst + y*dst_stride;
+
+        const unsigned char* first = in;
+        const unsigned char* last = in + (w-1)*N;
+
+        // Sum before the first pixel, i.e. from -r-1 to r-1
+        std::array<std::uint32_t, N> sum;
+
+        for (int c = 0; c < N; ++c)
+        {
+            sum[c] = (r+1)*first[c];
+
+            for (int j = 0; j < r; ++j)
+                sum[c] += in[std::min(j, w-1)*N + c];
+        }
+
+        // Left edge, removing copies of the first pixel
+        const int left = std::min(w, r+1);
+        int x = 0;
+
+        for ( ; x < left; ++x)
+        {
+            const unsigned char* add = in + std::min(x+r, w-1)*N;
+
+            for (int c = 0; c < N; ++c)
+            {
+                sum[c] += add[c] - first[c];
+                out[x*N + c] = divide(sum[c]);
+            }
+        }
+
+        // Middle, where the whole box is in the row
+        for ( ; x < w-r; ++x)
+        {
+            const unsigned char* add = in + (x+r)*N;
+            const unsigned char* sub = in + (x-r-1)*N;
+
+            for (int c = 0; c < N; ++c)
+            {
+                sum[c] += add[c] - sub[c];
+                out[x*N + c] = divide(sum[c]);
+            }
+        }
+
+        // Right edge, adding copies of the last pixel
+        for ( ; x < w; ++x)
+        {
+            const unsigned char* sub = in + (x-r-1)*N;
+
+            for (int c = 0; c < N; ++c)
+            {
+                sum[c] += last[c] - sub[c];
+                out[x*N + c] = divide(sum[c]);
+            }
+        }
+    }
+}
+
+template<int N>
+void gaussBlurRows(const unsigned char* src, std::ptrdiff_t src_stride,
+        unsigned char* tmp, std::ptrdiff_t tmp_stride,
+        unsigned char* dst, std::ptrdiff_t dst_stride,
+        int rows, int w, const std::array<int, 3>& radii)
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        // The first pass reads from the source and the others from the
+        // result of the previous one
+        if (i == 0)
+            boxBlurHorizontal<N>(src, src_stride, tmp, tmp_stride, rows, w, radii[i]);
+        else
+            boxBlurHorizontal<N>(dst, dst_stride, tmp, tmp_stride, rows, w, radii[i]);
+
+        boxBlurVertical(tmp, tmp_stride, dst, dst_stride, rows, w*N, radii[i]);
+    }
+}
+
+template<int N>
+void gaussBlur(const PixelBuffer<N>& src, PixelBuffer<N>& dst, int r, ThreadPool& pool)
+{
+    const int w = src.width();
+    const int h = src.height();
+    const std::array<int, 3> radii = gaussBoxRadii(r);
+
+    // Width of the blocks of columns in the vertical pass. This many sums
+    // fit in the L1 cache easily.
+    const int block = 512;
+    const int bytes = w*N;
+    const int blocks = (bytes + block - 1)/block;
+
+    PixelBuffer<N> tmp(w, h);
+
+    for (int i = 0; i < 3; ++i)
+    {
+        const PixelBuffer<N>& in = (i == 0)?src:dst;
+
+        parallelFor(0, h, 16, [&](int start, int end)
+        {
+            boxBlurHorizontal<N>(in.row(start), in.stride(),
+                tmp.row(start), tmp.stride(), end-start, w, radii[i]);
+        }, pool);
+
+        parallelFor(0, blocks, 1, [&](int start, int end)
+        {
+            const int offset = start*block;
+            const int length = std::min(bytes, end*block) - offset;
+
+            boxBlurVertical(tmp.row(0) + offset, tmp.stride(),
+                dst.row(0) + offset, dst.stride(), h, length, radii[i]);
+        }, pool);
+    }
+}
+
+template<int N, class Output>
+void gaussBlurTiled(const PixelBuffer<N>& src, int r, Output out, ThreadPool& pool)
+{
+    gaussBlurTiled<N>(src.row(0), src.stride(), src.width(), src.height(), r, out, pool);
+}
+
+template<int N, class Output>
+void gaussBlurTiled(const unsigned char* src, std::ptrdiff_t src_stride,
+        int w, int h, int r, Output out, ThreadPool& pool)
+{
+    const std::array<int, 3> radii = gaussBoxRadii(r);
+
+    // Each vertical pass makes the rows within its radius of the edge of a
+    // tile wrong (unless that's also the edge of the image), so with this
+    // many extra rows on each side the middle comes out right
+    const int halo = radii[0] + radii[1] + radii[2];
+
+    // Keep the extra rows small compared to the tile
+    const int tile = std::max(64, 4*halo);
+    const int tiles = (h + tile - 1)/tile;
+
+    parallelFor(0, tiles, 1, [&](int start, int end)
+    {
+        // Reused for all the tiles in this piece
+        PixelBuffer<N> tmp(w, std::min(h, tile + 2*halo));
+        PixelBuffer<N> blurred(w, std::min(h, tile + 2*halo));
+
+        for (int t = start; t < end; ++t)
+        {
+            const int y0 = t*tile;
+            const int y1 = std::min(h, y0 + tile);
+            const int top = std::max(0, y0 - halo);
+            const int bottom = std::min(h, y1 + halo);
+
+            gaussBlurRows<N>(src + top*src_stride, src_stride, tmp.row(0), tmp.stride(),
+                blurred.row(0), blurred.stride(), bottom-top, w, radii);
+
+            for (int y = y0; y < y1; ++y)
+                out(y, blurred.row(y-top));
+        }
+    }, pool);
+}
+
+#endif
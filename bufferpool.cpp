@@ -0,0 +1,126 @@
+#include <new>
+#include <mutex>
+#include <vector>
+
+#include "bufferpool.h"
+
+// Each block starts with how big it is, padded so that what's after is still
+// aligned for anything
+struct alignas(alignof(std::max_align_t)) PoolHeader
+{
+    std::size_t size;
+};
+
+struct PoolState
+{
+    std::mutex lock;
+    std::size_t limit = 0;
+    std::size_t total = 0;
+
+    // Oldest first
+    std::vector<PoolHeader*> blocks;
+};
+
+// Never destroyed, since buffers may still be freed while the program exits
+static PoolState& state()
+{
+    static PoolState* s = new PoolState;
+    return *s;
+}
+
+// Drop the oldest until there's no more than bytes kept, with the lock held
+static void trim(PoolState& s, std::size_t bytes)
+{
+    std::size_t drop = 0;
+
+    while (drop < s.blocks.size() && s.total > bytes)
+    {
+        s.total -= s.blocks[drop]->size;
+        ::operator delete(s.blocks[drop]);
+        ++drop;
+    }
+
+    s.blocks.erase(s.blocks.begin(), s.blocks.begin() + drop);
+}
+
+void BufferPool::setLimit(std::size_t bytes)
+{
+    PoolState& s = state();
+    std::unique_lock<std::mutex> lck(s.lock);
+
+    s.limit = bytes;
+    trim(s, s.limit);
+}
+
+void* BufferPool::allocate(std::size_t size)
+{
+    if (size >= min_size)
+    {
+        PoolState& s = state();
+        std::unique_lock<std::mutex> lck(s.lock);
+
+        // The smallest one that fits, as long as it's not much bigger than
+        // needed, since the rest of it goes unused until it's freed again
+        std::size_t best = s.blocks.size();
+
+        for (std::size_t i = 0; i < s.blocks.size(); ++i)
+        {
+            const std::size_t kept = s.blocks[i]->size;
+
+            if (kept >= size && kept - size <= size/2 &&
+                (best == s.blocks.size() || kept < s.blocks[best]->size))
+                best = i;
+        }
+
+        if (best < s.blocks.size())
+        {
+            PoolHeader* block = s.blocks[best];
+            s.total -= block->size;
+            s.blocks.erase(s.blocks.begin() + best);
+
+            return block + 1;
+        }
+    }
+
+    PoolHeader* block = static_cast<PoolHeader*>(::operator new(sizeof(PoolHeader) + size));
+    block->size = size;
+    return block + 1;
+}
+
+void BufferPool::deallocate(void* p) noexcept
+{
+    if (!p)
+        return;
+
+    PoolHeader* block = static_cast<PoolHeader*>(p) - 1;
+
+    if (block->size >= min_size)
+    {
+        PoolState& s = state();
+        std::unique_lock<std::mutex> lck(s.lock);
+
+        if (block->size <= s.limit)
+        {
+            try
+            {
+                s.blocks.push_back(block);
+                s.total += block->size;
+                trim(s, s.limit);
+                return;
+            }
+            catch (const std::bad_alloc&)
+            {
+            }
+        }
+    }
+
+    ::operator delete(block);
+}
+
+std::size_t BufferPool::kept()
+{
+    PoolState& s = state();
+    std::unique_lock<std::mutex> lck(s.lock);
+
+    return s.total;
+}
@@ -0,0 +1,75 @@
+/*
+ * Big blocks of memory kept after they're freed, for the next page to reuse
+ *
+ *   BufferPool::setLimit(1024*1024*1024); // e.g. with --serve
+ *
+ *   std::vector<int, PoolAllocator<int>> labels(w*h);
+ *   std::unique_ptr<unsigned char, BufferDeleter> pixels(
+ *       static_cast<unsigned char*>(BufferPool::allocate(size)));
+ *
+ * glibc's malloc maps anything over its threshold, which only grows to 32 MB,
+ * straight from the kernel and unmaps it again when it's freed, and gives the
+ * top of the heap back too, so every page would otherwise fault in its image
+ * buffers, labels, and outlines from scratch. The pages of a long running
+ * process are mostly the same few sizes, so keeping what was freed lets the
+ * next one start with memory that's already there. Until a limit is set
+ * nothing is kept, and this is just new and delete.
+ */
+
+#ifndef H_BUFFERPOOL
+#define H_BUFFERPOOL
+
+#include <new>
+#include <vector>
+#include <cstddef>
+
+class BufferPool
+{
+public:
+    // Smaller blocks aren't kept, since malloc already reuses those
+    static const std::size_t min_size = 1024*1024;
+
+    // Most bytes to keep at once, dropping the ones freed longest ago to stay
+    // under it. Zero keeps nothing and frees what's kept.
+    static void setLimit(std::size_t bytes);
+
+    // Aligned for anything, the same as new. Throws std::bad_alloc if there's
+    // no memory.
+    static void* allocate(std::size_t size);
+    static void deallocate(void* p) noexcept;
+
+    // Bytes being kept right now
+    static std::size_t kept();
+};
+
+struct BufferDeleter
+{
+    void operator()(void* p) const { BufferPool::deallocate(p); }
+};
+
+template<class T>
+class PoolAllocator
+{
+public:
+    typedef T value_type;
+
+    PoolAllocator() { }
+
+    template<class U>
+    PoolAllocator(const PoolAllocator<U>&) { }
+
+    T* allocate(std::size_t n) { return static_cast<T*>(BufferPool::allocate(n*sizeof(T))); }
+    void deallocate(T* p, std::size_t) { BufferPool::deallocate(p); }
+
+    template<class U>
+    bool operator==(const PoolAllocator<U>&) const { return true; }
+
+    template<class U>
+    bool operator!=(const PoolAllocator<U>&) const { return false; }
+};
+
+// For the big arrays that are made again for each page
+template<class T>
+using PoolVector = std::vector<T, PoolAllocator<T>>;
+
+#endif
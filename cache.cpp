@@ -0,0 +1,212 @@
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <sstream>
+#include <iomanip>
+
+// For making the directory and naming temporary files
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "log.h"
+#include "cache.h"
+#include "blobs.h"
+#include "pixels.h"
+#include "palette.h"
+#include "mappedfile.h"
+
+// Change this whenever what's written changes, so old entries are ignored
+static const char cache_version[16] = "fotoloc cache 1";
+
+std::uint64_t hashBytes(const char* data, std::size_t size, std::uint64_t hash)
+{
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+StageCache::StageCache(const std::string& d)
+    :dir(d)
+{
+    struct stat info;
+
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+        throw std::runtime_error("couldn't make cache directory \"" + dir + "\"");
+
+    if (stat(dir.c_str(), &info) != 0 || !(info.st_mode&S_IFDIR))
+        throw std::runtime_error("cache \"" + dir + "\" isn't a directory");
+}
+
+std::string StageCache::key(std::uint64_t hash, const std::vector<int>& options)
+{
+    std::ostringstream s;
+    s << std::hex << std::setw(16) << std::setfill('0') << hash << std::dec;
+
+    for (const int option : options)
+        s << "-" << option;
+
+    return s.str();
+}
+
+std::string StageCache::path(const std::string& key, const std::string& stage) const
+{
+    return dir + "/" + key + "." + stage;
+}
+
+bool StageCache::has(const std::string& key, const std::string& stage) const
+{
+    return access(path(key, stage).c_str(), R_OK) == 0;
+}
+
+template<class Function>
+bool StageCache::read(const std::string& key, const std::string& stage, Function f) const
+{
+    const std::string filename = path(key, stage);
+
+    if (access(filename.c_str(), R_OK) != 0)
+        return false;
+
+    try
+    {
+        const MappedFile file(filename);
+        CacheReader in(file.data(), file.size());
+
+        char version[sizeof(cache_version)];
+        in.array(version, sizeof(version));
+
+        if (std::memcmp(version, cache_version, sizeof(version)) != 0)
+            return false;
+
+        f(in);
+
+        if (!in.done())
+            throw std::runtime_error("cache entry is too long");
+    }
+    catch (const std::runtime_error& e)
+    {
+        log("ignoring cache entry \"" + filename + "\": " + e.what(), LogType::Warning);
+        return false;
+    }
+
+    return true;
+}
+
+template<class Function>
+bool StageCache::write(const std::string& key, const std::string& stage, Function f) const
+{
+    // Unique to this process, since other pages may be written at the same
+    // time, and other runs may be writing the same entry
+    static std::atomic<unsigned int> count(0);
+
+    const std::string filename = path(key, stage);
+    std::ostringstream temporary;
+    temporary << filename << ".tmp." << getpid() << "." << count++;
+
+    {
+        std::ofstream os(temporary.str(), std::ios::binary);
+        CacheWriter out(os);
+
+        out.array(cache_version, sizeof(cache_version));
+        f(out);
+
+        if (!os.flush())
+        {
+            os.close();
+            std::remove(temporary.str().c_str());
+            return false;
+        }
+    }
+
+    if (std::rename(temporary.str().c_str(), filename.c_str()) != 0)
+    {
+        std::remove(temporary.str().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool StageCache::load(const std::string& key, Pixels<3>& img, const std::string& filename) const
+{
+    return read(key, "decoded", [&](CacheReader& in)
+    {
+        const int w = in.value<int>();
+        const int h = in.value<int>();
+
+        if (w <= 0 || h <= 0 || static_cast<std::size_t>(w)*h*3 > in.remaining())
+            throw std::runtime_error("image is the wrong size");
+
+        Pixels<3>::PixelArray pixels(w, h);
+
+        for (int y = 0; y < h; ++y)
+            in.array(pixels.row(y), static_cast<std::size_t>(w)*3);
+
+        img = Pixels<3>(std::move(pixels), filename);
+    });
+}
+
+bool StageCache::load(const std::string& key, PaletteImage& indices) const
+{
+    return read(key, "indices", [&](CacheReader& in)
+    {
+        const int w = in.value<int>();
+        const int h = in.value<int>();
+        const int channels = in.value<int>();
+        const int amount = in.value<int>();
+
+        if (w <= 0 || h <= 0 ||
+            static_cast<std::size_t>(w)*h*sizeof(PaletteImage::Index) > in.remaining())
+            throw std::runtime_error("image is the wrong size");
+
+        PaletteImage loaded(w, h, channels, amount);
+        in.array(loaded.row(0), static_cast<std::size_t>(w)*h);
+        indices = std::move(loaded);
+    });
+}
+
+bool StageCache::load(const std::string& key, Blobs& blobs) const
+{
+    return read(key, "blobs", [&](CacheReader& in)
+    {
+        blobs.read(in);
+    });
+}
+
+bool StageCache::save(const std::string& key, const Pixels<3>& img) const
+{
+    return write(key, "decoded", [&](CacheWriter& out)
+    {
+        const Pixels<3>::PixelArray& pixels = img.ref();
+
+        out.value(img.width());
+        out.value(img.height());
+
+        for (int y = 0; y < img.height(); ++y)
+            out.array(pixels.row(y), static_cast<std::size_t>(img.width())*3);
+    });
+}
+
+bool StageCache::save(const std::string& key, const PaletteImage& indices) const
+{
+    return write(key, "indices", [&](CacheWriter& out)
+    {
+        out.value(indices.width());
+        out.value(indices.height());
+        out.value(indices.channelCount());
+        out.value(indices.amount());
+        out.array(indices.row(0), static_cast<std::size_t>(indices.width())*indices.height());
+    });
+}
+
+bool StageCache::save(const std::string& key, const Blobs& blobs) const
+{
+    return write(key, "blobs", [&](CacheWriter& out)
+    {
+        blobs.write(out);
+    });
+}
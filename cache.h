@@ -0,0 +1,170 @@
+/*
+ * What the slow stages made from each file, kept on disk so that running
+ * again on the same files, e.g. while tuning the options, starts from the
+ * deepest stage that's already been done
+ *
+ *   const StageCache cache("fotoloc-cache");
+ *   const std::string key = StageCache::key(hashBytes(file.data(), file.size()),
+ *       {scale, blurAmount, quantizeAmount});
+ *
+ *   PaletteImage indices;
+ *
+ *   if (!cache.load(key, indices))
+ *   {
+ *       indices = img.blurQuantizeIndices(blurAmount, quantizeAmount);
+ *       cache.save(key, indices);
+ *   }
+ *
+ * The key is the hash of the file's contents along with the options that
+ * change the result, so editing a file or changing an option just misses.
+ * Each entry is one file, named by its key and what's in it, that's written
+ * to a temporary file first and renamed so a run that's stopped part way
+ * never leaves half of one. The entries are the raw arrays in this machine's
+ * byte order, each read back by mapping the file and copying it once, and
+ * anything that can't be read is just made again.
+ */
+
+#ifndef H_CACHE
+#define H_CACHE
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+
+template<int N>
+class Pixels;
+class PaletteImage;
+class Blobs;
+
+// FNV-1a, which is plenty to tell files apart and much faster than decoding.
+// Passing the last hash continues it with more bytes.
+std::uint64_t hashBytes(const char* data, std::size_t size,
+        std::uint64_t hash = 14695981039346656037ULL);
+
+// Writes values and arrays one after the other as they are in memory
+class CacheWriter
+{
+    std::ofstream& os;
+
+public:
+    explicit CacheWriter(std::ofstream& o)
+        :os(o) { }
+
+    template<class T>
+    void value(const T& v)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "can only write plain data");
+        os.write(reinterpret_cast<const char*>(&v), sizeof(T));
+    }
+
+    // The size and then the elements
+    template<class T, class Allocator>
+    void array(const std::vector<T, Allocator>& v)
+    {
+        value<std::uint64_t>(v.size());
+        array(v.data(), v.size());
+    }
+
+    template<class T>
+    void array(const T* data, std::size_t count)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "can only write plain data");
+        os.write(reinterpret_cast<const char*>(data), count*sizeof(T));
+    }
+};
+
+// Reads back what CacheWriter wrote, throwing std::runtime_error if there
+// isn't that much left
+class CacheReader
+{
+    const char* data;
+    std::size_t size;
+    std::size_t position = 0;
+
+public:
+    CacheReader(const char* d, std::size_t s)
+        :data(d), size(s) { }
+
+    template<class T>
+    T value()
+    {
+        T v;
+        array(&v, 1);
+        return v;
+    }
+
+    template<class T, class Allocator>
+    void array(std::vector<T, Allocator>& v)
+    {
+        const std::uint64_t count = value<std::uint64_t>();
+
+        if (count > (size - position)/sizeof(T))
+            throw std::runtime_error("cache entry is cut short");
+
+        v.resize(count);
+        array(v.data(), v.size());
+    }
+
+    template<class T>
+    void array(T* out, std::size_t count)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "can only read plain data");
+
+        if (count > (size - position)/sizeof(T))
+            throw std::runtime_error("cache entry is cut short");
+
+        if (count == 0)
+            return;
+
+        std::memcpy(out, data + position, count*sizeof(T));
+        position += count*sizeof(T);
+    }
+
+    std::size_t remaining() const { return size - position; }
+    bool done() const { return position == size; }
+};
+
+class StageCache
+{
+    std::string dir;
+
+public:
+    // Makes the directory if it's not there, or throws std::runtime_error if
+    // it can't
+    explicit StageCache(const std::string& dir);
+
+    // The hash as hex, then each option
+    static std::string key(std::uint64_t hash, const std::vector<int>& options = {});
+
+    // Whether there's an entry for what's made at that stage, e.g. "blobs"
+    bool has(const std::string& key, const std::string& stage) const;
+
+    // The decoded image, the quantized indices, or the labeled blobs. Loading
+    // returns false if there's no entry or it can't be read, and saving if it
+    // couldn't be written.
+    bool load(const std::string& key, Pixels<3>& img, const std::string& filename) const;
+    bool load(const std::string& key, PaletteImage& indices) const;
+    bool load(const std::string& key, Blobs& blobs) const;
+
+    bool save(const std::string& key, const Pixels<3>& img) const;
+    bool save(const std::string& key, const PaletteImage& indices) const;
+    bool save(const std::string& key, const Blobs& blobs) const;
+
+private:
+    std::string path(const std::string& key, const std::string& stage) const;
+
+    // Check the entry is from this version of the cache for this stage and
+    // then read the rest with f(CacheReader&)
+    template<class Function>
+    bool read(const std::string& key, const std::string& stage, Function f) const;
+
+    // Write the entry with f(CacheWriter&), all at once
+    template<class Function>
+    bool write(const std::string& key, const std::string& stage, Function f) const;
+};
+
+#endif
@@ -0,0 +1,203 @@
+/*
+ * Cut a photo out of the page and straighten it
+ *
+ *   const Quad photo = findQuad(blobs.contour(label));
+ *   const Pixels<3> cropped = cropQuad(img, photo);
+ *   const Pixels<3> sharper = cropQuad(img, photo, Interpolation::Bicubic);
+ *
+ * The corners are mapped onto an upright rectangle by the one affine
+ * transform closest to them, which is exact if they're a parallelogram, as
+ * they are for a photo that's just rotated and moved on the scanner. Going
+ * along a row of the output is then adding the same step in the page for
+ * every pixel, which is done in 16.16 fixed point with integer weights. The
+ * rows are spread across the thread pool.
+ */
+
+#ifndef H_CROP
+#define H_CROP
+
+#include <cmath>
+#include <array>
+#include <cstdint>
+#include <algorithm>
+
+#include "quad.h"
+#include "pixels.h"
+#include "threadpool.h"
+#include "pixelbuffer.h"
+
+enum class Interpolation
+{
+    // The four nearest pixels
+    Bilinear,
+
+    // The sixteen nearest pixels (Catmull-Rom), a bit sharper
+    Bicubic
+};
+
+// The part of img inside the quad, rotated upright. It's as wide as the top
+// and bottom sides are long on average, and as tall as the left and right.
+template<int N>
+Pixels<N> cropQuad(const Pixels<N>& img, const Quad& quad,
+        Interpolation method = Interpolation::Bilinear,
+        ThreadPool& pool = ThreadPool::global());
+
+/*
+ * Implementation
+ */
+
+// Weights of the four pixels around a point for each 1/256 of a pixel it's
+// past the second one, in 1/4096ths, which add up to exactly 4096
+inline const std::array<std::array<int, 4>, 256>& bicubicWeights()
+{
+    static const std::array<std::array<int, 4>, 256> table = []()
+    {
+        std::array<std::array<int, 4>, 256> weights;
+
+        for (int i = 0; i < 256; ++i)
+        {
+            const double t = i/256.0;
+            const std::array<double, 4> w = {{
+                ((-0.5*t + 1.0)*t - 0.5)*t,
+                (1.5*t - 2.5)*t*t + 1.0,
+                ((-1.5*t + 2.0)*t + 0.5)*t,
+                (0.5*t - 0.5)*t*t
+            }};
+
+            // Put the rounding error on the biggest so the total is exact
+            int total = 0;
+
+            for (int j = 0; j < 4; ++j)
+            {
+                weights[i][j] = std::lround(w[j]*4096);
+                total += weights[i][j];
+            }
+
+            weights[i][(t < 0.5)?1:2] += 4096 - total;
+        }
+
+        return weights;
+    }();
+
+    return table;
+}
+
+template<int N>
+Pixels<N> cropQuad(const Pixels<N>& img, const Quad& quad,
+        Interpolation method, ThreadPool& pool)
+{
+    const std::array<Coord, 4>& c = quad.corners;
+    const typename Pixels<N>::PixelArray& p = img.ref();
+    const int w = img.width();
+    const int h = img.height();
+
+    if (w == 0 || h == 0)
+        return Pixels<N>();
+
+    // Top, right, bottom, and left sides, with the bottom and left going the
+    // same way as the top and right
+    auto length = [](const Coord& a, const Coord& b)
+    {
+        return std::hypot(b.x - a.x, b.y - a.y);
+    };
+
+    const int out_w = std::lround((length(c[0], c[1]) + length(c[3], c[2]))/2) + 1;
+    const int out_h = std::lround((length(c[0], c[3]) + length(c[1], c[2]))/2) + 1;
+
+    // One step right and one step down in the output, in the page
+    const double right_x = ((c[1].x - c[0].x) + (c[2].x - c[3].x))/2.0/std::max(1, out_w-1);
+    const double right_y = ((c[1].y - c[0].y) + (c[2].y - c[3].y))/2.0/std::max(1, out_w-1);
+    const double down_x  = ((c[3].x - c[0].x) + (c[2].x - c[1].x))/2.0/std::max(1, out_h-1);
+    const double down_y  = ((c[3].y - c[0].y) + (c[2].y - c[1].y))/2.0/std::max(1, out_h-1);
+
+    // Put the middle of the output on the middle of the corners
+    const double origin_x = (c[0].x + c[1].x + c[2].x + c[3].x)/4.0
+        - right_x*(out_w-1)/2.0 - down_x*(out_h-1)/2.0;
+    const double origin_y = (c[0].y + c[1].y + c[2].y + c[3].y)/4.0
+        - right_y*(out_w-1)/2.0 - down_y*(out_h-1)/2.0;
+
+    const std::int64_t one = 1 << 16;
+    const std::int64_t step_x = std::llround(right_x*one);
+    const std::int64_t step_y = std::llround(right_y*one);
+
+    // Outside the page, use the nearest pixel on the edge
+    auto pixel = [&](int x, int y) -> const unsigned char*
+    {
+        x = std::min(std::max(x, 0), w-1);
+        y = std::min(std::max(y, 0), h-1);
+
+        return p.row(y) + x*N;
+    };
+
+    typename Pixels<N>::PixelArray pixels(out_w, out_h);
+    const std::array<std::array<int, 4>, 256>& cubic = bicubicWeights();
+
+    parallelFor(0, out_h, 16, [&](int start, int end)
+    {
+        for (int v = start; v < end; ++v)
+        {
+            std::int64_t fx = std::llround((origin_x + v*down_x)*one);
+            std::int64_t fy = std::llround((origin_y + v*down_y)*one);
+            unsigned char* out = pixels.row(v);
+
+            for (int u = 0; u < out_w; ++u, fx += step_x, fy += step_y, out += N)
+            {
+                // Floor, since these may be negative
+                const int x = static_cast<int>(fx >> 16);
+                const int y = static_cast<int>(fy >> 16);
+                const int ax = (fx >> 8) & 0xff;
+                const int ay = (fy >> 8) & 0xff;
+
+                if (method == Interpolation::Bilinear)
+                {
+                    const bool inside = x >= 0 && y >= 0 && x+1 < w && y+1 < h;
+                    const unsigned char* p00 = inside?(p.row(y) + x*N):pixel(x, y);
+                    const unsigned char* p01 = inside?(p00 + N):pixel(x+1, y);
+                    const unsigned char* p10 = inside?(p.row(y+1) + x*N):pixel(x, y+1);
+                    const unsigned char* p11 = inside?(p10 + N):pixel(x+1, y+1);
+
+                    for (int i = 0; i < N; ++i)
+                    {
+                        const int top = p00[i]*(256-ax) + p01[i]*ax;
+                        const int bottom = p10[i]*(256-ax) + p11[i]*ax;
+                        out[i] = (top*(256-ay) + bottom*ay + (1 << 15)) >> 16;
+                    }
+                }
+                else
+                {
+                    const std::array<int, 4>& wx = cubic[ax];
+                    const std::array<int, 4>& wy = cubic[ay];
+                    const bool inside = x-1 >= 0 && y-1 >= 0 && x+2 < w && y+2 < h;
+
+                    std::array<std::int64_t, N> sums = {};
+
+                    for (int j = 0; j < 4; ++j)
+                    {
+                        std::array<int, N> row = {};
+
+                        for (int k = 0; k < 4; ++k)
+                        {
+                            const unsigned char* q = inside?(p.row(y-1+j) + (x-1+k)*N)
+                                                           :pixel(x-1+k, y-1+j);
+
+                            for (int i = 0; i < N; ++i)
+                                row[i] += wx[k]*q[i];
+                        }
+
+                        for (int i = 0; i < N; ++i)
+                            sums[i] += static_cast<std::int64_t>(wy[j])*row[i];
+                    }
+
+                    // It overshoots a bit next to edges
+                    for (int i = 0; i < N; ++i)
+                        out[i] = std::min<std::int64_t>(255, std::max<std::int64_t>(0,
+                                    (sums[i] + (1 << 23)) >> 24));
+                }
+            }
+        }
+    }, pool);
+
+    return Pixels<N>(std::move(pixels), img.filename());
+}
+
+#endif
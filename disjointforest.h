@@ -0,0 +1,170 @@
+/*
+ * A flat disjoint set (union find) for small non-negative integers
+ *   See: https://en.wikipedia.org/wiki/Disjoint-set_data_structure
+ *
+ * Usage is the same as DisjointSet, which means either can be used when
+ * labeling with Blobs:
+ *   DisjointForest<int> ds(0); // Default, not-found element
+ *   ds.add(5);
+ *   ds.add(6);
+ *   ds.join(5, 6);
+ *
+ *   int rep = ds.find(6);
+ *
+ *   if (rep != ds.notfound())
+ *       // 6 points to rep
+ *
+ * Notes
+ *   The elements are used as indices into a vector of parents, so this only
+ *   makes sense with densely packed values like the labels handed out while
+ *   labeling connected components. Something like 5, 6, 7, ... is great;
+ *   5, 1000000 will allocate a million entries.
+ *
+ *   Finding uses path halving and joining is by rank, so a sequence of
+ *   operations takes nearly linear time and no memory is allocated other than
+ *   growing the two vectors when adding.
+ *
+ *   find() is const but shortens paths as it goes, so don't call it from
+ *   multiple threads at once without first calling flatten().
+ */
+
+#ifndef H_DISJOINTFOREST
+#define H_DISJOINTFOREST
+
+#include <vector>
+#include <type_traits>
+
+#include "disjointset.h"
+
+template<class Type>
+class DisjointForest
+{
+    static_assert(std::is_integral<Type>::value, "Elements must be integers");
+
+    typedef typename std::vector<Type>::size_type size_type;
+
+    // Parent of each element, the element itself if it is the
+    // representative, or defaultElem if it hasn't been added
+    mutable std::vector<Type> parent;
+
+    // Upper bound on the height of each tree, only valid for representatives
+    std::vector<unsigned char> rank;
+
+    // Default, not found item
+    Type defaultElem;
+
+public:
+    DisjointForest(Type notfound)
+        : defaultElem(notfound)
+    { }
+
+    // Allow moving, just std::move everything
+    DisjointForest(DisjointForest<Type>&&) = default;
+    DisjointForest<Type>& operator=(DisjointForest<Type>&&) = default;
+
+    // Main operations
+    void add(Type elem);
+    void join(Type elem1, Type elem2);
+    Type find(Type elem) const;
+    Type notfound() const { return defaultElem; }
+
+    // Point every element directly at its representative. After this, find()
+    // doesn't modify anything until the next join().
+    void flatten();
+
+    // Preallocate for elements up to this value
+    void reserve(Type elem) { parent.reserve(elem+1); rank.reserve(elem+1); }
+
+private:
+    // Disallow copying (not needed so far)
+    DisjointForest(const DisjointForest<Type>&) = delete;
+    DisjointForest<Type>& operator=(const DisjointForest<Type>&) = delete;
+
+    bool exists(Type elem) const
+    {
+        return elem >= 0 && static_cast<size_type>(elem) < parent.size() &&
+            elem != defaultElem && parent[elem] != defaultElem;
+    }
+
+    Type root(Type elem) const;
+};
+
+//
+// Implementation
+//
+template<class Type>
+void DisjointForest<Type>::add(Type elem)
+{
+    if (elem == defaultElem)
+        throw ElementIsDefault();
+
+    if (static_cast<size_type>(elem) >= parent.size())
+    {
+        parent.resize(elem+1, defaultElem);
+        rank.resize(elem+1, 0);
+    }
+
+    // Insert if it doesn't already exist
+    if (parent[elem] == defaultElem)
+        parent[elem] = elem;
+}
+
+template<class Type>
+Type DisjointForest<Type>::root(Type elem) const
+{
+    // Path halving: point every other item on the way up at its grandparent
+    while (parent[elem] != elem)
+    {
+        parent[elem] = parent[parent[elem]];
+        elem = parent[elem];
+    }
+
+    return elem;
+}
+
+template<class Type>
+void DisjointForest<Type>::join(Type elem1, Type elem2)
+{
+    // If one of them doesn't exist, then we don't have to join anything
+    if (!exists(elem1) || !exists(elem2))
+        return;
+
+    Type rep1 = root(elem1);
+    Type rep2 = root(elem2);
+
+    // If they both are part of the same set
+    if (rep1 == rep2)
+        return;
+
+    // Put the shorter tree under the taller one so paths stay short
+    if (rank[rep1] < rank[rep2])
+    {
+        parent[rep1] = rep2;
+    }
+    else
+    {
+        parent[rep2] = rep1;
+
+        if (rank[rep1] == rank[rep2])
+            ++rank[rep1];
+    }
+}
+
+template<class Type>
+Type DisjointForest<Type>::find(Type elem) const
+{
+    if (!exists(elem))
+        return defaultElem;
+
+    return root(elem);
+}
+
+template<class Type>
+void DisjointForest<Type>::flatten()
+{
+    for (size_type i = 0; i < parent.size(); ++i)
+        if (static_cast<Type>(i) != defaultElem && parent[i] != defaultElem)
+            parent[i] = root(i);
+}
+
+#endif
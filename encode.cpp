@@ -0,0 +1,163 @@
+#include <vector>
+#include <cstdio>
+#include <csetjmp>
+#include <stdexcept>
+
+#include <IL/il.h>
+#include <png.h>
+#include <jpeglib.h>
+
+#include "encode.h"
+
+// Both libraries report errors by calling a function that isn't allowed to
+// return, so they jump back to where writing started. Nothing there can have
+// a destructor that would be skipped, which is why these work on plain
+// pointers and the caller cleans up.
+struct JPEGError
+{
+    jpeg_error_mgr mgr;
+    std::jmp_buf jump;
+};
+
+static void jpegErrorExit(j_common_ptr info)
+{
+    std::longjmp(reinterpret_cast<JPEGError*>(info->err)->jump, 1);
+}
+
+static bool writePNG(std::FILE* file, const unsigned char* data, int width, int height,
+        int channels, std::ptrdiff_t stride, int compression)
+{
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+
+    if (!png)
+        return false;
+
+    png_infop info = png_create_info_struct(png);
+
+    if (!info || setjmp(png_jmpbuf(png)))
+    {
+        png_destroy_write_struct(&png, &info);
+        return false;
+    }
+
+    png_init_io(png, file);
+    png_set_compression_level(png, compression);
+    png_set_IHDR(png, info, width, height, 8,
+            (channels == 1)?PNG_COLOR_TYPE_GRAY:PNG_COLOR_TYPE_RGB,
+            PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, info);
+
+    // Drop the fourth channel of each pixel while writing
+    if (channels == 4)
+        png_set_filler(png, 0, PNG_FILLER_AFTER);
+
+    for (int y = 0; y < height; ++y)
+        png_write_row(png, data + y*stride);
+
+    png_write_end(png, info);
+    png_destroy_write_struct(&png, &info);
+
+    return true;
+}
+
+// info is the caller's since it's changed after setjmp, and a local that is
+// has no set value after the jump. The caller zeroes it, so it can still be
+// destroyed if making it is what failed.
+static bool writeJPEG(jpeg_compress_struct& info, std::FILE* file, const unsigned char* data,
+        int width, int height, int channels, std::ptrdiff_t stride, unsigned char* rgb)
+{
+    JPEGError error;
+
+    info.err = jpeg_std_error(&error.mgr);
+    error.mgr.error_exit = jpegErrorExit;
+
+    if (setjmp(error.jump))
+    {
+        jpeg_destroy_compress(&info);
+        return false;
+    }
+
+    jpeg_create_compress(&info);
+    jpeg_stdio_dest(&info, file);
+
+    info.image_width = width;
+    info.image_height = height;
+    info.input_components = (channels == 1)?1:3;
+    info.in_color_space = (channels == 1)?JCS_GRAYSCALE:JCS_RGB;
+
+    jpeg_set_defaults(&info);
+    jpeg_set_quality(&info, JPEG_QUALITY, TRUE);
+    jpeg_start_compress(&info, TRUE);
+
+    for (int y = 0; y < height; ++y)
+    {
+        const unsigned char* in = data + y*stride;
+        JSAMPROW row = const_cast<JSAMPROW>(in);
+
+        // libjpeg only takes RGB, so copy the first three channels
+        if (channels == 4)
+        {
+            for (int x = 0; x < width; ++x, in += 4)
+            {
+                rgb[x*3] = in[0];
+                rgb[x*3+1] = in[1];
+                rgb[x*3+2] = in[2];
+            }
+
+            row = rgb;
+        }
+
+        jpeg_write_scanlines(&info, &row, 1);
+    }
+
+    jpeg_finish_compress(&info);
+    jpeg_destroy_compress(&info);
+
+    return true;
+}
+
+bool canEncode(const std::string& filename)
+{
+    const ILenum type = ilTypeFromExt(filename.c_str());
+    return type == IL_PNG || type == IL_JPG;
+}
+
+void encodeImage(const std::string& filename, const unsigned char* data,
+        int width, int height, int channels, std::ptrdiff_t stride, int compression)
+{
+    if (width <= 0 || height <= 0)
+        throw std::runtime_error("could not save empty image");
+
+    if (channels != 1 && channels != 3 && channels != 4)
+        throw std::runtime_error("can only save images with 1, 3, or 4 channels");
+
+    if (compression < 0 || compression > 9)
+        throw std::runtime_error("compression must be from 0 to 9");
+
+    std::FILE* file = std::fopen(filename.c_str(), "wb");
+
+    if (!file)
+        throw std::runtime_error("could not save image");
+
+    bool saved = false;
+
+    if (ilTypeFromExt(filename.c_str()) == IL_PNG)
+    {
+        saved = writePNG(file, data, width, height, channels, stride, compression);
+    }
+    else
+    {
+        std::vector<unsigned char> rgb((channels == 4)?static_cast<std::size_t>(width)*3:0);
+        jpeg_compress_struct info{};
+        saved = writeJPEG(info, file, data, width, height, channels, stride, rgb.data());
+    }
+
+    if (std::fclose(file) != 0)
+        saved = false;
+
+    if (!saved)
+    {
+        std::remove(filename.c_str());
+        throw std::runtime_error("could not save image");
+    }
+}
@@ -0,0 +1,37 @@
+/*
+ * Write PNGs and JPEGs straight from rows of pixels with libpng and libjpeg
+ *
+ *   if (canEncode(filename))
+ *       encodeImage(filename, pixels.row(0), w, h, 3, pixels.stride(), 6);
+ *
+ * Saving with DevIL can only be done one image at a time, since it keeps the
+ * image being saved in global state. Each call here only uses its own, so
+ * all the photos on a page can be compressed at once, each on its own thread.
+ */
+
+#ifndef H_ENCODE
+#define H_ENCODE
+
+#include <string>
+#include <cstddef>
+
+// zlib's levels, from 0 for no compression to 9 for the smallest files. 6 is
+// what libpng uses by default.
+static const int DEFAULT_COMPRESSION = 6;
+
+// JPEGs don't have levels, so they're always saved at DevIL's default quality
+static const int JPEG_QUALITY = 99;
+
+// Whether encodeImage can write this type of file, from its extension the
+// same way DevIL would pick the type
+bool canEncode(const std::string& filename);
+
+// The rows are stride bytes apart starting with the top one, so a negative
+// stride is for images stored bottom up. With 1 channel it's grayscale, with
+// 3 or 4 it's RGB, ignoring the fourth. Throws std::runtime_error if it can't
+// be written.
+void encodeImage(const std::string& filename, const unsigned char* data,
+        int width, int height, int channels, std::ptrdiff_t stride,
+        int compression = DEFAULT_COMPRESSION);
+
+#endif
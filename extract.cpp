@@ -0,0 +1,47 @@
+#include <memory>
+#include <stdexcept>
+
+#include "extract.h"
+#include "pipeline.h"
+
+ExtractedPhotos extractPhotos(const char* data, std::size_t size, const ExtractOptions& options)
+{
+    initPipeline();
+
+    if (options.scale < 1)
+        throw std::runtime_error("scale must be greater than zero");
+
+    // Pages are big, and the blobs point into its arena, so don't put it on
+    // the stack
+    std::unique_ptr<Page> page(new Page);
+    page->filename = options.filename;
+    page->type = options.type;
+
+    if (page->type == IL_TYPE_UNKNOWN && !page->filename.empty())
+        page->type = ilTypeFromExt(page->filename.c_str());
+
+    if (page->type == IL_TYPE_UNKNOWN || page->type == IL_RAW)
+        throw std::runtime_error("not supported file type \"" + page->filename + "\"");
+
+    page->data = data;
+    page->size = size;
+
+    decodePage(*page, options.cache);
+
+    if (!page->failed)
+        preprocessPage(*page, options.scale, false, options.cache);
+
+    if (!page->failed)
+        detectPage(*page, options.scale, false, options.cache);
+
+    if (page->failed)
+        throw std::runtime_error("invalid image \"" + page->filename + "\"");
+
+    ExtractedPhotos result;
+    result.photos = std::move(page->photos);
+    result.quads = std::move(page->quads);
+    result.log = page->out.str();
+    result.warnings = page->err.str();
+
+    return result;
+}
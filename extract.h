@@ -0,0 +1,65 @@
+/*
+ * Find the photos in an image that's already in memory, for using fotoloc
+ * from other programs rather than running it on files
+ *
+ *   ExtractOptions options;
+ *   options.filename = "scan.jpg"; // Only used for the type
+ *   options.scale = 4;
+ *
+ *   const ExtractedPhotos result = extractPhotos(data, size, options);
+ *
+ *   for (std::size_t i = 0; i < result.photos.size(); ++i)
+ *       result.photos[i].write("photo" + std::to_string(i) + ".png");
+ *
+ * This runs the same stages as fotoloc does on each page, one after the
+ * other on the calling thread, so several threads can each extract their
+ * own images at once. Only decoding is one at a time, since DevIL can only
+ * load one image at a time.
+ */
+
+#ifndef H_EXTRACT
+#define H_EXTRACT
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+#include <IL/il.h>
+
+#include "quad.h"
+#include "pixels.h"
+
+class StageCache;
+
+struct ExtractOptions
+{
+    // The image type, or if unknown, found from the extension of filename
+    ILenum type = IL_TYPE_UNKNOWN;
+    std::string filename;
+
+    // Find the photos on a copy 1/scale the size, as with -s
+    int scale = 1;
+
+    // Start from what's in the cache and save what's made to it, as with
+    // --cache
+    const StageCache* cache = nullptr;
+};
+
+struct ExtractedPhotos
+{
+    // Each photo cut out and straightened, and where its corners were in the
+    // image
+    std::vector<Pixels<3>> photos;
+    std::vector<Quad> quads;
+
+    // What fotoloc would have printed for this image
+    std::string log;
+    std::string warnings;
+};
+
+// Throws std::runtime_error if the type isn't known or the image couldn't be
+// decoded. The data is only read during the call.
+ExtractedPhotos extractPhotos(const char* data, std::size_t size,
+        const ExtractOptions& options = ExtractOptions());
+
+#endif
@@ -2,16 +2,14 @@
  * Extract images from scanned pages
  */
 
-#include <locale>
+#include <map>
+#include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 #include <fstream>
-#include <sstream>
+#include <cstdlib>
 #include <iostream>
-#include <algorithm>
-
-// For loading/saving images
-#include <IL/il.h>
 
 // For determining if files exist
 #include <unistd.h>
@@ -19,236 +17,320 @@
 #include <sys/types.h>
 
 // Our code
-#include "line.h"
-#include "math.h"
-#include "blobs.h"
-#include "outline.h"
-#include "pixels.h"
-#include "regions.h"
-
-// Get the lowercase extension from filename (the last bit after the .), e.g.
-//  a.b.c.JPG would yield 'jpg'
-std::string getExt(const std::string& filename)
-{
-    std::string ext;
-
-    // Go back through the string till the first dot
-    for (int i = filename.length()-1; i >= 0; --i)
-    {
-        if (filename[i] == '.')
-            break;
+#include "bufferpool.h"
+#include "cache.h"
+#include "encode.h"
+#include "stats.h"
+#include "pipeline.h"
 
-        // Insert this letter lowercase at the beginning
-        ext.insert(0, 1, std::tolower(filename[i]));
-    }
-
-    return ext;
-}
+// With --serve, most bytes of freed buffers to keep for later pages
+static const std::size_t SERVE_KEPT_BYTES = 1024*1024*1024;
 
 int main(int argc, char* argv[])
 {
-    ilInit();
+    initPipeline();
 
     // Get the files to parse
     struct stat info;
     std::vector<std::string> files;
 
-    for (int i = 1; i < argc; ++i)
-    {
-        if (stat(argv[i], &info) == 0 && (info.st_mode&S_IFREG))
-            files.push_back(argv[i]);
-        else
-            std::cerr << "Warning: " << argv[i] << " not found" << std::endl;
-    }
+    // Number of pages to work on at once
+    int jobs = 1;
+    int scale = 1;
 
-    unsigned int uid = 0;
+    // Rows at a time to read TIFFs in, or zero to load them all at once
+    int band_rows = 0;
 
-    // For each of them, extract the images
-    for (unsigned int i = 0; i < files.size(); ++i)
+    // Also save each page with the outlines and corners drawn on it
+    bool debug = false;
+
+    // zlib level for the PNGs, from 0 for the fastest to 9 for the smallest
+    int compression = DEFAULT_COMPRESSION;
+
+    // Where to write how long each stage took, as JSON or CSV depending on
+    // the extension
+    std::string stats_filename;
+
+    // Where to keep what each stage made, to start from on later runs
+    std::unique_ptr<StageCache> cache;
+
+    // After the files given, read more from stdin
+    bool serve = false;
+
+    for (int i = 1; i < argc; ++i)
     {
-        // Load file, from: http://stackoverflow.com/a/18816228/2698494
-        std::ifstream file(files[i], std::ios::binary);
-        file.seekg(0, std::ios::end);
-        std::streamsize size = file.tellg();
-        file.seekg(0, std::ios::beg);
+        const std::string arg = argv[i];
 
-        std::vector<char> buffer(size);
+        if (arg == "-j" || (arg.size() > 2 && arg.compare(0, 2, "-j") == 0))
+        {
+            const std::string value = (arg == "-j")?((i+1 < argc)?argv[++i]:""):arg.substr(2);
+            jobs = std::atoi(value.c_str());
 
-        if (!file.read(buffer.data(), size))
+            if (jobs < 1)
+            {
+                std::cerr << "Error: -j needs a number of jobs greater than zero" << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "-s" || (arg.size() > 2 && arg.compare(0, 2, "-s") == 0))
         {
-            std::cerr << "Warning: couldn't read file \"" << files[i] << "\"" << std::endl;
-            continue;
+            const std::string value = (arg == "-s")?((i+1 < argc)?argv[++i]:""):arg.substr(2);
+            scale = std::atoi(value.c_str());
+
+            if (scale < 1)
+            {
+                std::cerr << "Error: -s needs a scale greater than zero" << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "-b" || (arg.size() > 2 && arg.compare(0, 2, "-b") == 0))
+        {
+            const std::string value = (arg == "-b")?((i+1 < argc)?argv[++i]:""):arg.substr(2);
+            band_rows = std::atoi(value.c_str());
+
+            if (band_rows < 1)
+            {
+                std::cerr << "Error: -b needs a number of rows greater than zero" << std::endl;
+                return 1;
+            }
         }
+        else if (arg == "-z" || (arg.size() > 2 && arg.compare(0, 2, "-z") == 0))
+        {
+            const std::string value = (arg == "-z")?((i+1 < argc)?argv[++i]:""):arg.substr(2);
+            compression = std::atoi(value.c_str());
 
-        // Get extension
-        ILenum type = ilTypeFromExt(files[i].c_str());
+            if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos ||
+                compression > 9)
+            {
+                std::cerr << "Error: -z needs a compression level from 0 to 9" << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "-d")
+        {
+            debug = true;
+        }
+        else if (arg == "--serve")
+        {
+            serve = true;
+        }
+        else if (arg == "--stats" || arg.compare(0, 8, "--stats=") == 0)
+        {
+            stats_filename = (arg == "--stats")?((i+1 < argc)?argv[++i]:""):arg.substr(8);
 
-        if (type == IL_TYPE_UNKNOWN)
+            if (getExt(stats_filename) != "json" && getExt(stats_filename) != "csv")
+            {
+                std::cerr << "Error: --stats needs a .json or .csv file" << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--cache" || arg.compare(0, 8, "--cache=") == 0)
         {
-            std::string extension = getExt(files[i]);
+            const std::string dir = (arg == "--cache")?((i+1 < argc)?argv[++i]:""):arg.substr(8);
 
-            if (extension == "pdf")
+            if (dir.empty())
             {
-                std::cerr << "Warning: PDF image extraction not implemented yet" << std::endl;
-                continue;
+                std::cerr << "Error: --cache needs a directory" << std::endl;
+                return 1;
             }
-            else
+
+            try
             {
-                std::cerr << "Warning: not supported file type \"" << files[i] << "\"" << std::endl;
-                continue;
+                cache.reset(new StageCache(dir));
+            }
+            catch (const std::runtime_error& e)
+            {
+                std::cerr << "Error: " << e.what() << std::endl;
+                return 1;
             }
         }
+        else if (stat(argv[i], &info) == 0 && (info.st_mode&S_IFREG))
+        {
+            files.push_back(argv[i]);
+        }
+        else
+        {
+            std::cerr << "Warning: " << argv[i] << " not found" << std::endl;
+        }
+    }
+
+    std::ofstream stats_file;
+    const bool stats_json = getExt(stats_filename) == "json";
 
-        // Output filename
-        std::ostringstream s;
-        s << "image" << uid << ".png";
-        std::ostringstream s_contours;
-        s_contours << "image" << uid << "_contours.png";
-        /*
-        // TODO: remove
-        std::ostringstream s_blurred;
-        s_blurred << "image" << uid << "_blurred.png";
-        std::ostringstream s_quantized;
-        s_quantized << "image" << uid << "_quantized.png";
-        */
-        ++uid;
-
-        // Load image
-        const Pixels<3> img(type, &buffer[0], size, files[i]);
-
-        if (!img.valid())
+    if (!stats_filename.empty())
+    {
+        stats_file.open(stats_filename);
+
+        if (!stats_file)
         {
-            std::cerr << "Warning: invalid image \"" << files[i] << "\"" << std::endl;
-            continue;
+            std::cerr << "Error: couldn't write to \"" << stats_filename << "\"" << std::endl;
+            return 1;
         }
 
-        // Recursive rectangular finder
-        //std::vector<Rect> regions = findRegions(img);
-
-        //
-        // Options
-        //
-        const int quantizeAmount = 10;
-        const int blurAmount = 2;
-        const int min_dist = 100;
-        const int max_length = 2*img.width()*img.height();
-
-        // Average dist from line between two points as percentage of line length
-        const double maxLineError = 0.04;
-
-        // Blur and quantize
-        std::cout << "Blur" << std::endl;
-        Pixels<3> blurred = img.blur(blurAmount);
-        std::cout << "Quantize" << std::endl;
-        Pixels<3> quantized = blurred.quantize(quantizeAmount);
-        Pixels<3> contours(quantized.ref(), quantized.filename());
-
-        // Detect blobs
-        std::cout << "Blobs" << std::endl;
-        const Blobs blobs(quantized);
-
-        std::cout << "Outline" << std::endl;
-        for (const CoordPair& pair : blobs)
+        if (stats_json)
+            stats_file << "[";
+        else
+            Stats::writeCSVHeader(stats_file);
+    }
+
+    // A page read from stdin is usually about the size of the one before, so
+    // keep the big buffers of each for the next to reuse instead of giving
+    // them back to the kernel
+    if (serve)
+        BufferPool::setLimit(SERVE_KEPT_BYTES);
+
+    // Reading and decoding are done one at a time, the ones in the middle do
+    // jobs pages at once, and then saving is one at a time again. The queues
+    // limit how many pages are in memory at once.
+    PageQueue decode(jobs);
+    PageQueue preprocess(jobs);
+    PageQueue detect(jobs);
+    PageQueue encode(jobs);
+    std::vector<std::thread> threads;
+
+    threads.push_back(std::thread([&files, &decode, band_rows, serve]()
+    {
+        unsigned int seq = 0;
+        unsigned int uid = 0;
+
+        auto submit = [&](const std::string& filename)
         {
-            // This may be the height, width, or diagonal
-            double dist = distance(pair.first, pair.last);
+            if (getExt(filename) == "pdf")
+            {
+                readPDF(filename, seq, uid, decode);
+                return;
+            }
 
-            // Get rid of most the really big or really small objects
-            if (dist > min_dist)
+            if (band_rows > 0 && (getExt(filename) == "tif" || getExt(filename) == "tiff"))
             {
-                // Find the region boundary, i.e. compute the points on the
-                // outline of the blob
-                const Outline outline(blobs, pair.first, max_length);
-                const std::vector<Coord>& points = outline.points();
-                //const std::vector<Line> lines = findLinesHalvingExtending(points, maxLineError);
-                const std::vector<Line> lines = findLinesExtendingDecreasingError(points, maxLineError);
+                readTIFF(filename, seq, uid, decode);
+                return;
+            }
 
-                for (const Coord& c : points)
-                    contours.mark(c, 1);
+            std::unique_ptr<Page> page(new Page);
+            page->seq = seq++;
+            page->filename = filename;
 
-                for (const Line& line : lines)
-                {
-                    std::cout << line.p1 << " " << line.p2 <<  " Len: " << line.length << std::endl;
-                    quantized.line(line.p1, line.p2);
-                    quantized.mark(line.p1);
-                    quantized.mark(line.p2);
-                }
+            // The numbering depends only on the order of the files
+            if (readPage(*page))
+                page->uid = uid++;
+            else
+                page->failed = true;
 
-                /* Naive line detection
-                const int maxLines = 6; // Max number of lines for a region
-                const int minjump = 500; // Minimum length of straight line
-                const int linejump = 100; // Amount to jump when checking for new straight lines
-                const int checkjump = 5; // Amount to jump between points between the two points
-                const int avgThresh = 10; // Max average distance from line between points
-                const int stddevThresh = 10; // Max standard deviation from line between points
+            decode.push(std::move(page));
+        };
 
-                const int size = points.size();
+        for (unsigned int i = 0; i < files.size(); ++i)
+            submit(files[i]);
 
-                // The lines for this region
-                std::vector<Line> lines;
+        // Keep going with the same threads, one file per line, until stdin is
+        // closed. After each file's pages comes an empty page that only
+        // prints that it's done, so whoever's sending them knows when the
+        // output for that file is all there.
+        std::string filename;
 
-                // Find the long straight portions of the region boundary
-                for (int i = 0; i < size-minjump; i+=linejump)
-                {
-                    // Start out with the longest line possible
-                    for (int j = size-1; j > i+minjump; j-=linejump)
-                    {
-                        double length = distance(points[i], points[j]);
+        while (serve && std::getline(std::cin, filename))
+        {
+            struct stat info;
+
+            if (filename.empty())
+                continue;
 
-                        // Skip if the two points are too close together
-                        if (length < minjump)
-                            continue;
+            const bool found = stat(filename.c_str(), &info) == 0 && (info.st_mode&S_IFREG);
 
-                        // Look at how close the points between points i and j
-                        // on this contour fall to the line between i and j
-                        std::vector<double> dist;
+            if (found)
+                submit(filename);
 
-                        for (int k = i+1; k < j; k+=checkjump)
-                            dist.push_back(distance(points[i], points[j], points[k]));
+            std::unique_ptr<Page> done(new Page);
+            done->seq = seq++;
+            done->filename = filename;
+            done->failed = true;
 
-                        double avg = average(dist);
-                        double stddev = stdev(dist);
+            if (!found)
+                done->err << "Warning: " << filename << " not found" << std::endl;
 
-                        // If low average distance and standard deviation, then
-                        // this is approximately straight
-                        if (avg < avgThresh && stddev < stddevThresh)
-                        {
-                            lines.push_back(Line(points[i], points[j], length));
+            done->out << "Done: " << filename << std::endl;
+            decode.push(std::move(done));
+        }
 
-                            // Jump extra if we detect a line
-                            i += std::max(minjump-linejump, 0);
+        decode.close();
+    }));
 
-                            // Exit this inner loop since we found the longest
-                            // line with the first point
-                            break;
-                        }
-                    }
-                }
+    // Pages of TIFFs read in bands are only looked at when detecting
+    const StageCache* stage_cache = cache.get();
+
+    startStage(threads, 1, decode, preprocess,
+            [stage_cache](Page& page) { if (page.tiff_page < 0) decodePage(page, stage_cache); });
+    startStage(threads, jobs, preprocess, detect,
+            [scale, debug, stage_cache](Page& page)
+            {
+                if (page.tiff_page < 0)
+                    preprocessPage(page, scale, debug, stage_cache);
+            });
+    startStage(threads, jobs, detect, encode,
+            [scale, band_rows, debug, stage_cache](Page& page)
+            {
+                if (page.tiff_page < 0)
+                    detectPage(page, scale, debug, stage_cache);
+                else
+                    detectBands(page, band_rows);
+
+                // Nothing from detecting is used after this
+                page.arena.reset();
+            });
+
+    // Pages come out of the parallel stages in any order, so hold on to them
+    // until it's their turn. They're saved and their output printed in the
+    // same order as if they were done one at a time.
+    threads.push_back(std::thread([&encode, debug, compression, &stats_file, stats_json]()
+    {
+        std::map<unsigned int, std::unique_ptr<Page>> waiting;
+        unsigned int next = 0;
+        unsigned int written = 0;
+        std::unique_ptr<Page> page;
+
+        while (encode.pop(page))
+        {
+            const unsigned int seq = page->seq;
+            waiting[seq] = std::move(page);
 
-                // Sort by length, longest first, so we only process the first
-                // few longest lines
-                std::sort(lines.begin(), lines.end(), std::greater<Line>());
+            while (!waiting.empty() && waiting.begin()->first == next)
+            {
+                Page& p = *waiting.begin()->second;
+
+                if (!p.failed)
+                    encodePage(p, debug, compression);
+
+                std::cerr << p.err.str();
+                std::cout << p.out.str() << std::flush;
 
-                for (int i = 0; i < maxLines && i < lines.size(); ++i)
+                // Files that couldn't be read never got to any stage
+                if (stats_file.is_open() && !p.stats.empty())
                 {
-                    quantized.mark(findMidpoint(lines[i].p1, lines[i].p2));
-                    quantized.line(lines[i].p1, lines[i].p2);
-                }*/
+                    if (stats_json)
+                    {
+                        stats_file << ((written > 0)?",\n ":"\n ");
+                        p.stats.writeJSON(stats_file, p.uid, p.filename);
+                    }
+                    else
+                    {
+                        p.stats.writeCSV(stats_file, p.uid, p.filename);
+                    }
+
+                    ++written;
+                }
+
+                waiting.erase(waiting.begin());
+                ++next;
             }
         }
+    }));
 
-        // Save image
-        std::cout << "Saving " << s.str() << std::endl;
-        quantized.save(s.str(), true, true, OutputColor::Color);
-        std::cout << "Saving " << s_contours.str() << std::endl;
-        contours.save(s_contours.str(), true, true, OutputColor::Color);
-        /*
-        std::cout << "Saving " << s_blurred.str() << std::endl;
-        blurred.save(s_blurred.str(), false, false, OutputColor::Color);
-        std::cout << "Saving " << s_quantized.str() << std::endl;
-        quantized.save(s_quantized.str(), false, false, OutputColor::Color);
-        */
-    }
+    for (std::thread& t : threads)
+        t.join();
+
+    if (stats_json)
+        stats_file << "\n]\n";
 
     return 0;
 }
@@ -10,6 +10,7 @@
 #include <algorithm>
 
 #include "rect.h"
+#include "pixelbuffer.h"
 
 // Templated on number of channels
 template<int N>
@@ -22,9 +23,9 @@ class Histogram
     std::array<std::vector<int>, N> graph;
 
 public:
-    // Each inner vector is assumed to have the same length
-    Histogram(const std::vector<std::vector<std::array<unsigned char, N>>>& img,
-            Rect rect = default_rect);
+    // Count the pixels in the view, which may be the whole image or just a
+    // rectangle within it, e.g. Histogram<N>(img.ref().view(rect))
+    Histogram(const PixelView<N>& img);
 
     // Auto threshold. Specify the initial threshold to use to determine the
     // foreground and background.
@@ -51,48 +52,35 @@ public:
  */
 
 template<int N>
-Histogram<N>::Histogram(
-        const std::vector<std::vector<std::array<unsigned char, N>>>& img, Rect rect)
+Histogram<N>::Histogram(const PixelView<N>& img)
     : graphGray(256, 0) // This is unsigned char, so there's 0-255
 {
     // Fill the array with the same as graphGray
     graph.fill(graphGray);
 
-    int h = img.size();
-    int w = (h>0)?img[0].size():0;
+    const int w = img.width();
+    const int h = img.height();
     total = w*h;
 
-    // Specify custom bounds in the image if not the default rectangle
-    int minX = 0;
-    int minY = 0;
-    int maxX = w;
-    int maxY = h;
-
-    if (rect != default_rect)
-    {
-        minX = rect.tl.x;
-        minY = rect.tl.y;
-        maxX = rect.br.x;
-        maxY = rect.br.y;
-    }
-
     // Generate the graph by counting how many pixels are each shade. This
     // is easy with discrete values, would be more interesting with doubles.
-    for (int y = minY; y < maxY; ++y)
+    for (int y = 0; y < h; ++y)
     {
-        for (int x = minX; x < maxX; ++x)
+        const std::array<unsigned char, N>* row = img[y];
+
+        for (int x = 0; x < w; ++x)
         {
             // Grayscale graph
             int sum = 0;
 
             for (int i = 0; i < N; ++i)
-                sum += img[y][x][i];
+                sum += row[x][i];
 
             ++graphGray[sum/N];
 
             // Individual channels
             for (int i = 0; i < N; ++i)
-                ++graph[i][img[y][x][i]];
+                ++graph[i][row[x][i]];
         }
     }
 }
@@ -1,3 +1,5 @@
+#include <limits>
+
 #include "line.h"
 
 bool operator==(const Line& l1, const Line& l2)
@@ -25,6 +27,149 @@ bool operator>=(const Line& l1, const Line& l2)
     return l1.length >= l2.length;
 }
 
+PathMoments::PathMoments(const std::vector<Coord>& path)
+    : prefix(path.size()+1)
+{
+    if (path.empty())
+        return;
+
+    const Coord& anchor = path[0];
+
+    for (std::vector<Coord>::size_type k = 0; k < path.size(); ++k)
+    {
+        const long long x = path[k].x - anchor.x;
+        const long long y = path[k].y - anchor.y;
+        const Sums& before = prefix[k];
+        Sums& after = prefix[k+1];
+
+        after.x  = before.x  + x;
+        after.y  = before.y  + y;
+        after.xx = before.xx + x*x;
+        after.yy = before.yy + y*y;
+        after.xy = before.xy + x*y;
+    }
+}
+
+Coord PathMoments::point(int k) const
+{
+    return Coord(prefix[k+1].x - prefix[k].x, prefix[k+1].y - prefix[k].y);
+}
+
+void PathMoments::distances(int i, int j, long long& count, double& length,
+        double& sum, double& squares) const
+{
+    const int n = size();
+
+    count = 0;
+    length = sum = squares = 0;
+
+    if (n == 0)
+        return;
+
+    i = i%n;
+    j = j%n;
+
+    // Sums of the points after i up to but not including j, which if j isn't
+    // after i is the end of the path and then the beginning
+    Sums s;
+
+    auto add = [&](int from, int to)
+    {
+        s.x  += prefix[to].x  - prefix[from].x;
+        s.y  += prefix[to].y  - prefix[from].y;
+        s.xx += prefix[to].xx - prefix[from].xx;
+        s.yy += prefix[to].yy - prefix[from].yy;
+        s.xy += prefix[to].xy - prefix[from].xy;
+        count += to - from;
+    };
+
+    if (j > i)
+    {
+        add(i+1, j);
+    }
+    else
+    {
+        add(i+1, n);
+        add(0, j);
+    }
+
+    const Coord p = point(i);
+    const Coord q = point(j);
+    const long long a = q.x - p.x;
+    const long long b = q.y - p.y;
+    const double length2 = a*a + b*b;
+
+    length = std::sqrt(length2);
+
+    if (length2 == 0)
+        return;
+
+    // Sums of u = x - p.x and v = y - p.y, the points relative to point i
+    const long long su  = s.x - count*p.x;
+    const long long sv  = s.y - count*p.y;
+    const long long suu = s.xx - 2*p.x*s.x + count*p.x*p.x;
+    const long long svv = s.yy - 2*p.y*s.y + count*p.y*p.y;
+    const long long suv = s.xy - p.x*s.y - p.y*s.x + count*p.x*p.y;
+
+    // The signed distance of each is (a*v - b*u)/length. The squares can be
+    // too big for a long long, and rounding could make the sum a tiny bit
+    // negative when all the points are on the line.
+    sum = (1.0*a*sv - 1.0*b*su)/length;
+    squares = std::max(0.0, (1.0*a*a*svv - 2.0*a*b*suv + 1.0*b*b*suu)/length2);
+}
+
+double PathMoments::lineError(int i, int j) const
+{
+    long long count;
+    double length, sum, squares;
+    distances(i, j, count, length, sum, squares);
+
+    // Not a line, like dividing by the zero length in lineError()
+    if (length == 0)
+        return std::numeric_limits<double>::infinity();
+
+    if (count == 0)
+        return 0;
+
+    return std::sqrt(squares/count)/length;
+}
+
+bool PathMoments::isLine(int i, int j, double maxError) const
+{
+    if (i < 0 || j < 0 || i >= size() || j >= size())
+        return false;
+
+    long long count;
+    double length, sum, squares;
+    distances(i, j, count, length, sum, squares);
+
+    double rms = 0;
+    double stddev = 0;
+
+    if (count > 0)
+    {
+        const double mean = sum/count;
+        rms = std::sqrt(squares/count);
+        stddev = std::sqrt(std::max(0.0, squares/count - mean*mean));
+    }
+
+    // Same thresholds as isLine()
+    double avgThresh = length*maxError;
+    double stddevThresh = avgThresh/2;
+
+    return rms < avgThresh && stddev < stddevThresh;
+}
+
+// Space for the distances of the points between two points on a path, kept
+// for each thread since these are looked at for many pairs of points
+static std::vector<double>& distances()
+{
+    static thread_local std::vector<double> dist;
+    dist.clear();
+
+    return dist;
+}
+
 bool isLine(const std::vector<Coord>& path, int i, int j, double maxError)
 {
     // Make sure we don't get in an infinte loop. We need to reach point j
@@ -32,10 +177,10 @@ bool isLine(const std::vector<Coord>& path, int i, int j, double maxError)
     if (i < 0 || j < 0 || i >= path.size() || j >= path.size())
         return false;
 
-    std::vector<double> dist;
+    std::vector<double>& dist = distances();
 
     // Added complexity to make this work even if j < i, i.e. wrap around works
-    for (int k = i+1; k != j; k=(k+1)%path.size())
+    for (int k = (i+1)%path.size(); k != j; k=(k+1)%path.size())
         dist.push_back(distance(path[i], path[j], path[k]));
 
     // Right now just look at all the points between these two
@@ -61,7 +206,7 @@ bool isLine(const std::vector<Coord>& path, int i, int j, double maxError)
 
 double lineError(const std::vector<Coord>& path, int i, int j)
 {
-    std::vector<double> dist;
+    std::vector<double>& dist = distances();
 
     // Make sure we don't get in an infinte loop. We need to reach point j
     // to break out of this function, so make sure we can reach it.
@@ -89,11 +234,12 @@ std::vector<Line> findLinesHalvingExtending(
         return lines;
 
     const int size = path.size();
+    const PathMoments moments(path);
 
     // If the whole path is a line, we're done
     double wholeLength = distance(path[0], path[size-1]);
 
-    if (isLine(path, 0, size-1, maxError) && wholeLength > minLength)
+    if (moments.isLine(0, size-1, maxError) && wholeLength > minLength)
     {
         lines.push_back(Line(path[0], path[size-1], wholeLength));
         return lines;
@@ -120,12 +266,12 @@ std::vector<Line> findLinesHalvingExtending(
             break;
 
         // If this is a line, extend it until it isn't a line
-        if (isLine(path, i, i+length, maxError))
+        if (moments.isLine(i, i+length, maxError))
         {
             int largerLength = length+1;
 
             for ( ; i+largerLength < size; ++largerLength)
-                if (!isLine(path, i, i+largerLength, maxError))
+                if (!moments.isLine(i, i+largerLength, maxError))
                     break;
 
             // Subtract one since the last one resulted in it not being a line
@@ -156,12 +302,12 @@ std::vector<Line> findLinesHalvingExtending(
     for (int i = firstEnd; i < size+firstStart; ++i)
     {
         // Look at the longest possible line
-        if (isLine(path, i, i+minLength, maxError))
+        if (moments.isLine(i, i+minLength, maxError))
         {
             int largerLength = minLength+1;
 
             for ( ; i+largerLength < size; ++largerLength)
-                if (!isLine(path, i, i+largerLength, maxError))
+                if (!moments.isLine(i, i+largerLength, maxError))
                     break;
 
             // Subtract one since the last one resulted in it not being a line
@@ -180,18 +326,18 @@ std::vector<Line> findLinesHalvingExtending(
     return lines;
 }
 
-int findLargerLength(const std::vector<Coord>& path, double currentError,
+int findLargerLength(const PathMoments& moments, double currentError,
         int start, int currentLength, int maxLookAhead)
 {
     int increasing = 0;
-    int size = path.size();
+    int size = moments.size();
     int largerLength = currentLength+1;
 
     // Extend the current line until we reach a point where the error keeps
     // increasing
     for ( ; (start+largerLength)%size < start; ++largerLength)
     {
-        double newError = lineError(path, start, start+largerLength);
+        double newError = moments.lineError(start, start+largerLength);
 
         // If still a line, then make sure the next line is better than this
         // one. If not, then continue looking for a decrease for a bit and then
@@ -231,6 +377,7 @@ std::vector<Line> findLinesExtendingDecreasingError(
         return lines;
 
     const int size = path.size();
+    const PathMoments moments(path);
 
     // Look for a line of length half the total number of points, starting at
     // the beginning and sliding along toward the end, ending at the last point
@@ -253,7 +400,7 @@ std::vector<Line> findLinesExtendingDecreasingError(
             break;
 
         // What is the current error?
-        double currentError = lineError(path, i, i+length);
+        double currentError = moments.lineError(i, i+length);
 
         // If this is a line, extend it while the error is decreasing
         if (currentError < maxError)
@@ -261,7 +408,7 @@ std::vector<Line> findLinesExtendingDecreasingError(
             // TODO: take into consideration minlength??? make sure the lines
             // don't suddenly decrease in length even if largerLength is
             // increasing
-            int largerLength = findLargerLength(path, currentError, i, length, maxLookAhead);
+            int largerLength = findLargerLength(moments, currentError, i, length, maxLookAhead);
 
             firstStart = i;
             firstEnd = (i+largerLength)%size;
@@ -295,12 +442,12 @@ std::vector<Line> findLinesExtendingDecreasingError(
     for (int i = firstEnd; i < size+firstStart; i+=linejump)
     {
         // What is the current error?
-        double currentError = lineError(path, i, i+length);
+        double currentError = moments.lineError(i, i+length);
 
         // If this is a line, extend it while the error is decreasing
         if (currentError < maxError)
         {
-            int largerLength = findLargerLength(path, currentError, i, length, maxLookAhead);
+            int largerLength = findLargerLength(moments, currentError, i, length, maxLookAhead);
 
             // Save this as a line
             lines.push_back(Line(path[i%size], path[(i+largerLength)%size]));
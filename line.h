@@ -1,12 +1,20 @@
 /*
- * Provides two useful elements:
+ * Provides three useful elements:
  * - A class for storing lines that can be sorted based on length
+ * - A class for quickly finding how far points on a path are from lines
+ *   between points on that path
  * - A function to split up a list of points into line segments
+ *
+ * Checking many lines on the same path:
+ *   const PathMoments moments(path);
+ *   double error = moments.lineError(i, j); // Constant time
  */
 
 #ifndef H_LINE
 #define H_LINE
 
+#include <vector>
+
 #include "math.h"
 #include "coord.h"
 
@@ -29,12 +37,58 @@ bool operator<=(const Line& l1, const Line& l2);
 bool operator>(const Line& l1, const Line& l2);
 bool operator>=(const Line& l1, const Line& l2);
 
+// Running sums of the coordinates along a closed path, so that how far the
+// points between any two points are from the line between them doesn't depend
+// on how many points there are. Point indices wrap around the path.
+class PathMoments
+{
+    // Sums of the points before this one, relative to the first point on the
+    // path to keep the numbers small
+    struct Sums
+    {
+        long long x = 0;
+        long long y = 0;
+        long long xx = 0;
+        long long yy = 0;
+        long long xy = 0;
+    };
+
+    std::vector<Sums> prefix;
+
+public:
+    explicit PathMoments(const std::vector<Coord>& path);
+
+    int size() const { return prefix.size()-1; }
+
+    // Root mean square distance from the line between points i and j of the
+    // points between them, as a percentage of the length of the line. This
+    // is never less than the average distance that lineError(path, i, j)
+    // gives.
+    double lineError(int i, int j) const;
+
+    // Like isLine(path, i, j, maxError), though using the root mean square
+    // distance and the deviation of the signed distances, which makes it a
+    // bit stricter
+    bool isLine(int i, int j, double maxError) const;
+
+private:
+    // Point k relative to the first point
+    Coord point(int k) const;
+
+    // Number of points between i and j, the length of the line between them,
+    // and the sums of their signed and squared distances from that line
+    void distances(int i, int j, long long& count, double& length,
+            double& sum, double& squares) const;
+};
+
 // Look at how close the points between points i and j on this path fall to the
-// line between points i and j to determine if these two points form a line
+// line between points i and j to determine if these two points form a line.
+// This goes through all the points, so use PathMoments for long paths.
 bool isLine(const std::vector<Coord>& path, int i, int j, double maxError);
 
 // Return the average distance from the line between points i and j as a
-// percentage of the length of the line, giving the line error
+// percentage of the length of the line, giving the line error. This goes
+// through all the points, so use PathMoments for long paths.
 double lineError(const std::vector<Coord>& path, int i, int j);
 
 // Non-overlapping halving and extending line search algorithm
@@ -48,7 +102,7 @@ std::vector<Line> findLinesHalvingExtending(
 // Extend the line while the error is decreasing, proceed a bit futher, and
 // stop if the error doesn't drop below what it was before indicating that
 // we've already found the best line
-int findLargerLength(const std::vector<Coord>& path, double currentError,
+int findLargerLength(const PathMoments& moments, double currentError,
         int start, int currentLength, int maxLookAhead);
 
 // Non-overlapping extending while decreasing error line search algorithm
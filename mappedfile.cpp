@@ -0,0 +1,85 @@
+#include "mappedfile.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+MappedFile::MappedFile(const std::string& filename)
+{
+    const int fd = open(filename.c_str(), O_RDONLY);
+
+    if (fd == -1)
+        throw std::runtime_error("couldn't open \"" + filename + "\": " + std::strerror(errno));
+
+    struct stat info;
+
+    if (fstat(fd, &info) == -1)
+    {
+        const int error = errno;
+        close(fd);
+        throw std::runtime_error("couldn't read \"" + filename + "\": " + std::strerror(error));
+    }
+
+    // Can't map nothing
+    if (info.st_size > 0)
+    {
+        void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (mapping == MAP_FAILED)
+        {
+            const int error = errno;
+            close(fd);
+            throw std::runtime_error("couldn't map \"" + filename + "\": " + std::strerror(error));
+        }
+
+        // The decoders go through it from start to end
+        madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+
+        begin = static_cast<const char*>(mapping);
+        length = info.st_size;
+    }
+
+    // The mapping stays around after the file is closed
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    unmap();
+}
+
+MappedFile::MappedFile(MappedFile&& other)
+    : begin(other.begin), length(other.length)
+{
+    other.begin = nullptr;
+    other.length = 0;
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other)
+{
+    if (this != &other)
+    {
+        unmap();
+
+        begin = other.begin;
+        length = other.length;
+        other.begin = nullptr;
+        other.length = 0;
+    }
+
+    return *this;
+}
+
+void MappedFile::unmap()
+{
+    if (begin)
+        munmap(const_cast<char*>(begin), length);
+
+    begin = nullptr;
+    length = 0;
+}
@@ -0,0 +1,44 @@
+/*
+ * Map a file into memory rather than reading it into a buffer
+ *
+ *   MappedFile file("page.jpg");
+ *   ilLoadL(IL_JPG, file.data(), file.size());
+ *
+ * The pages are only read in as they're used, and since they're backed by the
+ * file, the kernel can drop them again under memory pressure rather than
+ * writing them to swap.
+ */
+
+#ifndef H_MAPPEDFILE
+#define H_MAPPEDFILE
+
+#include <string>
+#include <cstddef>
+
+class MappedFile
+{
+    const char* begin = nullptr;
+    std::size_t length = 0;
+
+public:
+    MappedFile() { }
+
+    // Throws std::runtime_error if it can't be opened or mapped
+    explicit MappedFile(const std::string& filename);
+    ~MappedFile();
+
+    MappedFile(MappedFile&& other);
+    MappedFile& operator=(MappedFile&& other);
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // An empty file is valid but has no data
+    const char* data() const { return begin; }
+    std::size_t size() const { return length; }
+
+private:
+    void unmap();
+};
+
+#endif
@@ -22,8 +22,8 @@ const std::array<Coord, 8> Outline::matrix = {{
 }};
 
 Outline::Outline(const Blobs& blobs, const Coord& point,
-    const int max_length)
-    : blobs(blobs)
+    const int max_length, VisitedMap& visited)
+    : blobs(blobs), visited(visited)
 {
     // Current label so we only walk around this object
     label = blobs.label(point);
@@ -34,6 +34,18 @@ Outline::Outline(const Blobs& blobs, const Coord& point,
         return;
     }
 
+    // Every point we go to is next to a pixel of this object
+    Rect area = blobs.bounds(label);
+    area.tl += Coord(-1, -1);
+    area.br += Coord(1, 1);
+
+    visited.reset(area);
+    found = walk(point, max_length);
+    visited.clear(path);
+}
+
+bool Outline::walk(const Coord& point, const int max_length)
+{
     // Start one pixel above this first point (we wouldn't have been given this
     // point if the pixel above it was black)
     Coord position(point.x, point.y-1);
@@ -56,17 +68,17 @@ Outline::Outline(const Blobs& blobs, const Coord& point,
         // we had to retrace our steps a ways)
         position = edge.point+matrix[edge.index];
         path.push_back(position);
-        sortedpath.insert(position);
+        visited.visit(position);
 
         // Give up after we reach a certain size of object
         ++iterations;
 
         if (iterations > max_length)
-            return;
+            return false;
     }
 
     // If we didn't return already, we found the points.
-    found = true;
+    return true;
 }
 
 // If we've been to pixel before, go back till we can go some place new.
@@ -121,7 +133,7 @@ int Outline::findIndex(const Coord& p) const
         const Coord previous = p+matrix[back];
 
         if (blobs.label(current) == label && blobs.label(previous) != label &&
-            sortedpath.find(previous) == sortedpath.end())
+            !visited.visited(previous))
         {
             result = back;
             break;
@@ -130,3 +142,40 @@ int Outline::findIndex(const Coord& p) const
 
     return result;
 }
+
+VisitedMap& VisitedMap::local()
+{
+    static thread_local VisitedMap map;
+    return map;
+}
+
+void VisitedMap::reset(const Rect& rect)
+{
+    const std::size_t size = static_cast<std::size_t>(rect.width())*rect.height();
+
+    // If the last outline didn't finish, we don't know which bits are set
+    if (in_use)
+        std::fill(bits.begin(), bits.end(), 0);
+
+    // Everything is already cleared, so this just needs to be big enough
+    if (bits.size() < (size+63)/64)
+        bits.resize((size+63)/64, 0);
+
+    area = rect;
+    stride = rect.width();
+    in_use = true;
+}
+
+void VisitedMap::clear(const std::vector<Coord>& points)
+{
+    for (const Coord& p : points)
+    {
+        if (p.x < area.tl.x || p.y < area.tl.y || p.x > area.br.x || p.y > area.br.y)
+            continue;
+
+        const std::size_t i = index(p);
+        bits[i/64] &= ~(static_cast<std::uint64_t>(1) << (i%64));
+    }
+
+    in_use = false;
+}
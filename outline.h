@@ -8,10 +8,11 @@
 #ifndef H_OUTLINE
 #define H_OUTLINE
 
-#include <set>
 #include <array>
 #include <vector>
+#include <cstdint>
 
+#include "rect.h"
 #include "blobs.h"
 
 // Used to return both point to jump to (if we had to go back a ways
@@ -25,6 +26,56 @@ struct EdgePair
         :point(p), index(i) { }
 };
 
+// Which points an outline has been to, one bit each for the points in a
+// rectangle, so checking is a lookup rather than a search. The bits are
+// cleared afterwards by going back over the points, so the same map can be
+// used for one outline after another without clearing the whole rectangle.
+class VisitedMap
+{
+    Rect area;
+    int stride = 0;
+    std::vector<std::uint64_t> bits;
+
+    // Set while someone is using the map, so we know if it wasn't cleared
+    bool in_use = false;
+
+public:
+    // Start over, only keeping track of points in the rectangle (including
+    // both corners)
+    void reset(const Rect& rect);
+
+    // Unset the given points, which should be all of the ones that were set
+    void clear(const std::vector<Coord>& points);
+
+    // Points outside the rectangle are never visited
+    bool visited(const Coord& p) const
+    {
+        if (p.x < area.tl.x || p.y < area.tl.y || p.x > area.br.x || p.y > area.br.y)
+            return false;
+
+        const std::size_t i = index(p);
+        return (bits[i/64] >> (i%64)) & 1;
+    }
+
+    void visit(const Coord& p)
+    {
+        if (p.x < area.tl.x || p.y < area.tl.y || p.x > area.br.x || p.y > area.br.y)
+            return;
+
+        const std::size_t i = index(p);
+        bits[i/64] |= static_cast<std::uint64_t>(1) << (i%64);
+    }
+
+    // One for each thread, used by Outline unless given another
+    static VisitedMap& local();
+
+private:
+    std::size_t index(const Coord& p) const
+    {
+        return static_cast<std::size_t>(p.y - area.tl.y)*stride + (p.x - area.tl.x);
+    }
+};
+
 // Get the outline of the object
 class Outline
 {
@@ -35,7 +86,9 @@ class Outline
 
     // Save the outline of this object
     std::vector<Coord> path;
-    std::set<Coord> sortedpath; // Faster for contains a point check
+
+    // Faster for contains a point check, only used while finding the path
+    VisitedMap& visited;
 
     // Did we find the outline?
     bool found = false;
@@ -45,13 +98,18 @@ class Outline
     static const std::array<Coord, 8> matrix;
 
 public:
-    Outline(const Blobs& blobs, const Coord& point, const int max_length);
+    Outline(const Blobs& blobs, const Coord& point, const int max_length,
+            VisitedMap& visited = VisitedMap::local());
 
     bool good() const { return found; }
 
     const std::vector<Coord>& points() const { return path; }
 
 private:
+    // Walk around the edge, filling in path, returning whether we made it
+    // all the way around
+    bool walk(const Coord& point, const int max_length);
+
     // Find the next pixel on edge by finding index of matrix used to move, or
     // if no available locations, moving back through our history till we can move
     // and returning that point and the index of the matrix to use to move.
@@ -0,0 +1,58 @@
+#include <stdexcept>
+
+#include "palette.h"
+
+PaletteImage::PaletteImage(int width, int height, int channel_count, int amount)
+    :w(width), h(height), channels(channel_count), quantize_amount(amount)
+{
+    if (channels < 1 || channels > 4)
+        throw std::runtime_error("palette images must have 1 to 4 channels");
+
+    if (amount < 2 || amount > 257)
+        throw std::runtime_error("can only quantize into 2 to 257 bins");
+
+    // Same as in Pixels::quantizeTable, where value i becomes
+    // floor(i/step)*step. Since the step is rounded down there may be more
+    // bins than asked for.
+    step = 256/(amount-1);
+    bins = 255/step + 1;
+
+    long long colors = 1;
+
+    for (int i = 0; i < channels; ++i)
+        colors *= bins;
+
+    if (colors > 65536)
+        throw std::runtime_error("too many colors to fit in a palette index");
+
+    indices.assign(static_cast<std::size_t>(w)*h, 0);
+}
+
+std::vector<std::array<PaletteImage::Index, 256>> PaletteImage::indexTables() const
+{
+    std::vector<std::array<Index, 256>> tables(channels);
+    int place = 1;
+
+    for (int i = 0; i < channels; ++i)
+    {
+        for (int value = 0; value < 256; ++value)
+            tables[i][value] = value/step*place;
+
+        place *= bins;
+    }
+
+    return tables;
+}
+
+std::array<unsigned char, 4> PaletteImage::color(Index index) const
+{
+    std::array<unsigned char, 4> c = {};
+
+    for (int i = 0; i < channels; ++i)
+    {
+        c[i] = index%bins*step;
+        index /= bins;
+    }
+
+    return c;
+}
@@ -0,0 +1,70 @@
+/*
+ * A quantized image stored as one small number per pixel, the index of its
+ * color, rather than all of the channels
+ *
+ *   const PaletteImage indices = img.blurQuantizeIndices(2, 10);
+ *   const Blobs blobs(indices, LabelingMethod::Strips);
+ *   const Pixels<3> quantized(indices); // Same as img.blurQuantize(2, 10)
+ *
+ * Quantizing into amount bins leaves each channel with only that many values,
+ * so there are at most amount^channels colors, e.g. 1000 for RGB quantized
+ * into 10 bins. As long as there are no more than 65536 the index fits in 16
+ * bits, two bytes a pixel instead of three or four, and two pixels are the
+ * same color exactly when their indices are the same.
+ */
+
+#ifndef H_PALETTE
+#define H_PALETTE
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "bufferpool.h"
+
+class PaletteImage
+{
+public:
+    typedef std::uint16_t Index;
+
+private:
+    int w = 0;
+    int h = 0;
+    int channels = 0;
+    int quantize_amount = 0;
+
+    // Each channel value is in one of bins bins, each step values wide, and
+    // the index is the bin of the first channel plus bins times the second,
+    // and so on
+    int bins = 0;
+    int step = 0;
+
+    PoolVector<Index> indices; // Row by row, w*h of them
+
+public:
+    PaletteImage() { }
+
+    // All index 0, for quantizing channels into amount bins the same way as
+    // Pixels::quantize(amount)
+    PaletteImage(int w, int h, int channels, int amount);
+
+    int width() const { return w; }
+    int height() const { return h; }
+    int channelCount() const { return channels; }
+    int amount() const { return quantize_amount; }
+    bool empty() const { return indices.empty(); }
+
+    Index* row(int y) { return indices.data() + static_cast<std::size_t>(y)*w; }
+    const Index* row(int y) const { return indices.data() + static_cast<std::size_t>(y)*w; }
+
+    // What each channel value adds to the index, so a pixel's index is the
+    // sum of these for each of its channels
+    std::vector<std::array<Index, 256>> indexTables() const;
+
+    // The quantized color of an index, with the channels past the last left
+    // zero
+    std::array<unsigned char, 4> color(Index index) const;
+};
+
+#endif
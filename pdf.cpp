@@ -0,0 +1,536 @@
+#include <array>
+#include <cstdlib>
+#include <algorithm>
+#include <stdexcept>
+#include <podofo/podofo.h>
+
+#include "pdf.h"
+
+using namespace PoDoFo;
+
+// The message for a PoDoFo error
+static std::string errorMessage(const PdfError& e)
+{
+    const char* message = PdfError::ErrorMessage(e.GetError());
+
+    if (message)
+        return message;
+    else
+        return "unknown PDF error";
+}
+
+// Copy out a stream, either as it's stored or decoded
+static std::vector<char> streamData(const PdfObject* obj, bool decode)
+{
+    char* buffer = nullptr;
+    pdf_long length = 0;
+
+    if (decode)
+        obj->GetStream()->GetFilteredCopy(&buffer, &length);
+    else
+        obj->GetStream()->GetCopy(&buffer, &length);
+
+    std::vector<char> data(buffer, buffer + length);
+    std::free(buffer);
+
+    return data;
+}
+
+// Either a single name or an array of names
+static std::vector<std::string> names(const PdfObject* obj)
+{
+    std::vector<std::string> result;
+
+    if (!obj)
+        return result;
+
+    if (obj->IsName())
+    {
+        result.push_back(obj->GetName().GetName());
+    }
+    else if (obj->IsArray())
+    {
+        for (const PdfObject& item : obj->GetArray())
+            if (item.IsName())
+                result.push_back(item.GetName().GetName());
+    }
+
+    return result;
+}
+
+// Either an integer or a real
+static double number(const PdfObject& obj)
+{
+    if (obj.IsReal())
+        return obj.GetReal();
+    else if (obj.IsNumber())
+        return obj.GetNumber();
+    else
+        return 0;
+}
+
+// Convert one pixel to RGB from gray, RGB, or CMYK
+static void toRGB(const unsigned char* in, int components, char* out)
+{
+    if (components == 1)
+    {
+        out[0] = out[1] = out[2] = in[0];
+    }
+    else if (components == 3)
+    {
+        out[0] = in[0];
+        out[1] = in[1];
+        out[2] = in[2];
+    }
+    else
+    {
+        const int k = 255 - in[3];
+        out[0] = (255 - in[0])*k/255;
+        out[1] = (255 - in[1])*k/255;
+        out[2] = (255 - in[2])*k/255;
+    }
+}
+
+PDFImages::PDFImages(const std::string& filename)
+    : filename(filename), doc(new PdfMemDocument)
+{
+    // Otherwise it prints to stderr itself
+    PdfError::EnableDebug(false);
+    PdfError::EnableLogging(false);
+
+    try
+    {
+        doc->Load(filename.c_str());
+    }
+    catch (const PdfError& e)
+    {
+        throw std::runtime_error("couldn't open PDF \"" + filename + "\": " + errorMessage(e));
+    }
+}
+
+// Here where PdfMemDocument isn't incomplete
+PDFImages::~PDFImages()
+{
+}
+
+int PDFImages::pages() const
+{
+    return doc->GetPageCount();
+}
+
+bool PDFImages::next(PDFImage& image)
+{
+    try
+    {
+        while (images.empty())
+        {
+            if (page >= pages())
+                return false;
+
+            loadPage();
+        }
+    }
+    catch (const PdfError& e)
+    {
+        throw std::runtime_error("couldn't read page " + std::to_string(page) +
+                " of \"" + filename + "\": " + errorMessage(e));
+    }
+
+    PdfObject* obj = images.back();
+    images.pop_back();
+
+    image = PDFImage();
+    image.page = page;
+
+    try
+    {
+        extract(obj, image);
+    }
+    catch (const PdfError& e)
+    {
+        image.data = std::vector<char>();
+        image.error = errorMessage(e);
+    }
+    catch (const std::bad_alloc&)
+    {
+        image.data = std::vector<char>();
+        image.error = "image is too big";
+    }
+
+    // Done with it, so let PoDoFo reload it if it's ever needed again rather
+    // than keeping every image of the document in memory
+    PdfParserObject* parsed = dynamic_cast<PdfParserObject*>(obj);
+
+    if (parsed)
+        parsed->FreeObjectMemory();
+
+    return true;
+}
+
+void PDFImages::loadPage()
+{
+    PdfPage* current = doc->GetPage(page++);
+    PdfObject* resources = current ? current->GetResources() : nullptr;
+    PdfObject* xobjects = resources ? resolve(resources->GetIndirectKey(PdfName("XObject"))) : nullptr;
+
+    if (!xobjects || !xobjects->IsDictionary())
+        return;
+
+    for (const TKeyMap::value_type& key : xobjects->GetDictionary().GetKeys())
+    {
+        PdfObject* obj = resolve(key.second);
+
+        if (!obj || !obj->IsDictionary() || !obj->HasStream())
+            continue;
+
+        const PdfObject* subtype = obj->GetDictionary().GetKey(PdfName::KeySubtype);
+
+        if (subtype && subtype->IsName() && subtype->GetName() == PdfName("Image"))
+            images.push_back(obj);
+    }
+
+    // Taken off the back
+    std::reverse(images.begin(), images.end());
+}
+
+PdfObject* PDFImages::resolve(PdfObject* obj) const
+{
+    if (obj && obj->IsReference())
+        return doc->GetObjects().GetObject(obj->GetReference());
+
+    return obj;
+}
+
+const PdfObject* PDFImages::resolve(const PdfObject* obj) const
+{
+    if (obj && obj->IsReference())
+        return doc->GetObjects().GetObject(obj->GetReference());
+
+    return obj;
+}
+
+void PDFImages::extract(PdfObject* obj, PDFImage& image) const
+{
+    const std::vector<std::string> filters = names(obj->GetIndirectKey(PdfName::KeyFilter));
+    const std::string last = filters.empty() ? "" : filters.back();
+
+    if (last == "DCTDecode" || last == "JPXDecode" || last == "CCITTFaxDecode" ||
+        last == "JBIG2Decode")
+    {
+        if (filters.size() > 1)
+        {
+            image.error = "images with more than one filter aren't supported";
+            return;
+        }
+
+        if (last == "DCTDecode")
+        {
+            image.type = IL_JPG;
+            image.data = streamData(obj, false);
+        }
+        else if (last == "JPXDecode")
+        {
+            image.type = IL_JP2;
+            image.data = streamData(obj, false);
+        }
+        else if (last == "CCITTFaxDecode")
+        {
+            extractCCITT(obj, image);
+        }
+        else
+        {
+            image.error = "JBIG2 images aren't supported";
+        }
+    }
+    else
+    {
+        extractRaw(obj, image);
+    }
+}
+
+void PDFImages::extractRaw(PdfObject* obj, PDFImage& image) const
+{
+    const PdfDictionary& dict = obj->GetDictionary();
+    const int w = dict.GetKeyAsLong(PdfName("Width"), 0);
+    const int h = dict.GetKeyAsLong(PdfName("Height"), 0);
+    const bool mask = dict.GetKeyAsBool(PdfName("ImageMask"), false);
+    const int bits = mask ? 1 : dict.GetKeyAsLong(PdfName("BitsPerComponent"), 8);
+
+    if (w <= 0 || h <= 0)
+    {
+        image.error = "image has no size";
+        return;
+    }
+
+    if (bits != 1 && bits != 2 && bits != 4 && bits != 8 && bits != 16)
+    {
+        image.error = "unsupported bits per component";
+        return;
+    }
+
+    // Components of each sample and, if there's a palette, of each color in
+    // it. Stencil masks are like one bit gray images, painting black where
+    // the value is zero.
+    int components = 0;
+    int palette_components = 0;
+    std::vector<unsigned char> palette;
+
+    const PdfObject* space = resolve(obj->GetIndirectKey(PdfName("ColorSpace")));
+    const std::vector<std::string> space_names = names(space);
+    std::string name = mask ? "DeviceGray" : (space_names.empty() ? "" : space_names.front());
+
+    if (name == "Indexed" && space->IsArray() && space->GetArray().size() == 4)
+    {
+        const PdfArray& indexed = space->GetArray();
+        const std::vector<std::string> base_names = names(resolve(&indexed[1]));
+
+        if (!base_names.empty())
+        {
+            const std::string& base_name = base_names.front();
+
+            if (base_name == "DeviceGray" || base_name == "CalGray")
+                palette_components = 1;
+            else if (base_name == "DeviceRGB" || base_name == "CalRGB")
+                palette_components = 3;
+            else if (base_name == "DeviceCMYK")
+                palette_components = 4;
+        }
+
+        const PdfObject* table = resolve(&indexed[3]);
+
+        if (table && table->IsString())
+        {
+            const PdfString& s = table->GetString();
+            palette.assign(s.GetString(), s.GetString() + s.GetLength());
+        }
+        else if (table && table->HasStream())
+        {
+            const std::vector<char> data = streamData(table, true);
+            palette.assign(data.begin(), data.end());
+        }
+
+        // Only whole colors, so that looking one up can't read past the end
+        if (palette_components > 0)
+            palette.resize(palette.size()/palette_components*palette_components);
+
+        if (palette_components == 0 || palette.empty())
+        {
+            image.error = "unsupported palette";
+            return;
+        }
+
+        components = 1;
+    }
+    else if (name == "DeviceGray" || name == "CalGray")
+    {
+        components = 1;
+    }
+    else if (name == "DeviceRGB" || name == "CalRGB")
+    {
+        components = 3;
+    }
+    else if (name == "DeviceCMYK")
+    {
+        components = 4;
+    }
+    else if (name == "ICCBased" && space->GetArray().size() == 2)
+    {
+        const PdfObject* stream = resolve(&space->GetArray()[1]);
+
+        if (stream && stream->IsDictionary())
+            components = stream->GetDictionary().GetKeyAsLong(PdfName("N"), 0);
+
+        if (components != 1 && components != 3 && components != 4)
+            components = 0;
+    }
+
+    if (components == 0)
+    {
+        image.error = "unsupported color space";
+        return;
+    }
+
+    // A decode array of [1 0] flips the values, which is common for black and
+    // white scans. Otherwise assume the default.
+    bool inverted = false;
+    const PdfObject* decode = obj->GetIndirectKey(PdfName("Decode"));
+
+    if (decode && decode->IsArray() && decode->GetArray().size() >= 2)
+        inverted = number(decode->GetArray()[0]) > number(decode->GetArray()[1]);
+
+    const std::vector<char> data = streamData(obj, true);
+    const std::size_t row_bytes = (static_cast<std::size_t>(w)*components*bits + 7)/8;
+
+    if (data.size() < row_bytes*h)
+    {
+        image.error = "image data is too short";
+        return;
+    }
+
+    const int max_value = (bits == 16) ? 255 : (1 << bits) - 1;
+
+    image.type = IL_RAW;
+    image.width = w;
+    image.height = h;
+    image.data.resize(static_cast<std::size_t>(w)*h*3);
+
+    std::array<unsigned char, 4> pixel;
+    std::array<unsigned char, 4> color;
+
+    for (int y = 0; y < h; ++y)
+    {
+        const unsigned char* row = reinterpret_cast<const unsigned char*>(&data[y*row_bytes]);
+        char* out = &image.data[static_cast<std::size_t>(y)*w*3];
+
+        for (int x = 0; x < w; ++x)
+        {
+            for (int i = 0; i < components; ++i)
+            {
+                const std::size_t sample = static_cast<std::size_t>(x)*components + i;
+                int value;
+
+                if (bits == 8)
+                    value = row[sample];
+                else if (bits == 16)
+                    value = row[2*sample];
+                else
+                    value = (row[sample*bits/8] >> (8 - bits - sample*bits%8)) & max_value;
+
+                if (inverted)
+                    value = max_value - value;
+
+                pixel[i] = value;
+            }
+
+            if (!palette.empty())
+            {
+                const std::size_t index = std::min<std::size_t>(pixel[0],
+                        palette.size()/palette_components - 1);
+
+                for (int i = 0; i < palette_components; ++i)
+                    color[i] = palette[index*palette_components + i];
+
+                toRGB(color.data(), palette_components, &out[x*3]);
+            }
+            else
+            {
+                // Spread out over 0 to 255 if fewer than 8 bits
+                if (max_value != 255)
+                    for (int i = 0; i < components; ++i)
+                        pixel[i] = pixel[i]*255/max_value;
+
+                toRGB(pixel.data(), components, &out[x*3]);
+            }
+        }
+    }
+}
+
+void PDFImages::extractCCITT(PdfObject* obj, PDFImage& image) const
+{
+    const PdfDictionary& dict = obj->GetDictionary();
+    long long k = 0;
+    long long columns = 1728;
+    long long rows = dict.GetKeyAsLong(PdfName("Height"), 0);
+    bool black_is_1 = false;
+    bool byte_align = false;
+
+    const PdfObject* parms = resolve(obj->GetIndirectKey(PdfName("DecodeParms")));
+
+    if (parms && parms->IsArray() && parms->GetArray().size() == 1)
+        parms = resolve(&parms->GetArray()[0]);
+
+    if (parms && parms->IsDictionary())
+    {
+        const PdfDictionary& p = parms->GetDictionary();
+        k = p.GetKeyAsLong(PdfName("K"), 0);
+        columns = p.GetKeyAsLong(PdfName("Columns"), 1728);
+        rows = p.GetKeyAsLong(PdfName("Rows"), rows);
+        black_is_1 = p.GetKeyAsBool(PdfName("BlackIs1"), false);
+        byte_align = p.GetKeyAsBool(PdfName("EncodedByteAlign"), false);
+    }
+
+    if (columns <= 0 || rows <= 0)
+    {
+        image.error = "fax image has no size";
+        return;
+    }
+
+    const std::vector<char> data = streamData(obj, false);
+
+    // Negative K is Group 4, otherwise Group 3 where positive K means it's
+    // two dimensional
+    const int compression = (k < 0) ? 4 : 3;
+    const int options = ((k > 0) ? 1 : 0) | (byte_align ? 4 : 0);
+
+    // One strip of the whole image right after the directory
+    struct Entry
+    {
+        int tag;
+        int type; // 3 is a short, 4 is a long
+        unsigned int value;
+    };
+
+    std::vector<Entry> entries = {
+        { 256, 4, static_cast<unsigned int>(columns) },   // ImageWidth
+        { 257, 4, static_cast<unsigned int>(rows) },      // ImageLength
+        { 258, 3, 1 },                                    // BitsPerSample
+        { 259, 3, static_cast<unsigned int>(compression) },
+        { 262, 3, black_is_1 ? 0u : 1u },                 // Photometric
+        { 273, 4, 0 },                                    // StripOffsets
+        { 277, 3, 1 },                                    // SamplesPerPixel
+        { 278, 4, static_cast<unsigned int>(rows) },      // RowsPerStrip
+        { 279, 4, static_cast<unsigned int>(data.size()) } // StripByteCounts
+    };
+
+    if (compression == 3)
+        entries.push_back({ 292, 4, static_cast<unsigned int>(options) }); // T4Options
+
+    const unsigned int header_size = 8 + 2 + 12*entries.size() + 4;
+    entries[5].value = header_size;
+
+    std::vector<char>& out = image.data;
+    out.reserve(header_size + data.size());
+
+    auto put16 = [&out](unsigned int v)
+    {
+        out.push_back(v & 0xff);
+        out.push_back((v >> 8) & 0xff);
+    };
+
+    auto put32 = [&out, &put16](unsigned int v)
+    {
+        put16(v & 0xffff);
+        put16(v >> 16);
+    };
+
+    // Little endian, then where the directory is
+    out.push_back('I');
+    out.push_back('I');
+    put16(42);
+    put32(8);
+
+    put16(entries.size());
+
+    for (const Entry& e : entries)
+    {
+        put16(e.tag);
+        put16(e.type);
+        put32(1);
+
+        if (e.type == 3)
+        {
+            put16(e.value);
+            put16(0);
+        }
+        else
+        {
+            put32(e.value);
+        }
+    }
+
+    // No more directories
+    put32(0);
+
+    out.insert(out.end(), data.begin(), data.end());
+    image.type = IL_TIF;
+}
@@ -0,0 +1,94 @@
+/*
+ * Pull the images out of a PDF without rendering it
+ *
+ *   PDFImages pdf("scans.pdf");
+ *   PDFImage image;
+ *
+ *   while (pdf.next(image))
+ *   {
+ *       if (image.error.empty())
+ *           ... Pixels<3>(image.type, &image.data[0], image.data.size()) ...
+ *   }
+ *
+ * Scanned pages are usually just one big image each, so there's no need to
+ * draw the page. JPEG (DCT) and JPEG 2000 images are passed on as they are
+ * for DevIL to load, CCITT fax images get a TIFF header put in front of them,
+ * and anything else is decoded by PoDoFo (e.g. Flate) and converted to RGB,
+ * in which case the type is IL_RAW.
+ *
+ * Pages are gone through in order, one at a time, and only the objects for
+ * the current image are loaded, so it doesn't matter how big the PDF is.
+ */
+
+#ifndef H_PDF
+#define H_PDF
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <IL/il.h>
+
+namespace PoDoFo
+{
+    class PdfObject;
+    class PdfMemDocument;
+}
+
+struct PDFImage
+{
+    // Page it's on, starting at one
+    int page = 0;
+
+    // IL_JPG, IL_JP2, IL_TIF, or IL_RAW if the data is already RGB
+    ILenum type = IL_TYPE_UNKNOWN;
+    std::vector<char> data;
+
+    // Only set for IL_RAW
+    int width = 0;
+    int height = 0;
+
+    // Why the image couldn't be extracted, if it couldn't
+    std::string error;
+};
+
+class PDFImages
+{
+    std::string filename;
+    std::unique_ptr<PoDoFo::PdfMemDocument> doc;
+
+    // Next page to look at and the images left on the current one
+    int page = 0;
+    std::vector<PoDoFo::PdfObject*> images;
+
+public:
+    // Throws std::runtime_error if it can't be opened
+    explicit PDFImages(const std::string& filename);
+    ~PDFImages();
+
+    int pages() const;
+
+    // Get the next image, returning false if there aren't any more
+    bool next(PDFImage& image);
+
+private:
+    PDFImages(const PDFImages&) = delete;
+    PDFImages& operator=(const PDFImages&) = delete;
+
+    // Find the images on the next page
+    void loadPage();
+
+    // Follow a reference to the object it refers to
+    PoDoFo::PdfObject* resolve(PoDoFo::PdfObject* obj) const;
+    const PoDoFo::PdfObject* resolve(const PoDoFo::PdfObject* obj) const;
+
+    // Get the data out of an image object
+    void extract(PoDoFo::PdfObject* obj, PDFImage& image) const;
+
+    // Decode the image and convert it to 8-bit RGB
+    void extractRaw(PoDoFo::PdfObject* obj, PDFImage& image) const;
+
+    // Put a TIFF header in front of CCITT fax data so DevIL can load it
+    void extractCCITT(PoDoFo::PdfObject* obj, PDFImage& image) const;
+};
+
+#endif
@@ -0,0 +1,634 @@
+#include <mutex>
+#include <iostream>
+#include <algorithm>
+
+#include "line.h"
+#include "math.h"
+#include "crop.h"
+#include "bands.h"
+#include "bandblobs.h"
+#include "pdf.h"
+#include "regions.h"
+#include "pipeline.h"
+#include "tiffreader.h"
+
+std::string getExt(const std::string& filename)
+{
+    std::string ext;
+
+    // Go back through the string till the first dot
+    for (int i = filename.length()-1; i >= 0; --i)
+    {
+        if (filename[i] == '.')
+            break;
+
+        // Insert this letter lowercase at the beginning
+        ext.insert(0, 1, std::tolower(filename[i]));
+    }
+
+    return ext;
+}
+
+void initPipeline()
+{
+    static std::once_flag once;
+    std::call_once(once, []() { ilInit(); });
+}
+
+bool readPage(Page& page)
+{
+    // Map it rather than reading it in, so it's only read once it's decoded
+    try
+    {
+        page.file = MappedFile(page.filename);
+    }
+    catch (const std::runtime_error&)
+    {
+        page.err << "Warning: couldn't read file \"" << page.filename << "\"" << std::endl;
+        return false;
+    }
+
+    // Get extension
+    page.type = ilTypeFromExt(page.filename.c_str());
+
+    if (page.type == IL_TYPE_UNKNOWN)
+    {
+        page.err << "Warning: not supported file type \"" << page.filename << "\"" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+void readPDF(const std::string& filename, unsigned int& seq, unsigned int& uid,
+        PageQueue& out)
+{
+    std::unique_ptr<PDFImages> pdf;
+    int count = 0;
+
+    // Report a problem with the whole file in order with the pages
+    auto fail = [&](const std::string& message)
+    {
+        std::unique_ptr<Page> page(new Page);
+        page->seq = seq++;
+        page->filename = filename;
+        page->failed = true;
+        page->err << "Warning: " << message << std::endl;
+        out.push(std::move(page));
+    };
+
+    try
+    {
+        pdf.reset(new PDFImages(filename));
+
+        PDFImage image;
+
+        while (pdf->next(image))
+        {
+            std::unique_ptr<Page> page(new Page);
+            page->seq = seq++;
+            page->filename = filename;
+
+            if (image.error.empty())
+            {
+                page->uid = uid++;
+                page->type = image.type;
+                page->buffer = std::move(image.data);
+                page->width = image.width;
+                page->height = image.height;
+            }
+            else
+            {
+                page->err << "Warning: couldn't extract image on page " << image.page
+                    << " of \"" << filename << "\": " << image.error << std::endl;
+                page->failed = true;
+            }
+
+            out.push(std::move(page));
+            ++count;
+        }
+    }
+    catch (const std::runtime_error& e)
+    {
+        fail(e.what());
+        return;
+    }
+
+    if (count == 0)
+        fail("no images found in \"" + filename + "\"");
+}
+
+void readTIFF(const std::string& filename, unsigned int& seq, unsigned int& uid,
+        PageQueue& out)
+{
+    int pages = 0;
+    std::string error;
+
+    try
+    {
+        pages = TiffReader::pages(filename);
+    }
+    catch (const std::runtime_error& e)
+    {
+        error = e.what();
+    }
+
+    for (int i = 0; i < pages; ++i)
+    {
+        std::unique_ptr<Page> page(new Page);
+        page->seq = seq++;
+        page->uid = uid++;
+        page->filename = filename;
+        page->tiff_page = i;
+        out.push(std::move(page));
+    }
+
+    if (pages == 0)
+    {
+        std::unique_ptr<Page> page(new Page);
+        page->seq = seq++;
+        page->filename = filename;
+        page->failed = true;
+        page->err << "Warning: " << (error.empty()?"no pages in \"" + filename + "\"":error) << std::endl;
+        out.push(std::move(page));
+    }
+}
+
+void decodePage(Page& page, const StageCache* cache)
+{
+    StageTimer timer(page.stats, "decode");
+
+    // Wherever the file's contents are
+    const char* data = page.data;
+    std::size_t size = page.size;
+
+    if (page.file.data())
+    {
+        data = page.file.data();
+        size = page.file.size();
+    }
+    else if (!page.buffer.empty())
+    {
+        data = &page.buffer[0];
+        size = page.buffer.size();
+    }
+
+    if (cache)
+    {
+        if (data)
+            page.hash = hashBytes(data, size);
+
+        // The same pixels could be different sizes
+        if (page.type == IL_RAW)
+        {
+            const int size[2] = { page.width, page.height };
+            page.hash = hashBytes(reinterpret_cast<const char*>(size), sizeof(size), page.hash);
+        }
+
+        page.cached_decode = cache->load(StageCache::key(page.hash), page.img, page.filename);
+
+        if (page.cached_decode)
+            page.stats.count("decode", "cached", 1);
+    }
+
+    if (!page.cached_decode)
+    {
+        try
+        {
+            if (page.type == IL_RAW)
+            {
+                Pixels<3>::PixelArray pixels(page.width, page.height);
+
+                const std::size_t row_size = static_cast<std::size_t>(page.width)*3;
+
+                for (int y = 0; y < page.height; ++y)
+                {
+                    const char* in = page.buffer.data() + y*row_size;
+                    std::copy(in, in + row_size, pixels.row(y));
+                }
+
+                page.img = Pixels<3>(std::move(pixels), page.filename);
+            }
+            else if (data)
+            {
+                page.img = Pixels<3>(page.type, data, size, page.filename);
+            }
+        }
+        catch (const std::runtime_error&)
+        {
+        }
+    }
+
+    // Don't need them anymore
+    page.file = MappedFile();
+    page.buffer = std::vector<char>();
+    page.data = nullptr;
+    page.size = 0;
+
+    if (!page.img.valid())
+    {
+        page.err << "Warning: invalid image \"" << page.filename << "\"" << std::endl;
+        page.failed = true;
+    }
+}
+
+void preprocessPage(Page& page, int scale, bool debug, const StageCache* cache)
+{
+    //
+    // Options
+    //
+    const int quantizeAmount = 10;
+    const int blurAmount = 2;
+
+    // Recursive rectangular finder
+    //std::vector<Rect> regions = findRegions(page.img);
+
+    bool cached_indices = false;
+
+    if (cache)
+    {
+        // Saved here rather than when decoding, since that's one page at a time
+        if (!page.cached_decode && !cache->save(StageCache::key(page.hash), page.img))
+            page.err << "Warning: couldn't write to the cache" << std::endl;
+
+        page.cache_key = StageCache::key(page.hash, {scale, blurAmount, quantizeAmount});
+
+        {
+            StageTimer timer(page.stats, "blobs");
+            page.cached_blobs = cache->load(page.cache_key, page.blobs);
+        }
+
+        // The indices are only needed to label, or to draw on when debugging
+        if (!page.cached_blobs || debug)
+        {
+            StageTimer timer(page.stats, "blur_quantize");
+            cached_indices = cache->load(page.cache_key, page.indices);
+        }
+
+        if (page.cached_blobs)
+            page.stats.count("blobs", "cached", 1);
+        if (cached_indices)
+            page.stats.count("blur_quantize", "cached", 1);
+    }
+
+    if (cached_indices || (page.cached_blobs && !debug))
+    {
+        // The same as if they weren't cached, so it doesn't change the output
+        if (scale > 1)
+            page.out << "Downscale" << std::endl;
+
+        page.out << "Blur and quantize" << std::endl;
+    }
+    else if (scale > 1)
+    {
+        // The photos are easily big enough to find on a smaller image. The
+        // original is kept to find exactly where the edges are afterwards.
+        page.out << "Downscale" << std::endl;
+        Pixels<3> small;
+
+        {
+            StageTimer timer(page.stats, "downscale");
+            small = page.img.downscale(scale);
+        }
+
+        // Averaging when downscaling already blurs, so blur by the same radius
+        // in full image pixels, rounded down, to keep the edges of the blobs
+        // about where they are in the full image. With blurAmount 2 that's a
+        // radius of 1 at -s 2, and no blur at all at -s 3 or more, where the
+        // averaging alone already blurs more than that.
+        page.out << "Blur and quantize" << std::endl;
+        StageTimer timer(page.stats, "blur_quantize");
+
+        if (blurAmount/scale >= 1)
+            page.indices = small.blurQuantizeIndices(blurAmount/scale, quantizeAmount);
+        else
+            page.indices = small.quantizeIndices(quantizeAmount);
+    }
+    else
+    {
+        page.out << "Blur and quantize" << std::endl;
+        StageTimer timer(page.stats, "blur_quantize");
+        page.indices = page.img.blurQuantizeIndices(blurAmount, quantizeAmount);
+    }
+
+    if (cache && !cached_indices && !page.indices.empty() &&
+        !cache->save(page.cache_key, page.indices))
+        page.err << "Warning: couldn't write to the cache" << std::endl;
+
+    if (debug)
+    {
+        page.quantized = Pixels<3>(page.indices, page.img.filename());
+        page.contours = Pixels<3>(page.quantized.ref(), page.quantized.filename());
+    }
+}
+
+void detectPage(Page& page, int scale, bool debug, const StageCache* cache)
+{
+    //
+    // Options
+    //
+    const int min_dist = 100/scale;
+
+    // Anything thinner than this, as if it were a solid rectangle, is too thin
+    // to be a photo even if it's hollow, since then it'd look thicker
+    const double minWidth = min_dist/4.0;
+
+    // How far to look from where each side was found on the smaller image
+    const int refineWindow = 2*scale;
+
+    // Area inside the outline as a fraction of the area of the four corners
+    // fit to it, below which it's probably not a photo
+    const double minQuadFill = 0.9;
+
+    Pixels<3>& quantized = page.quantized;
+    Pixels<3>& contours = page.contours;
+
+    // Detect blobs, and then find the outlines of only the ones that might be
+    // photos. Cached blobs already have those outlines.
+    page.out << "Blobs" << std::endl;
+    StageTimer blobs_timer(page.stats, "blobs");
+
+    if (!page.cached_blobs)
+        page.blobs = Blobs(page.indices, LabelingMethod::Strips, ContourMode::None, &page.arena);
+
+    Blobs& blobs = page.blobs;
+    std::vector<int> candidates;
+
+    for (int label = 1; label <= static_cast<int>(blobs.size()); ++label)
+    {
+        // This may be the height, width, or diagonal
+        const CoordPair pair = blobs.object(label);
+        double dist = distance(pair.first, pair.last);
+
+        // Get rid of most the really big or really small objects, and then
+        // those that are too thin to bother finding the outline of
+        if (dist > min_dist && blobs.shape(label).width < minWidth)
+            page.stats.count("outline", "too_thin", 1);
+        else if (dist > min_dist)
+            candidates.push_back(label);
+    }
+
+    if (!page.cached_blobs)
+    {
+        blobs.traceContours(candidates);
+
+        if (cache && !cache->save(page.cache_key, blobs))
+            page.err << "Warning: couldn't write to the cache" << std::endl;
+    }
+
+    page.stats.count("blobs", "blobs", blobs.size());
+    page.stats.count("blobs", "traced", candidates.size());
+    blobs_timer.stop();
+
+    page.out << "Outline" << std::endl;
+    for (const int label : candidates)
+    {
+        StageTimer outline_timer(page.stats, "outline");
+
+        // The region boundary, i.e. the points on the outline of the
+        // blob
+        const std::vector<Coord> points = blobs.contour(label);
+        page.stats.count("outline", "outlines", 1);
+        page.stats.count("outline", "contour_points", points.size());
+
+        if (debug)
+            for (const Coord& c : points)
+                contours.mark(c, 1);
+
+        // Fit the corners directly rather than searching for lines along
+        // the outline, e.g. with findLinesExtendingDecreasingError(points,
+        // 0.04), and then trying to pick out the sides
+        const Quad quad = findQuad(points);
+        outline_timer.stop();
+
+        if (quad.fill < minQuadFill)
+            continue;
+
+        if (debug)
+        {
+            for (const Line& line : quad.sides())
+            {
+                quantized.line(line.p1, line.p2);
+                quantized.mark(line.p1);
+                quantized.mark(line.p2);
+            }
+        }
+
+        StageTimer refine_timer(page.stats, "refine");
+        const Quad photo = (scale > 1)?refineQuad(page.img, quad, scale, refineWindow):quad;
+        refine_timer.stop();
+
+        for (const Line& line : photo.sides())
+            page.out << line.p1 << " " << line.p2 <<  " Len: " << line.length << std::endl;
+
+        StageTimer crop_timer(page.stats, "crop");
+        page.quads.push_back(photo);
+        page.photos.push_back(cropQuad(page.img, photo));
+        page.stats.count("crop", "photos", 1);
+        crop_timer.stop();
+
+        /* Naive line detection
+        const int maxLines = 6; // Max number of lines for a region
+        const int minjump = 500; // Minimum length of straight line
+        const int linejump = 100; // Amount to jump when checking for new straight lines
+        const int checkjump = 5; // Amount to jump between points between the two points
+        const int avgThresh = 10; // Max average distance from line between points
+        const int stddevThresh = 10; // Max standard deviation from line between points
+
+        const int size = points.size();
+
+        // The lines for this region
+        std::vector<Line> lines;
+
+        // Find the long straight portions of the region boundary
+        for (int i = 0; i < size-minjump; i+=linejump)
+        {
+            // Start out with the longest line possible
+            for (int j = size-1; j > i+minjump; j-=linejump)
+            {
+                double length = distance(points[i], points[j]);
+
+                // Skip if the two points are too close together
+                if (length < minjump)
+                    continue;
+
+                // Look at how close the points between points i and j
+                // on this contour fall to the line between i and j
+                std::vector<double> dist;
+
+                for (int k = i+1; k < j; k+=checkjump)
+                    dist.push_back(distance(points[i], points[j], points[k]));
+
+                double avg = average(dist);
+                double stddev = stdev(dist);
+
+                // If low average distance and standard deviation, then
+                // this is approximately straight
+                if (avg < avgThresh && stddev < stddevThresh)
+                {
+                    lines.push_back(Line(points[i], points[j], length));
+
+                    // Jump extra if we detect a line
+                    i += std::max(minjump-linejump, 0);
+
+                    // Exit this inner loop since we found the longest
+                    // line with the first point
+                    break;
+                }
+            }
+        }
+
+        // Sort by length, longest first, so we only process the first
+        // few longest lines
+        std::sort(lines.begin(), lines.end(), std::greater<Line>());
+
+        for (int i = 0; i < maxLines && i < lines.size(); ++i)
+        {
+            quantized.mark(findMidpoint(lines[i].p1, lines[i].p2));
+            quantized.line(lines[i].p1, lines[i].p2);
+        }*/
+    }
+
+    // Only kept around for refining and cropping, and quantized for saving
+    // with the marks. The empty blobs aren't in the arena, since that's
+    // cleared once this returns.
+    page.img = Pixels<3>();
+    page.indices = PaletteImage();
+    page.blobs = Blobs();
+}
+
+void detectBands(Page& page, int rows)
+{
+    //
+    // Options
+    //
+    const int quantizeAmount = 10;
+    const int blurAmount = 2;
+    const int min_dist = 100;
+    const double minQuadFill = 0.9;
+
+    // The first point of each photo, to put them in the same order as Blobs
+    std::vector<std::pair<Coord, Quad>> photos;
+
+    try
+    {
+        TiffReader tiff(page.filename, page.tiff_page);
+        const int w = tiff.width();
+
+        BandBlobs blobs([&](const BandObject& obj)
+        {
+            if (distance(obj.first, obj.last) <= min_dist)
+                return;
+
+            // The outline only follows the sides of the rows, so it misses
+            // where the object is cut into from above or below
+            Quad quad = findQuad(obj.outline());
+
+            if (quad.area > 0)
+                quad.fill = std::min(quad.fill, obj.area()/quad.area);
+
+            page.stats.count("bands", "outlines", 1);
+
+            if (quad.fill >= minQuadFill)
+                photos.push_back(std::make_pair(obj.first, quad));
+        });
+
+        page.out << "Blur, quantize, and blobs" << std::endl;
+        StageTimer timer(page.stats, "bands");
+        blurQuantizeBands<3>(w, tiff.height(), blurAmount, quantizeAmount, rows,
+            [&](unsigned char* out, std::ptrdiff_t stride, int count)
+            {
+                tiff.read(out, stride, count);
+            },
+            [&](int, const unsigned char* row)
+            {
+                blobs.add<3>(row, w);
+            });
+        blobs.finish();
+    }
+    catch (const std::runtime_error& e)
+    {
+        page.err << "Warning: " << e.what() << std::endl;
+        page.failed = true;
+        return;
+    }
+
+    std::sort(photos.begin(), photos.end(),
+        [](const std::pair<Coord, Quad>& a, const std::pair<Coord, Quad>& b)
+        {
+            return a.first.y < b.first.y || (a.first.y == b.first.y && a.first.x < b.first.x);
+        });
+
+    page.stats.count("bands", "photos", photos.size());
+
+    page.out << "Outline" << std::endl;
+    for (const std::pair<Coord, Quad>& photo : photos)
+        for (const Line& line : photo.second.sides())
+            page.out << line.p1 << " " << line.p2 <<  " Len: " << line.length << std::endl;
+}
+
+void encodePage(Page& page, bool debug, int compression)
+{
+    // Streamed pages never have a whole image to save
+    if (page.tiff_page >= 0)
+        return;
+
+    StageTimer timer(page.stats, "encode");
+
+    // One that can't be written shouldn't stop the rest, e.g. with --serve
+    try
+    {
+        if (debug)
+        {
+            std::ostringstream s;
+            s << "image" << page.uid << ".png";
+            std::ostringstream s_contours;
+            s_contours << "image" << page.uid << "_contours.png";
+
+            page.out << "Saving " << s.str() << std::endl;
+            page.quantized.save(s.str(), true, true, OutputColor::Color, compression);
+            page.out << "Saving " << s_contours.str() << std::endl;
+            page.contours.save(s_contours.str(), true, true, OutputColor::Color, compression);
+        }
+
+        /*
+        // TODO: remove
+        std::ostringstream s_blurred;
+        s_blurred << "image" << page.uid << "_blurred.png";
+        std::ostringstream s_quantized;
+        s_quantized << "image" << page.uid << "_quantized.png";
+        */
+
+        // Save the photos at the same time. PNGs and JPEGs don't go through
+        // DevIL, so they're compressed at the same time too, and only other
+        // types are written one at a time.
+        TaskGroup group;
+
+        for (std::vector<Pixels<3>>::size_type i = 0; i < page.photos.size(); ++i)
+        {
+            std::ostringstream s_photo;
+            s_photo << "image" << page.uid << "_" << i << ".png";
+            const std::string filename = s_photo.str();
+
+            page.out << "Saving " << filename << std::endl;
+            group.run([&page, i, filename, compression]()
+            {
+                page.photos[i].write(filename, compression);
+            });
+        }
+
+        group.wait();
+    }
+    catch (const std::runtime_error& e)
+    {
+        page.err << "Warning: saving \"" << page.filename << "\": " << e.what() << std::endl;
+        page.failed = true;
+    }
+
+    /*
+    page.out << "Saving " << s_blurred.str() << std::endl;
+    page.img.blur(blurAmount).save(s_blurred.str(), false, false, OutputColor::Color);
+    page.out << "Saving " << s_quantized.str() << std::endl;
+    page.quantized.save(s_quantized.str(), false, false, OutputColor::Color);
+    */
+}
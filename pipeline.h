@@ -0,0 +1,194 @@
+/*
+ * The stages each page goes through, from reading the file to saving the
+ * photos found on it
+ *
+ *   std::unique_ptr<Page> page(new Page);
+ *   page->filename = "scan.jpg";
+ *
+ *   if (readPage(*page))
+ *   {
+ *       decodePage(*page, nullptr);
+ *       preprocessPage(*page, scale, debug, nullptr);
+ *       detectPage(*page, scale, debug, nullptr);
+ *       encodePage(*page, debug, DEFAULT_COMPRESSION);
+ *   }
+ *
+ * fotoloc runs each stage on its own threads with queues of pages between
+ * them (see startStage), while extractPhotos runs them one after the other.
+ * What each stage would print is kept in the page so that it can be printed
+ * in order once the page is done.
+ */
+
+#ifndef H_PIPELINE
+#define H_PIPELINE
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <sstream>
+
+#include <IL/il.h>
+
+#include "quad.h"
+#include "blobs.h"
+#include "arena.h"
+#include "cache.h"
+#include "encode.h"
+#include "stats.h"
+#include "pixels.h"
+#include "palette.h"
+#include "mappedfile.h"
+#include "blockingqueue.h"
+
+// Get the lowercase extension from filename (the last bit after the .), e.g.
+//  a.b.c.JPG would yield 'jpg'
+std::string getExt(const std::string& filename);
+
+// Everything about one input file as it goes through the stages
+struct Page
+{
+    // Order the file was given in, and the number for the output images,
+    // which only counts files that could be read
+    unsigned int seq = 0;
+    unsigned int uid = 0;
+
+    std::string filename;
+    ILenum type = IL_TYPE_UNKNOWN;
+
+    // The file as it is on disk, or for images from a PDF, a copy of the
+    // image data since it's not stored by itself anywhere
+    MappedFile file;
+    std::vector<char> buffer;
+
+    // Or for extractPhotos, the file in memory the caller still owns, which
+    // is only read until it's decoded
+    const char* data = nullptr;
+    std::size_t size = 0;
+
+    // Size of the image if it's IL_RAW, in which case the buffer is already
+    // RGB, e.g. from a PDF
+    int width = 0;
+    int height = 0;
+
+    // Which page of a TIFF this is if it's read a band of rows at a time while
+    // detecting, rather than loaded all at once
+    int tiff_page = -1;
+
+    // Set once a stage gives up on this page, but it still goes through the
+    // rest so that the output stays in order
+    bool failed = false;
+
+    Pixels<3> img;
+
+    // The index of each pixel's color after blurring and quantizing, which is
+    // what the blobs are found in
+    PaletteImage indices;
+
+    // Their colors, only when debugging to draw on and save
+    Pixels<3> quantized;
+
+    // For the many small things made while detecting, freed all at once
+    Arena arena;
+
+    // Found while detecting, or read from the cache before that
+    Blobs blobs{&arena};
+
+    // With --cache, the hash of the file, the key for what's made from it
+    // with the options used, and which stages were read from the cache
+    // rather than done
+    std::uint64_t hash = 0;
+    std::string cache_key;
+    bool cached_decode = false;
+    bool cached_blobs = false;
+
+    // A copy of quantized to draw the outlines on, only when debugging
+    Pixels<3> contours;
+
+    // Each photo found, cut out of img and straightened, and where its
+    // corners were in img
+    std::vector<Pixels<3>> photos;
+    std::vector<Quad> quads;
+
+    // What would have been printed, printed in order once the page is done
+    std::ostringstream out;
+    std::ostringstream err;
+
+    // How long each stage took, written out with --stats
+    Stats stats;
+};
+
+typedef BlockingQueue<std::unique_ptr<Page>> PageQueue;
+
+// Call before anything else. Calling it again does nothing.
+void initPipeline();
+
+// Read the file and figure out what type it is, returning false if it's not
+// going to be processed
+bool readPage(Page& page);
+
+// Send each image in the PDF on as its own page. They're extracted one at a
+// time as there's room in the queue, so only a few are in memory at once.
+void readPDF(const std::string& filename, unsigned int& seq, unsigned int& uid,
+        PageQueue& out);
+
+// Send each page of the TIFF on as its own page, to be read a band at a time
+// once it's detected
+void readTIFF(const std::string& filename, unsigned int& seq, unsigned int& uid,
+        PageQueue& out);
+
+// Load the image, which only one thread at a time can do with DevIL, unless
+// it's already in the cache
+void decodePage(Page& page, const StageCache* cache);
+
+// Blur and quantize, at 1/scale the size if scale is more than one. With a
+// cache, this instead starts from the deepest stage that's in it, which may
+// be the blobs themselves.
+void preprocessPage(Page& page, int scale, bool debug, const StageCache* cache);
+
+// Find the blobs, their outlines, and the corners of those that are photos.
+// If the page was preprocessed at 1/scale the size, the corners are then found
+// in the full image. The outlines and corners are only drawn when debugging.
+void detectPage(Page& page, int scale, bool debug, const StageCache* cache);
+
+// Find the photos on a page of a TIFF while reading it a band of rows at a
+// time, so only about that many rows are ever in memory. Since there's never a
+// whole image to draw on, the corners are printed but nothing is saved.
+void detectBands(Page& page, int rows);
+
+// Save the photos, and when debugging, the page with what was found drawn on,
+// with PNGs compressed at that zlib level
+void encodePage(Page& page, bool debug, int compression);
+
+// Start threads that take pages from in, call f on the ones that haven't
+// failed, and pass them all on to out. out is closed once all of them are
+// done.
+template<class Function>
+void startStage(std::vector<std::thread>& threads, int count,
+        PageQueue& in, PageQueue& out, Function f)
+{
+    std::shared_ptr<std::atomic<int>> running(new std::atomic<int>(count));
+
+    for (int i = 0; i < count; ++i)
+    {
+        threads.push_back(std::thread([&in, &out, f, running]()
+        {
+            std::unique_ptr<Page> page;
+
+            while (in.pop(page))
+            {
+                if (!page->failed)
+                    f(*page);
+
+                out.push(std::move(page));
+            }
+
+            if (--*running == 0)
+                out.close();
+        }));
+    }
+}
+
+#endif
@@ -0,0 +1,419 @@
+/*
+ * Contiguous storage for the pixels of an image
+ *
+ * All rows live in one allocation. Each row starts on an aligned boundary, so
+ * the distance between rows (the stride) may be a bit more than the width.
+ * Pixels are normally interleaved (RGBRGB...), but the channels may instead be
+ * stored as separate planes (RR...GG...BB...) for filters that work on one
+ * channel at a time.
+ *
+ *   PixelBuffer<3> buf(w, h);
+ *   PixelBuffer<3>::Pixel* row = buf[y]; // Interleaved only
+ *   row[x][0] = 255;
+ *
+ *   PixelView<3> part = buf.view(Rect(Coord(10,10), Coord(20,20)));
+ *   part[0][0] == buf[10][10];
+ *
+ *   PixelBuffer<3> planar = buf.converted(PixelLayout::Planar);
+ *   unsigned char* red = planar.plane(0, y);
+ */
+
+#ifndef H_PIXELBUFFER
+#define H_PIXELBUFFER
+
+#include <array>
+#include <memory>
+#include <utility>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include "rect.h"
+#include "bufferpool.h"
+
+// Rows (and planes) start on a multiple of this many bytes. This is a cache
+// line and is enough for any SIMD loads we'd want to do.
+static const int PIXEL_ALIGNMENT = 64;
+
+enum class PixelLayout
+{
+    Interleaved,
+    Planar
+};
+
+template<int N>
+class PixelBuffer;
+
+// A read-only window into an interleaved buffer, e.g. the part of an image
+// inside a rectangle. This doesn't own or copy any of the pixels, so it is
+// only valid as long as the buffer it came from.
+template<int N>
+class PixelView
+{
+public:
+    typedef std::array<unsigned char, N> Pixel;
+
+private:
+    const unsigned char* base = nullptr;
+    std::ptrdiff_t row_stride = 0;
+    int w = 0;
+    int h = 0;
+
+public:
+    PixelView() { }
+    PixelView(const unsigned char* base, std::ptrdiff_t stride, int w, int h)
+        : base(base), row_stride(stride), w(w), h(h) { }
+
+    // Allow passing a buffer wherever a view is expected
+    PixelView(const PixelBuffer<N>& buf);
+
+    int width()  const { return w; }
+    int height() const { return h; }
+    bool empty() const { return w == 0 || h == 0; }
+
+    const Pixel* operator[](int y) const
+    {
+        return reinterpret_cast<const Pixel*>(base + y*row_stride);
+    }
+};
+
+template<int N>
+class PixelBuffer
+{
+    static_assert(N == 1 || N == 3 || N == 4, "Must have 1, 3, or 4 channels");
+
+public:
+    typedef std::array<unsigned char, N> Pixel;
+
+    // We hand out rows of bytes as arrays of pixels
+    static_assert(sizeof(Pixel) == N, "std::array must not be padded");
+
+private:
+    std::unique_ptr<unsigned char, BufferDeleter> storage;
+    unsigned char* base = nullptr; // First aligned byte of storage
+    std::size_t plane_size = 0;    // Bytes in each plane if planar
+    int row_stride = 0;            // Bytes from one row to the next
+    int w = 0;
+    int h = 0;
+    PixelLayout pixel_layout = PixelLayout::Interleaved;
+
+public:
+    PixelBuffer() { }
+    PixelBuffer(int w, int h, PixelLayout layout = PixelLayout::Interleaved);
+    PixelBuffer(int w, int h, const Pixel& fill,
+            PixelLayout layout = PixelLayout::Interleaved);
+
+    PixelBuffer(const PixelBuffer<N>& other);
+    PixelBuffer(PixelBuffer<N>&& other);
+    PixelBuffer<N>& operator=(const PixelBuffer<N>& other);
+    PixelBuffer<N>& operator=(PixelBuffer<N>&& other);
+
+    int width()  const { return w; }
+    int height() const { return h; }
+    int stride() const { return row_stride; }
+    bool empty() const { return w == 0 || h == 0; }
+    PixelLayout layout() const { return pixel_layout; }
+
+    // Row y of an interleaved buffer
+    Pixel* operator[](int y)
+    {
+        return reinterpret_cast<Pixel*>(base + static_cast<std::size_t>(y)*row_stride);
+    }
+
+    const Pixel* operator[](int y) const
+    {
+        return reinterpret_cast<const Pixel*>(base + static_cast<std::size_t>(y)*row_stride);
+    }
+
+    // Raw bytes of row y, either the whole interleaved row or row y of the
+    // channel plane if planar
+    unsigned char* row(int y, int channel = 0)
+    {
+        return base + channel*plane_size + static_cast<std::size_t>(y)*row_stride;
+    }
+
+    const unsigned char* row(int y, int channel = 0) const
+    {
+        return base + channel*plane_size + static_cast<std::size_t>(y)*row_stride;
+    }
+
+    // Row y of one channel of a planar buffer
+    unsigned char* plane(int channel, int y) { return row(y, channel); }
+    const unsigned char* plane(int channel, int y) const { return row(y, channel); }
+
+    // Access that works with either layout, slower than going through rows
+    inline unsigned char& sample(int x, int y, int channel);
+    inline unsigned char sample(int x, int y, int channel) const;
+    inline Pixel get(int x, int y) const;
+    inline void set(int x, int y, const Pixel& value);
+
+    // Set every pixel to this value
+    void fill(const Pixel& value);
+
+    // A copy of the image stored with the other layout
+    PixelBuffer<N> converted(PixelLayout layout) const;
+
+    // Look at the whole image or part of it without copying. The rectangle
+    // is half open like the loops in Histogram, i.e. br isn't included.
+    PixelView<N> view() const;
+    PixelView<N> view(const Rect& rect) const;
+
+private:
+    void allocate(int w, int h, PixelLayout layout);
+};
+
+/*
+ * Implementation
+ */
+
+template<int N>
+PixelView<N>::PixelView(const PixelBuffer<N>& buf)
+{
+    *this = buf.view();
+}
+
+template<int N>
+PixelBuffer<N>::PixelBuffer(int w, int h, PixelLayout layout)
+{
+    allocate(w, h, layout);
+}
+
+template<int N>
+PixelBuffer<N>::PixelBuffer(int w, int h, const Pixel& value, PixelLayout layout)
+{
+    allocate(w, h, layout);
+    fill(value);
+}
+
+template<int N>
+PixelBuffer<N>::PixelBuffer(const PixelBuffer<N>& other)
+{
+    *this = other;
+}
+
+template<int N>
+PixelBuffer<N>::PixelBuffer(PixelBuffer<N>&& other)
+{
+    *this = std::move(other);
+}
+
+template<int N>
+PixelBuffer<N>& PixelBuffer<N>::operator=(const PixelBuffer<N>& other)
+{
+    if (this != &other)
+    {
+        allocate(other.w, other.h, other.pixel_layout);
+
+        const int planes = (pixel_layout == PixelLayout::Planar)?N:1;
+
+        if (base != nullptr)
+            std::memcpy(base, other.base, planes*plane_size);
+    }
+
+    return *this;
+}
+
+template<int N>
+PixelBuffer<N>& PixelBuffer<N>::operator=(PixelBuffer<N>&& other)
+{
+    storage = std::move(other.storage);
+    base = other.base;
+    plane_size = other.plane_size;
+    row_stride = other.row_stride;
+    w = other.w;
+    h = other.h;
+    pixel_layout = other.pixel_layout;
+
+    other.base = nullptr;
+    other.plane_size = 0;
+    other.row_stride = 0;
+    other.w = 0;
+    other.h = 0;
+
+    return *this;
+}
+
+template<int N>
+void PixelBuffer<N>::allocate(int new_w, int new_h, PixelLayout layout)
+{
+    if (new_w < 0 || new_h < 0)
+        throw std::runtime_error("image dimensions must not be negative");
+
+    w = new_w;
+    h = new_h;
+    pixel_layout = layout;
+
+    // Padding each row out to the alignment keeps every row aligned
+    const int row_bytes = (layout == PixelLayout::Planar)?w:w*N;
+    row_stride = (row_bytes + PIXEL_ALIGNMENT - 1)/PIXEL_ALIGNMENT*PIXEL_ALIGNMENT;
+    plane_size = static_cast<std::size_t>(row_stride)*h;
+
+    const std::size_t total = plane_size*((layout == PixelLayout::Planar)?N:1);
+
+    if (total == 0)
+    {
+        storage.reset();
+        base = nullptr;
+        return;
+    }
+
+    // Not initialized, every user writes all of the pixels anyway
+    storage.reset(static_cast<unsigned char*>(BufferPool::allocate(total + PIXEL_ALIGNMENT - 1)));
+
+    const std::size_t address = reinterpret_cast<std::size_t>(storage.get());
+    base = storage.get() + (PIXEL_ALIGNMENT - address%PIXEL_ALIGNMENT)%PIXEL_ALIGNMENT;
+}
+
+template<int N>
+inline unsigned char& PixelBuffer<N>::sample(int x, int y, int channel)
+{
+    if (pixel_layout == PixelLayout::Planar)
+        return row(y, channel)[x];
+    else
+        return row(y)[x*N + channel];
+}
+
+template<int N>
+inline unsigned char PixelBuffer<N>::sample(int x, int y, int channel) const
+{
+    if (pixel_layout == PixelLayout::Planar)
+        return row(y, channel)[x];
+    else
+        return row(y)[x*N + channel];
+}
+
+template<int N>
+inline typename PixelBuffer<N>::Pixel PixelBuffer<N>::get(int x, int y) const
+{
+    if (pixel_layout == PixelLayout::Interleaved)
+        return (*this)[y][x];
+
+    Pixel value;
+
+    for (int i = 0; i < N; ++i)
+        value[i] = row(y, i)[x];
+
+    return value;
+}
+
+template<int N>
+inline void PixelBuffer<N>::set(int x, int y, const Pixel& value)
+{
+    if (pixel_layout == PixelLayout::Interleaved)
+    {
+        (*this)[y][x] = value;
+    }
+    else
+    {
+        for (int i = 0; i < N; ++i)
+            row(y, i)[x] = value[i];
+    }
+}
+
+template<int N>
+void PixelBuffer<N>::fill(const Pixel& value)
+{
+    for (int y = 0; y < h; ++y)
+    {
+        if (pixel_layout == PixelLayout::Interleaved)
+        {
+            Pixel* r = (*this)[y];
+
+            for (int x = 0; x < w; ++x)
+                r[x] = value;
+        }
+        else
+        {
+            for (int i = 0; i < N; ++i)
+                std::memset(row(y, i), value[i], w);
+        }
+    }
+}
+
+template<int N>
+PixelBuffer<N> PixelBuffer<N>::converted(PixelLayout layout) const
+{
+    if (layout == pixel_layout)
+        return *this;
+
+    PixelBuffer<N> result(w, h, layout);
+
+    for (int y = 0; y < h; ++y)
+    {
+        for (int i = 0; i < N; ++i)
+        {
+            const unsigned char* src = row(y, (pixel_layout == PixelLayout::Planar)?i:0);
+            unsigned char* dst = result.row(y, (layout == PixelLayout::Planar)?i:0);
+
+            if (layout == PixelLayout::Planar)
+                for (int x = 0; x < w; ++x)
+                    dst[x] = src[x*N + i];
+            else
+                for (int x = 0; x < w; ++x)
+                    dst[x*N + i] = src[x];
+        }
+    }
+
+    return result;
+}
+
+template<int N>
+PixelView<N> PixelBuffer<N>::view() const
+{
+    if (pixel_layout != PixelLayout::Interleaved)
+        throw std::runtime_error("can only view interleaved pixels");
+
+    return PixelView<N>(base, row_stride, w, h);
+}
+
+template<int N>
+PixelView<N> PixelBuffer<N>::view(const Rect& rect) const
+{
+    if (rect == default_rect)
+        return view();
+
+    if (pixel_layout != PixelLayout::Interleaved)
+        throw std::runtime_error("can only view interleaved pixels");
+
+    // Keep the view inside of the image
+    const int minX = std::max(0, std::min(w, rect.tl.x));
+    const int minY = std::max(0, std::min(h, rect.tl.y));
+    const int maxX = std::max(minX, std::min(w, rect.br.x));
+    const int maxY = std::max(minY, std::min(h, rect.br.y));
+
+    return PixelView<N>(row(minY) + minX*N, row_stride, maxX-minX, maxY-minY);
+}
+
+// A pixel's channels in one integer, so pixels can be compared with one ==.
+// This only reads the N bytes of the pixel, never past the end of the row.
+template<int N>
+inline std::uint32_t packPixel(const unsigned char* p)
+{
+    static_assert(N >= 1 && N <= 4, "only up to 4 channels fit");
+
+    if constexpr (N == 4)
+    {
+        std::uint32_t packed;
+        std::memcpy(&packed, p, sizeof(packed));
+        return packed;
+    }
+    else
+    {
+        std::uint32_t packed = 0;
+
+        for (int i = 0; i < N; ++i)
+            packed |= static_cast<std::uint32_t>(p[i]) << (8*i);
+
+        return packed;
+    }
+}
+
+template<int N>
+inline std::uint32_t packPixel(const std::array<unsigned char, N>& p)
+{
+    return packPixel<N>(p.data());
+}
+
+#endif
@@ -20,12 +20,18 @@
 #include "log.h"
 #include "coord.h"
 #include "math.h"
+#include "blur.h"
 #include "utils.h"
+#include "encode.h"
 #include "pixels.h"
+#include "palette.h"
 #include "histogram.h"
+#include "pixelbuffer.h"
 
 // The default gray value
 static const int GRAY_SHADE = 127;
+// The gray value hasn't been determined from the histogram yet
+static const int UNKNOWN_GRAY_SHADE = -1;
 // How big to make the marks
 static const int MARK_SIZE = 5;
 // Color of mark
@@ -57,7 +63,10 @@ class Pixels
 {
     static_assert(N == 1 || N == 3 || N == 4, "Must have 1, 3, or 4 channels");
 
-    typedef std::vector<std::vector<std::array<unsigned char, N>>> PixelArray;
+public:
+    typedef PixelBuffer<N> PixelArray;
+
+private:
 
     std::vector<Mark> marks;
     PixelArray p;
@@ -65,7 +74,12 @@ class Pixels
     int h;
     bool loaded;
     std::string fn;
-    unsigned char gray_shade;
+
+    // Threshold for viewing this as a black and white image. Finding it takes
+    // a pass over the whole image, which most images never need, so it's put
+    // off until something asks for it. Multiple threads may do that at once,
+    // but they'll all come up with the same value.
+    mutable CopyableAtomic<int> gray_shade;
 
     // Lock this so that only one thread can read an image or save()
     // OpenIL/DevIL is not multithreaded
@@ -73,12 +87,14 @@ class Pixels
 
 public:
     Pixels(); // Useful for placeholder
-    Pixels(std::vector<std::vector<std::array<unsigned char, N>>>&& pixels,
-            const std::string& fn = "");
-    Pixels(const std::vector<std::vector<std::array<unsigned char, N>>>& pixels,
-            const std::string& fn = "");
+    Pixels(PixelArray&& pixels, const std::string& fn = "");
+    Pixels(const PixelArray& pixels, const std::string& fn = "");
     Pixels(ILenum type, const char* lump, const int size, const std::string& fn = "");
 
+    // The colors of a quantized image's indices, which needs to have N
+    // channels
+    explicit Pixels(const PaletteImage& indices, const std::string& fn = "");
+
     inline bool valid()  const { return loaded; }
     inline int  width()  const { return w; }
     inline int  height() const { return h; }
@@ -99,8 +115,9 @@ public:
     inline std::array<unsigned char, N> color(const Coord& c,
         const std::array<unsigned char, N>& default_color) const;
 
-    // Get reference to the data so we can extensively process it
-    const std::vector<std::vector<std::array<unsigned char, N>>>& ref() const;
+    // Get reference to the data so we can extensively process it, e.g. with
+    // ref()[y] to get a row or ref().view(rect) to look at part of it
+    const PixelArray& ref() const;
 
     // When saving, we'll display marks optionally
     void mark(const Coord& m, int size = MARK_SIZE);
@@ -109,9 +126,15 @@ public:
     void line(const Coord& p1, const Coord& p2);
 
     // Used for debugging, all processing (converting to black-and-white, adding
-    // the marks, dimming the image) is done on a copy of the image
+    // the marks, dimming the image) is done on a copy of the image. The
+    // compression is only used for PNGs.
     void save(const std::string& filename, const bool show_marks = true,
-              const bool dim = true, const OutputColor color = OutputColor::Color) const;
+              const bool dim = true, const OutputColor color = OutputColor::Color,
+              const int compression = DEFAULT_COMPRESSION) const;
+
+    // Save the image as it is, the same as save(filename, false, false), but
+    // PNGs and JPEGs are encoded straight from the pixels without a copy
+    void write(const std::string& filename, int compression = DEFAULT_COMPRESSION) const;
 
     // Rotate p around origin an amount in radians, sin_rad = sin(rad) and
     // cos_rad = cos(rad). We pass in these values because otherwise we calculate
@@ -126,7 +149,7 @@ public:
     bool isLoaded() const { return loaded; }
 
     // Get the grayscale value
-    unsigned char grayShade() const { return gray_shade; }
+    inline unsigned char grayShade() const;
 
     // A simple quantization rounding each channel value into a certain number
     // of bins
@@ -137,15 +160,23 @@ public:
     // Fast blur
     Pixels<N> blur(const int amount) const;
 
-private:
-    // For blur
-    //
-    // From: http://blog.ivank.net/fastest-gaussian-blur.html
-    std::vector<int> boxesForGauss(int sigma, int n) const;
-    void gaussBlur_4(PixelArray& scl, PixelArray& tcl, int r) const;
-    void boxBlur_4(PixelArray& scl, PixelArray& tcl, int r) const;
-    void boxBlurH_4(const PixelArray& scl, PixelArray& tcl, int r) const;
-    void boxBlurT_4(const PixelArray& scl, PixelArray& tcl, int r) const;
+    // Same as blur(r).quantize(amount), but without ever storing the blurred
+    // image. Rows are quantized as soon as they're blurred.
+    Pixels<N> blurQuantize(const int r, const int amount) const;
+
+    // Average each factor by factor block into one pixel, giving a smaller
+    // image for things that don't need the full resolution. Blocks on the
+    // right and bottom edges may be partial.
+    Pixels<N> downscale(const int factor) const;
+
+    // What each channel value becomes when quantizing into amount bins, for
+    // quantizing rows that aren't in a Pixels
+    static std::array<unsigned char, 256> quantizeTable(const int amount);
+
+    // Same as quantize(amount) and blurQuantize(r, amount), but giving the
+    // index of each pixel's color rather than the color
+    PaletteImage quantizeIndices(const int amount) const;
+    PaletteImage blurQuantizeIndices(const int r, const int amount) const;
 };
 
 // Used so frequently and so small, so make this inline
@@ -160,7 +191,7 @@ inline bool Pixels<N>::black(const Coord& c, const bool default_value) const
         for (int i = 0; i < N; ++i)
             sum += p[c.y][c.x][i];
 
-        return sum/N < gray_shade;
+        return sum/N < grayShade();
     }
 
     return default_value;
@@ -191,9 +222,24 @@ inline std::array<unsigned char, N> Pixels<N>::color(const Coord& c,
     return default_color;
 }
 
+template<int N>
+inline unsigned char Pixels<N>::grayShade() const
+{
+    int shade = gray_shade.load();
+
+    if (shade == UNKNOWN_GRAY_SHADE)
+    {
+        const Histogram<N> hist(p);
+        shade = hist.threshold(GRAY_SHADE);
+        gray_shade.store(shade);
+    }
+
+    return shade;
+}
+
 // Get constant reference
 template<int N>
-const std::vector<std::vector<std::array<unsigned char, N>>>& Pixels<N>::ref() const
+const typename Pixels<N>::PixelArray& Pixels<N>::ref() const
 {
     return p;
 }
@@ -237,66 +283,61 @@ Pixels<N>::Pixels(ILenum type, const char* lump, const int size, const std::stri
             if (w < 0 || h < 0)
                 throw std::runtime_error("use a smaller image, can't store dimensions in int");
 
-            // 3 because IL_RGB
-            const int total = w*h*3;
-            unsigned char* data = new unsigned char[total];
+            // Have DevIL convert it to 8-bit RGB in place, which it skips if it
+            // already is, and then copy the rows straight from its copy of the
+            // image rather than making another one first
+            if (ilConvertImage(IL_RGB, IL_UNSIGNED_BYTE))
+            {
+                const unsigned char* data = ilGetData();
+                const std::size_t row_bytes = static_cast<std::size_t>(w)*3;
 
-            ilCopyPixels(0, 0, 0, w, h, 1, IL_RGB, IL_UNSIGNED_BYTE, data);
+                // DevIL may store it bottom row first
+                const bool flipped = ilGetInteger(IL_IMAGE_ORIGIN) == IL_ORIGIN_LOWER_LEFT;
 
-            // Move data into a nicer format
-            int x = 0;
-            int y = 0;
-            p = std::vector<std::vector<std::array<unsigned char, N>>>(
-                    h, std::vector<std::array<unsigned char, N>>(w));
+                p = PixelArray(w, h);
 
-            // Start at third
-            for (int i = 2; i < total; i+=3)
-            {
-                // Grayscale
-                if (N == 1)
-                {
-                    // Average min and max to get lightness
-                    //  p[y][x] = smartFloor((min(data[i-2], data[i-1], data[i]) +
-                    //                        max(data[i-2], data[i-1], data[i]))/2);
-                    // For average:
-                    //  p[y][x] = smartFloor((1.0*data[i-2]+data[i-1]+data[i])/3);
-                    //
-                    // For luminosity:
-                    //  p[y][x] = smartFloor(0.2126*data[i-2] + 0.7152*data[i-1] + 0.0722*data[i]);
-                    //
-                    // Use the simplest. It doesn't seem to make a difference.
-                    p[y][x][0] = smartFloor((1.0*data[i-2]+data[i-1]+data[i])/3);
-                }
-                // RGB
-                else if (N == 3)
-                {
-                    p[y][x][0] = data[i-2];
-                    p[y][x][1] = data[i-1];
-                    p[y][x][2] = data[i];
-                }
-                // RGBA
-                else if (N == 4)
+                for (int y = 0; y < h; ++y)
                 {
-                    p[y][x][0] = data[i-2];
-                    p[y][x][1] = data[i-1];
-                    p[y][x][2] = data[i];
-                    p[y][x][3] = 255; // TODO: load RGBA images properly
-                }
+                    const unsigned char* in = data + (flipped ? h-1-y : y)*row_bytes;
+                    unsigned char* out = p.row(y);
 
-                // Increase y every time we get to end of row
-                if (x+1 == w)
-                {
-                    x=0;
-                    ++y;
-                }
-                else
-                {
-                    ++x;
+                    // RGB
+                    if constexpr (N == 3)
+                    {
+                        std::copy(in, in + row_bytes, out);
+                    }
+                    // Grayscale
+                    else if constexpr (N == 1)
+                    {
+                        // Average min and max to get lightness
+                        //  smartFloor((min(r, g, b) + max(r, g, b))/2);
+                        // For average:
+                        //  smartFloor((1.0*r+g+b)/3);
+                        //
+                        // For luminosity:
+                        //  smartFloor(0.2126*r + 0.7152*g + 0.0722*b);
+                        //
+                        // Use the simplest. It doesn't seem to make a
+                        // difference. The sum is a whole number, so dividing
+                        // it is the same as smartFloor((1.0*r+g+b)/3).
+                        for (int x = 0; x < w; ++x, in += 3)
+                            out[x] = (in[0] + in[1] + in[2])/3;
+                    }
+                    // RGBA
+                    else
+                    {
+                        for (int x = 0; x < w; ++x, in += 3, out += 4)
+                        {
+                            out[0] = in[0];
+                            out[1] = in[1];
+                            out[2] = in[2];
+                            out[3] = 255; // TODO: load RGBA images properly
+                        }
+                    }
                 }
-            }
 
-            loaded = true;
-            delete[] data;
+                loaded = true;
+            }
         }
         else
         {
@@ -308,42 +349,74 @@ Pixels<N>::Pixels(ILenum type, const char* lump, const int size, const std::stri
     }
 
     // After loading, determine the real gray shade to view this as a black and white
-    // image. We'll be using this constantly, so we might as well do it now.
-    const Histogram<N> h(p);
-    gray_shade = h.threshold(gray_shade);
+    // image, though only once it's used
+    gray_shade.store(UNKNOWN_GRAY_SHADE);
 }
 
-// Initialize all the pixels from a vector, copying the vector
+// Initialize all the pixels from a buffer, copying the buffer
 template<int N>
-Pixels<N>::Pixels(const std::vector<std::vector<std::array<unsigned char, N>>>& pixels,
-            const std::string& fn)
+Pixels<N>::Pixels(const PixelArray& pixels, const std::string& fn)
     :w(0), h(0), loaded(false), fn(fn), gray_shade(GRAY_SHADE)
 {
-    if (pixels.size() > 0 && pixels[0].size() > 0)
+    if (!pixels.empty())
     {
-        w = pixels[0].size();
-        h = pixels.size();
-        p = pixels;
+        w = pixels.width();
+        h = pixels.height();
+        p = pixels.converted(PixelLayout::Interleaved);
         loaded = true;
     }
 }
 
-// Initialize all the pixels from a vector, moving the vector
+// Initialize all the pixels from a buffer, moving the buffer
 template<int N>
-Pixels<N>::Pixels(std::vector<std::vector<std::array<unsigned char, N>>>&& pixels,
-            const std::string& fn)
+Pixels<N>::Pixels(PixelArray&& pixels, const std::string& fn)
     :w(0), h(0), loaded(false), fn(fn), gray_shade(GRAY_SHADE)
 {
-    if (pixels.size() > 0 && pixels[0].size() > 0)
+    if (!pixels.empty())
     {
-        w = pixels[0].size();
-        h = pixels.size();
-        p = std::move(pixels);
+        w = pixels.width();
+        h = pixels.height();
+
+        // Everything else expects interleaved pixels
+        if (pixels.layout() == PixelLayout::Interleaved)
+            p = std::move(pixels);
+        else
+            p = pixels.converted(PixelLayout::Interleaved);
+
         loaded = true;
+        gray_shade.store(UNKNOWN_GRAY_SHADE);
+    }
+}
+
+// Initialize all the pixels from the colors of the indices
+template<int N>
+Pixels<N>::Pixels(const PaletteImage& indices, const std::string& fn)
+    :w(0), h(0), loaded(false), fn(fn), gray_shade(GRAY_SHADE)
+{
+    if (indices.empty())
+        return;
+
+    if (indices.channelCount() != N)
+        throw std::runtime_error("palette image has the wrong number of channels");
+
+    w = indices.width();
+    h = indices.height();
+    p = PixelArray(w, h);
+
+    for (int y = 0; y < h; ++y)
+    {
+        const PaletteImage::Index* in = indices.row(y);
+        unsigned char* out = p.row(y);
 
-        const Histogram<N> h(p);
-        gray_shade = h.threshold(gray_shade);
+        for (int x = 0; x < w; ++x, out += N)
+        {
+            const std::array<unsigned char, 4> c = indices.color(in[x]);
+            std::copy(c.begin(), c.begin() + N, out);
+        }
     }
+
+    loaded = true;
+    gray_shade.store(UNKNOWN_GRAY_SHADE);
 }
 
 // Quantize the image
@@ -358,18 +431,18 @@ Pixels<N> Pixels<N>::quantize(const int amount) const
     if (amount < 2)
         return Pixels();
 
-    std::vector<std::vector<std::array<unsigned char, N>>> pixels(
-            h, std::vector<std::array<unsigned char, N>>(w, make_array<N, unsigned char>(0)));
-
-    // Quantize the image by rounding the pixels into the "amount" number of
-    // bins, using amount-1 to get "amount" instead of amount+1.
-    double divisor = 256/(amount-1);
+    PixelArray pixels(w, h);
+    const std::array<unsigned char, 256> table = quantizeTable(amount);
 
     // Based on each channel value
     for (int y = 0; y < h; ++y)
-        for (int x = 0; x < w; ++x)
-            for (int channel = 0; channel < N; ++channel)
-                pixels[y][x][channel] = std::floor(p[y][x][channel]/divisor)*divisor;
+    {
+        const unsigned char* in = p.row(y);
+        unsigned char* out = pixels.row(y);
+
+        for (int x = 0; x < w*N; ++x)
+            out[x] = table[in[x]];
+    }
 
     /*
     // Based on grayscale average
@@ -395,6 +468,153 @@ Pixels<N> Pixels<N>::quantize(const int amount) const
     return quantized;
 }
 
+template<int N>
+std::array<unsigned char, 256> Pixels<N>::quantizeTable(const int amount)
+{
+    std::array<unsigned char, 256> table;
+
+    // Quantize the image by rounding the pixels into the "amount" number of
+    // bins, using amount-1 to get "amount" instead of amount+1.
+    double divisor = 256/(amount-1);
+
+    for (int i = 0; i < 256; ++i)
+        table[i] = std::floor(i/divisor)*divisor;
+
+    return table;
+}
+
+// Blur and then quantize the image, a tile of rows at a time
+template<int N>
+Pixels<N> Pixels<N>::blurQuantize(const int r, const int amount) const
+{
+    // Same cases where blur() or quantize() wouldn't do anything
+    if (amount < 2)
+        return Pixels();
+
+    if (r < 1 || r > w || r > h)
+    {
+        log("Not blurring, zero blur radius or radius greater than image width or height");
+        return quantize(amount);
+    }
+
+    PixelArray pixels(w, h);
+    const std::array<unsigned char, 256> table = quantizeTable(amount);
+
+    gaussBlurTiled(p, r, [&](int y, const unsigned char* in)
+    {
+        unsigned char* out = pixels.row(y);
+
+        for (int x = 0; x < w*N; ++x)
+            out[x] = table[in[x]];
+    });
+
+    Pixels<N> quantized(std::move(pixels), fn);
+
+    return quantized;
+}
+
+// Each pixel's index is the sum of what each of its channels adds to it
+template<int N>
+void quantizeIndexRow(const unsigned char* in, PaletteImage::Index* out,
+        int w, const std::vector<std::array<PaletteImage::Index, 256>>& tables)
+{
+    for (int x = 0; x < w; ++x, in += N)
+    {
+        int index = 0;
+
+        for (int i = 0; i < N; ++i)
+            index += tables[i][in[i]];
+
+        out[x] = index;
+    }
+}
+
+template<int N>
+PaletteImage Pixels<N>::quantizeIndices(const int amount) const
+{
+    // only works with amount > 2
+    if (amount < 2)
+        return PaletteImage();
+
+    PaletteImage indices(w, h, N, amount);
+    const std::vector<std::array<PaletteImage::Index, 256>> tables = indices.indexTables();
+
+    for (int y = 0; y < h; ++y)
+        quantizeIndexRow<N>(p.row(y), indices.row(y), w, tables);
+
+    return indices;
+}
+
+template<int N>
+PaletteImage Pixels<N>::blurQuantizeIndices(const int r, const int amount) const
+{
+    if (amount < 2)
+        return PaletteImage();
+
+    if (r < 1 || r > w || r > h)
+    {
+        log("Not blurring, zero blur radius or radius greater than image width or height");
+        return quantizeIndices(amount);
+    }
+
+    PaletteImage indices(w, h, N, amount);
+    const std::vector<std::array<PaletteImage::Index, 256>> tables = indices.indexTables();
+
+    gaussBlurTiled(p, r, [&](int y, const unsigned char* in)
+    {
+        quantizeIndexRow<N>(in, indices.row(y), w, tables);
+    });
+
+    return indices;
+}
+
+template<int N>
+Pixels<N> Pixels<N>::downscale(const int factor) const
+{
+    if (factor <= 1)
+        return *this;
+
+    const int sw = (w + factor-1)/factor;
+    const int sh = (h + factor-1)/factor;
+    PixelArray pixels(sw, sh);
+
+    parallelFor(0, sh, 16, [&](int start, int end)
+    {
+        std::vector<unsigned int> sums(sw*N);
+
+        for (int sy = start; sy < end; ++sy)
+        {
+            const int y_start = sy*factor;
+            const int y_end = std::min(h, y_start+factor);
+
+            std::fill(sums.begin(), sums.end(), 0);
+
+            for (int y = y_start; y < y_end; ++y)
+            {
+                const unsigned char* in = p.row(y);
+
+                for (int x = 0; x < w; ++x)
+                    for (int i = 0; i < N; ++i)
+                        sums[(x/factor)*N + i] += in[x*N + i];
+            }
+
+            unsigned char* out = pixels.row(sy);
+
+            for (int sx = 0; sx < sw; ++sx)
+            {
+                const int count = (y_end - y_start)*(std::min(w, (sx+1)*factor) - sx*factor);
+
+                for (int i = 0; i < N; ++i)
+                    out[sx*N + i] = (sums[sx*N + i] + count/2)/count;
+            }
+        }
+    });
+
+    Pixels<N> scaled(std::move(pixels), fn);
+
+    return scaled;
+}
+
 // Blur the image, perfect Gaussian blur
 // See: http://blog.ivank.net/fastest-gaussian-blur.html
 template<int N>
@@ -404,8 +624,7 @@ Pixels<N> Pixels<N>::blurPerfect(const int r) const
     if (r < 1)
         return *this;
 
-    std::vector<std::vector<std::array<unsigned char, N>>> pixels(
-            h, std::vector<std::array<unsigned char, N>>(w, make_array<N, unsigned char>(0)));
+    PixelArray pixels(w, h);
 
     // Significant radius
     int rs = std::ceil(r * 2.57);
@@ -465,141 +684,14 @@ Pixels<N> Pixels<N>::blur(const int r) const
     if (255*w > std::numeric_limits<int>::max() || 255*h > std::numeric_limits<int>::max())
         log("Possible integer overflow while blurring", LogType::Warning);
 
-    PixelArray copy(p);
-    PixelArray output(h, std::vector<std::array<unsigned char, N>>(
-                w, make_array<N, unsigned char>(0)));
+    PixelArray output(w, h);
 
-    gaussBlur_4(copy, output, r);
+    gaussBlur(p, output, r);
     Pixels<N> blurred(std::move(output), fn);
 
     return blurred;
 }
 
-// sigma = standard deviation, n = number of boxes
-template<int N>
-std::vector<int> Pixels<N>::boxesForGauss(int sigma, int n) const
-{
-    // Ideal averaging filter width
-    double wIdeal = std::sqrt((12.0*sigma*sigma/n)+1);
-
-    int wl = std::floor(wIdeal);
-
-    if (wl%2 == 0)
-        wl--;
-
-    int wu = wl+2;
-    double mIdeal = (12.0*sigma*sigma - n*wl*wl - 4*n*wl - 3*n)/(-4*wl - 4);
-    int m = std::round(mIdeal);
-
-    std::vector<int> sizes(n);
-
-    for (int i = 0; i < n; ++i)
-        sizes[i] = (i<m)?wl:wu;
-
-    return sizes;
-}
-
-template<int N>
-void Pixels<N>::gaussBlur_4(PixelArray& scl, PixelArray& tcl, int r) const
-{
-    std::vector<int> boxes = boxesForGauss(r, 3);
-    boxBlur_4(scl, tcl, std::round((1.0*boxes[0]-1)/2));
-    boxBlur_4(tcl, scl, std::round((1.0*boxes[1]-1)/2));
-    boxBlur_4(scl, tcl, std::round((1.0*boxes[2]-1)/2));
-}
-
-template<int N>
-void Pixels<N>::boxBlur_4(PixelArray& scl, PixelArray& tcl, int r) const
-{
-    tcl = scl;
-    boxBlurH_4(tcl, scl, r);
-    boxBlurT_4(scl, tcl, r);
-}
-
-template<int N>
-void Pixels<N>::boxBlurH_4(const PixelArray& scl, PixelArray& tcl, int r) const
-{
-    double iarr = 1.0 / (r+r+1);
-
-    for (int i = 0; i < h; ++i)
-    {
-        for (int channel = 0; channel < N; ++channel)
-        {
-            int ti = 0;
-            int li = 0;
-            int ri = r;
-            unsigned char fv = scl[i][0][channel];
-            unsigned char lv = scl[i][w-1][channel];
-            int val = (r+1)*fv;
-
-            for (int j = 0; j < r; ++j)
-            {
-                val += scl[i][j][channel];
-            }
-
-            for (int j = 0; j <= r && ri < w && ti < w; ++j)
-            {
-                val += scl[i][ri++][channel] - fv;
-                tcl[i][ti++][channel] = std::round(val*iarr);
-            }
-
-            for (int j = r+1; j < w-r && ri < w && li < w && ti < w; ++j)
-            {
-                val += scl[i][ri++][channel] - scl[i][li++][channel];
-                tcl[i][ti++][channel] = std::round(val*iarr);
-            }
-
-            for (int j = w-r; j < w && li < w && ti < w; ++j)
-            {
-                val += lv - scl[i][li++][channel];
-                tcl[i][ti++][channel] = std::round(val*iarr);
-            }
-        }
-    }
-}
-
-template<int N>
-void Pixels<N>::boxBlurT_4(const PixelArray& scl, PixelArray& tcl, int r) const
-{
-    double iarr = 1.0 / (r+r+1);
-
-    for (int i = 0; i < w; ++i)
-    {
-        for (int channel = 0; channel < N; ++channel)
-        {
-            int ti = 0;
-            int li = 0;
-            int ri = r;
-            unsigned char fv = scl[0][i][channel];
-            unsigned char lv = scl[h-1][i][channel];
-            int val = (r+1)*fv;
-
-            for (int j = 0; j < r; ++j)
-            {
-                val += scl[j][i][channel];
-            }
-
-            for (int j = 0; j <= r && ri < h && ti < h; ++j)
-            {
-                val += scl[ri++][i][channel] - fv;
-                tcl[ti++][i][channel] = std::round(val*iarr);
-            }
-
-            for (int j = r+1; j < h-r && ri < h && li < h && ti < h; ++j)
-            {
-                val += scl[ri++][i][channel] - scl[li++][i][channel];
-                tcl[ti++][i][channel] = std::round(val*iarr);
-            }
-
-            for (int j = h-r; j < h && li < h && ti < h; ++j)
-            {
-                val += lv - scl[li++][i][channel];
-                tcl[ti++][i][channel] = std::round(val*iarr);
-            }
-        }
-    }
-}
-
 template<int N>
 void Pixels<N>::mark(const Coord& c, int size)
 {
@@ -626,165 +718,129 @@ void Pixels<N>::line(const Coord& p1, const Coord& p2)
 }
 
 template<int N>
-void Pixels<N>::save(const std::string& filename, bool show_marks, bool dim, OutputColor color) const
+void Pixels<N>::save(const std::string& filename, bool show_marks, bool dim, OutputColor color,
+        int compression) const
 {
+    // Nothing to copy, and no last row to start from below
+    if (w <= 0 || h <= 0)
+        throw std::runtime_error("could not save empty image");
+
     // We'll use the default color unless we're dimming the image. Then we'll use
     // black since the default color might blend in.
     unsigned char mark_color = MARK_COLOR;
 
     // If the image is grayscale and we're trying to output color, change the
     // output to be grayscale
-    if (N == 1 && color == OutputColor::Color)
-        color = OutputColor::Grayscale;
-
-    // Output 3 channels with color, 1 for black and white or grayscale
-    int channels = (color == OutputColor::Color)?3:1;
+    if constexpr (N == 1)
+        if (color == OutputColor::Color)
+            color = OutputColor::Grayscale;
 
-    // Work on a separate copy of this image
-    std::vector<std::vector<std::vector<unsigned char>>> copy(
-            h, std::vector<std::vector<unsigned char>>(
-                w, std::vector<unsigned char>(channels, 0)));
+    // Only look at the histogram if we need it
+    const int shade = (color == OutputColor::BlackAndWhite)?grayShade():GRAY_SHADE;
 
-    for (int y = 0; y < h; ++y)
-    {
-        for (int x = 0; x < w; ++x)
-        {
-            // If grayscale input, just copy the image
-            if (N == 1)
-            {
-                copy[y][x][0] = p[y][x][0];
-            }
-            // If color, copy all the channels
-            else if (color == OutputColor::Color)
-            {
-                for (int i = 0; i < channels; ++i)
-                    copy[y][x][i] = p[y][x][i];
-            }
-            // If color and we want grayscale or black and white, then average
-            // the channels
-            else
-            {
-                double sum = 0;
+    if (dim)
+        mark_color = 0;
 
-                // 3 instead of N since with RGBA we ignore A
-                for (int i = 0; i < 3; ++i)
-                    sum += p[y][x][i];
+    // What each value becomes after thresholding or dimming, so that
+    // converting each pixel is just looking it up
+    std::array<unsigned char, 256> table;
 
-                copy[y][x][0] = smartFloor(sum/N);
-            }
-        }
+    for (int v = 0; v < 256; ++v)
+    {
+        if (color == OutputColor::BlackAndWhite)
+            table[v] = (v>shade)?255:(dim?170:0); // 255-255/3 = 170
+        else
+            table[v] = dim?(170 + v/3):v;
     }
 
-    // Converting both at once is faster
-    if (dim && color == OutputColor::BlackAndWhite)
-    {
-        mark_color = 0;
+    // Work on a separate copy of this image, already laid out the way DevIL
+    // wants it: RGB even for grayscale or black and white, and flipped
+    // vertically since for some reason ilTexImage puts the first row at the
+    // bottom
+    const std::size_t row_size = static_cast<std::size_t>(w)*3;
+    PoolVector<unsigned char> data(row_size*h);
 
-        for (int y = 0; y < h; ++y)
-            for (int x = 0; x < w; ++x)
-                copy[y][x][0] = (copy[y][x][0]>gray_shade)?255:170; // 255-255/3 = 170
-    }
-    // Convert to black and white
-    else if (color == OutputColor::BlackAndWhite)
-    {
-        for (int y = 0; y < h; ++y)
-            for (int x = 0; x < w; ++x)
-                copy[y][x][0] = (copy[y][x][0]>gray_shade)?255:0;
-    }
-    // Dim the image
-    else if (dim)
+    for (int y = 0; y < h; ++y)
     {
-        mark_color = 0;
+        const unsigned char* in = p.row(y);
+        unsigned char* out = data.data() + (h-1-y)*row_size;
 
-        for (int y = 0; y < h; ++y)
-            for (int x = 0; x < w; ++x)
-                for (int i = 0; i < channels; ++i)
-                    copy[y][x][i] = 170 + copy[y][x][i]/3; // 255-255/3 = 170
+        // If grayscale input, just copy the image
+        if constexpr (N == 1)
+        {
+            for (int x = 0; x < w; ++x, ++in, out += 3)
+                out[0] = out[1] = out[2] = table[in[0]];
+        }
+        // If color, copy the channels, ignoring A with RGBA
+        else if (color == OutputColor::Color)
+        {
+            for (int x = 0; x < w; ++x, in += N, out += 3)
+            {
+                out[0] = table[in[0]];
+                out[1] = table[in[1]];
+                out[2] = table[in[2]];
+            }
+        }
+        // Otherwise average the channels, 3 instead of N since with RGBA we
+        // ignore A
+        else
+        {
+            for (int x = 0; x < w; ++x, in += N, out += 3)
+                out[0] = out[1] = out[2] = table[(in[0] + in[1] + in[2])/N];
+        }
     }
 
-    // Draw the marks on a copy of the image
+    // Draw the marks on the copy of the image
     if (show_marks)
     {
+        auto set = [&](int x, int y)
+        {
+            unsigned char* out = data.data() + (h-1-y)*row_size + x*3;
+            out[0] = out[1] = out[2] = mark_color;
+        };
+
         for (const Mark& m : marks)
         {
-            if (m.size > 1)
-            {
-                // Left
-                for (int i = m.coord.x; i > m.coord.x-m.size && i >= 0; --i)
-                    for (int j = 0; j < channels; ++j)
-                        copy[m.coord.y][i][j] = mark_color;
-                // Right
-                for (int i = m.coord.x; i < m.coord.x+m.size && i < w; ++i)
-                    for (int j = 0; j < channels; ++j)
-                        copy[m.coord.y][i][j] = mark_color;
-                // Up
-                for (int i = m.coord.y; i > m.coord.y-m.size && i >= 0; --i)
-                    for (int j = 0; j < channels; ++j)
-                        copy[i][m.coord.x][j] = mark_color;
-                // Down
-                for (int i = m.coord.y; i < m.coord.y+m.size && i < h; ++i)
-                    for (int j = 0; j < channels; ++j)
-                        copy[i][m.coord.x][j] = mark_color;
-            }
-            else
-            {
-                for (int j = 0; j < channels; ++j)
-                    copy[m.coord.y][m.coord.x][j] = mark_color;
-            }
+            // Left and right, then up and down
+            for (int i = std::max(m.coord.x-m.size+1, 0); i < m.coord.x+m.size && i < w; ++i)
+                set(i, m.coord.y);
+            for (int i = std::max(m.coord.y-m.size+1, 0); i < m.coord.y+m.size && i < h; ++i)
+                set(m.coord.x, i);
         }
     }
 
+    // Without DevIL these can be written at the same time as others, starting
+    // from the last row since the copy is upside down
+    if (canEncode(filename))
+    {
+        encodeImage(filename, data.data() + (h-1)*row_size, w, h, 3,
+                -static_cast<std::ptrdiff_t>(row_size), compression);
+        return;
+    }
+
     // One thread again
     std::unique_lock<std::mutex> lck(lock);
 
-    // Convert this back to a real black and white image
     ILuint name;
     ilGenImages(1, &name);
     ilBindImage(name);
     ilEnable(IL_FILE_OVERWRITE);
+    ilTexImage(w, h, 1, 3, IL_RGB, IL_UNSIGNED_BYTE, data.data());
 
-    // 3 because IL_RGB
-    const int total = w*h*3;
-    unsigned char* data = new unsigned char[total];
-
-    // Position in data
-    int pos = 0;
-
-    // For some reason the image is flipped vertically when loading it with
-    // ilTexImage, so start at the bottom and go up.
-    for (int y = h-1; y >= 0; --y)
-    {
-        for (int x = 0; x < w; ++x)
-        {
-            // Output RGB if color output otherwise just the grayscale or B&W channel
-            if (color == OutputColor::Color)
-            {
-                data[pos]   = copy[y][x][0];
-                data[pos+1] = copy[y][x][1];
-                data[pos+2] = copy[y][x][2];
-            }
-            else
-            {
-                data[pos]   = copy[y][x][0];
-                data[pos+1] = copy[y][x][0];
-                data[pos+2] = copy[y][x][0];
-            }
-
-            // For R, G, and B that we just set
-            pos+=3;
-        }
-    }
-
-    ilTexImage(w, h, 1, 3, IL_RGB, IL_UNSIGNED_BYTE, data);
+    const bool saved = ilSaveImage(filename.c_str()) && ilGetError() != IL_INVALID_PARAM;
+    ilDeleteImages(1, &name);
 
-    if (!ilSaveImage(filename.c_str()) || ilGetError() == IL_INVALID_PARAM)
-    {
-        delete[] data;
+    if (!saved)
         throw std::runtime_error("could not save image");
-    }
+}
 
-    ilDeleteImages(1, &name);
-    delete[] data;
+template<int N>
+void Pixels<N>::write(const std::string& filename, int compression) const
+{
+    if (!canEncode(filename) || !loaded)
+        save(filename, false, false, OutputColor::Color, compression);
+    else
+        encodeImage(filename, p.row(0), w, h, N, p.stride(), compression);
 }
 
 template<int N>
@@ -812,9 +868,12 @@ Coord Pixels<N>::rotatePoint(const Coord& origin, const Coord& c,
 template<int N>
 void Pixels<N>::rotate(double rad, const Coord& point)
 {
+    // The threshold is that of the image before rotating, which has the same
+    // pixels without the white fill
+    grayShade();
+
     // Right size, default to white (255 or 1111 1111)
-    std::vector<std::vector<std::array<unsigned char, N>>> copy(
-            h, std::vector<std::array<unsigned char, N>>(w, make_array<N, unsigned char>(0xff)));
+    PixelArray copy(w, h, make_array<N, unsigned char>(0xff));
 
     // -rad because we're calculating the rotation to get from the new rotated
     // image to the original image. We're walking the new image instead of the
@@ -833,7 +892,7 @@ void Pixels<N>::rotate(double rad, const Coord& point)
         }
     }
 
-    p = copy;
+    p = std::move(copy);
 
     // Rotate marks as well. This time we'll rotate to the new image, calculating the new
     // point instead of looking for what goes at every pixel in the new image.
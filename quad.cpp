@@ -0,0 +1,157 @@
+#include <limits>
+#include <algorithm>
+
+#include "quad.h"
+
+// Positive if going from o to a to b turns clockwise (with y going down)
+static long long cross(const Coord& o, const Coord& a, const Coord& b)
+{
+    return 1LL*(a.x - o.x)*(b.y - o.y) - 1LL*(a.y - o.y)*(b.x - o.x);
+}
+
+std::vector<Line> Quad::sides() const
+{
+    std::vector<Line> lines;
+
+    for (int i = 0; i < 4; ++i)
+        lines.push_back(Line(corners[i], corners[(i+1)%4]));
+
+    return lines;
+}
+
+std::vector<Coord> convexHull(const std::vector<Coord>& points)
+{
+    if (points.empty())
+        return std::vector<Coord>();
+
+    int min_x = std::numeric_limits<int>::max();
+    int max_x = std::numeric_limits<int>::min();
+
+    for (const Coord& p : points)
+    {
+        min_x = std::min(min_x, p.x);
+        max_x = std::max(max_x, p.x);
+    }
+
+    // Only the top and bottom point in each column could be on the hull, and
+    // going through the columns gives them already sorted
+    const int width = max_x - min_x + 1;
+    std::vector<int> top(width, std::numeric_limits<int>::max());
+    std::vector<int> bottom(width, std::numeric_limits<int>::min());
+
+    for (const Coord& p : points)
+    {
+        top[p.x - min_x] = std::min(top[p.x - min_x], p.y);
+        bottom[p.x - min_x] = std::max(bottom[p.x - min_x], p.y);
+    }
+
+    std::vector<Coord> sorted;
+
+    for (int x = 0; x < width; ++x)
+    {
+        if (top[x] > bottom[x])
+            continue;
+
+        sorted.push_back(Coord(x + min_x, top[x]));
+
+        if (bottom[x] != top[x])
+            sorted.push_back(Coord(x + min_x, bottom[x]));
+    }
+
+    if (sorted.size() < 3)
+        return sorted;
+
+    // Monotone chain, the top going right and then the bottom going left,
+    // dropping any point where it doesn't turn clockwise
+    std::vector<Coord> hull;
+
+    for (const Coord& p : sorted)
+    {
+        while (hull.size() >= 2 && cross(hull[hull.size()-2], hull.back(), p) <= 0)
+            hull.pop_back();
+
+        hull.push_back(p);
+    }
+
+    const std::vector<Coord>::size_type top_size = hull.size();
+
+    for (std::vector<Coord>::const_reverse_iterator p = sorted.rbegin()+1;
+            p != sorted.rend(); ++p)
+    {
+        while (hull.size() > top_size && cross(hull[hull.size()-2], hull.back(), *p) <= 0)
+            hull.pop_back();
+
+        hull.push_back(*p);
+    }
+
+    // The first point was added again at the end
+    hull.pop_back();
+
+    return hull;
+}
+
+double polygonArea(const std::vector<Coord>& points)
+{
+    long long total = 0;
+
+    for (std::vector<Coord>::size_type i = 0; i < points.size(); ++i)
+    {
+        const Coord& a = points[i];
+        const Coord& b = points[(i+1)%points.size()];
+        total += 1LL*a.x*b.y - 1LL*b.x*a.y;
+    }
+
+    return total/2.0;
+}
+
+Quad findQuad(const std::vector<Coord>& outline)
+{
+    Quad quad;
+    const std::vector<Coord> hull = convexHull(outline);
+
+    if (hull.size() < 3)
+        return quad;
+
+    // One corner is probably the farthest from the center, and the opposite
+    // one the farthest from that
+    const Coord first = farthestFromPoint(findCenter(hull), hull);
+    const Coord opposite = farthestFromPoint(first, hull);
+
+    const int size = hull.size();
+    const int i = std::find(hull.begin(), hull.end(), first) - hull.begin();
+    const int j = std::find(hull.begin(), hull.end(), opposite) - hull.begin();
+
+    // The other two are the farthest from the diagonal on each side of it,
+    // which are the two halves of the hull between these corners
+    std::vector<Coord> right;
+    std::vector<Coord> left;
+
+    for (int k = (i+1)%size; k != j; k = (k+1)%size)
+        right.push_back(hull[k]);
+
+    for (int k = (j+1)%size; k != i; k = (k+1)%size)
+        left.push_back(hull[k]);
+
+    if (right.empty() || left.empty())
+        return quad;
+
+    std::vector<Coord> corners = {
+        first,
+        farthestFromLine(first, opposite, right),
+        opposite,
+        farthestFromLine(first, opposite, left)
+    };
+
+    // Start from the top left. They're already clockwise since the hull is.
+    std::vector<Coord>::iterator top_left = std::min_element(corners.begin(), corners.end(),
+        [](const Coord& a, const Coord& b) { return a.x + a.y < b.x + b.y; });
+    std::rotate(corners.begin(), top_left, corners.end());
+    std::copy(corners.begin(), corners.end(), quad.corners.begin());
+
+    quad.area = polygonArea(corners);
+
+    if (quad.area > 0)
+        quad.fill = std::abs(polygonArea(outline))/quad.area;
+
+    return quad;
+}
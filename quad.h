@@ -0,0 +1,221 @@
+/*
+ * Fit the four corners of a photo to its outline
+ *
+ *   const Quad quad = findQuad(blobs.contour(label));
+ *
+ *   if (quad.fill > 0.9)
+ *       for (const Line& side : quad.sides())
+ *           ...
+ *
+ * This finds the convex hull of the outline and then the corners from the
+ * points on the hull farthest from each other, so it's linear in the length of
+ * the outline rather than trying many lines along it.
+ *
+ * If the outline was found on img.downscale(4), the corners can be moved to
+ * where the edges are in the full image, only looking near each side:
+ *   const Quad photo = refineQuad(img, quad, 4, 8);
+ */
+
+#ifndef H_QUAD
+#define H_QUAD
+
+#include <cmath>
+#include <array>
+#include <vector>
+
+#include "line.h"
+#include "coord.h"
+#include "pixels.h"
+
+struct Quad
+{
+    // Clockwise starting from the top left
+    std::array<Coord, 4> corners;
+
+    // Area of the quadrilateral
+    double area = 0;
+
+    // Area inside the outline as a fraction of the area of the
+    // quadrilateral, near one if the outline really is four sided
+    double fill = 0;
+
+    // Lines between the corners, starting with the top
+    std::vector<Line> sides() const;
+};
+
+// Smallest convex polygon containing all of the points, clockwise, without
+// any points in the middle of the sides. Linear in the number of points plus
+// the width they span.
+std::vector<Coord> convexHull(const std::vector<Coord>& points);
+
+// Area of a closed polygon, positive if the points go clockwise
+double polygonArea(const std::vector<Coord>& points);
+
+// Find the corners of a closed outline. If it's too small or all in a line,
+// the area and fill will be zero.
+Quad findQuad(const std::vector<Coord>& outline);
+
+// Scale up the corners of a quad found on img.downscale(scale) and then move
+// each side to best fit the edge in img, looking up to window pixels to
+// either side of where it was. The corners are where the fitted sides cross.
+// The fill is left as it was on the coarse outline, since that's only known
+// as a fraction of the coarse area.
+template<int N>
+Quad refineQuad(const Pixels<N>& img, const Quad& coarse, int scale, int window);
+
+template<int N>
+Quad refineQuad(const Pixels<N>& img, const Quad& coarse, int scale, int window)
+{
+    // Skip this much of each side near the corners, which often aren't
+    // quite square
+    const double margin = 0.15;
+
+    // Smallest change in the sum of the channels across the edge to count
+    const int min_gradient = 8*N;
+
+    const int w = img.width();
+    const int h = img.height();
+    const typename Pixels<N>::PixelArray& p = img.ref();
+
+    // Middle of each block in the full image
+    std::array<double, 4> cx;
+    std::array<double, 4> cy;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        cx[i] = coarse.corners[i].x*scale + (scale-1)/2.0;
+        cy[i] = coarse.corners[i].y*scale + (scale-1)/2.0;
+    }
+
+    auto intensity = [&](double x, double y, int& value) -> bool
+    {
+        const int px = std::lround(x);
+        const int py = std::lround(y);
+
+        if (px < 0 || px >= w || py < 0 || py >= h)
+            return false;
+
+        value = 0;
+
+        for (int i = 0; i < N; ++i)
+            value += p[py][px][i];
+
+        return true;
+    };
+
+    // Each side as a point on it and a unit direction along it
+    std::array<double, 4> ox, oy, dx, dy;
+
+    for (int side = 0; side < 4; ++side)
+    {
+        const int next = (side+1)%4;
+        const double length = std::hypot(cx[next] - cx[side], cy[next] - cy[side]);
+
+        ox[side] = cx[side];
+        oy[side] = cy[side];
+        dx[side] = (length > 0)?(cx[next] - cx[side])/length:1;
+        dy[side] = (length > 0)?(cy[next] - cy[side])/length:0;
+
+        // Normal to the side
+        const double nx = -dy[side];
+        const double ny = dx[side];
+
+        // Where the edge is across the side, every few pixels along it
+        std::vector<double> ex;
+        std::vector<double> ey;
+
+        for (double s = margin*length; s <= (1-margin)*length; s += std::max(1, scale/2))
+        {
+            const double sx = cx[side] + s*dx[side];
+            const double sy = cy[side] + s*dy[side];
+
+            int best = min_gradient-1;
+            int best_t = 0;
+            bool found = false;
+
+            for (int t = -window+1; t < window; ++t)
+            {
+                int before, after;
+
+                if (!intensity(sx + (t-1)*nx, sy + (t-1)*ny, before) ||
+                    !intensity(sx + (t+1)*nx, sy + (t+1)*ny, after))
+                    continue;
+
+                if (std::abs(after - before) > best)
+                {
+                    best = std::abs(after - before);
+                    best_t = t;
+                    found = true;
+                }
+            }
+
+            if (found)
+            {
+                ex.push_back(sx + best_t*nx);
+                ey.push_back(sy + best_t*ny);
+            }
+        }
+
+        // Not enough to go on, so keep the side where it was
+        if (ex.size() < 2)
+            continue;
+
+        // Least squares fit minimizing the perpendicular distances, i.e. the
+        // line through the center along the main axis of the points
+        double mx = 0;
+        double my = 0;
+
+        for (std::vector<double>::size_type i = 0; i < ex.size(); ++i)
+        {
+            mx += ex[i];
+            my += ey[i];
+        }
+
+        mx /= ex.size();
+        my /= ey.size();
+
+        double sxx = 0;
+        double syy = 0;
+        double sxy = 0;
+
+        for (std::vector<double>::size_type i = 0; i < ex.size(); ++i)
+        {
+            sxx += (ex[i]-mx)*(ex[i]-mx);
+            syy += (ey[i]-my)*(ey[i]-my);
+            sxy += (ex[i]-mx)*(ey[i]-my);
+        }
+
+        const double angle = std::atan2(2*sxy, sxx - syy)/2;
+
+        ox[side] = mx;
+        oy[side] = my;
+        dx[side] = std::cos(angle);
+        dy[side] = std::sin(angle);
+    }
+
+    // Each corner is where the sides before and after it cross
+    Quad quad = coarse;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        const int a = (i+3)%4;
+        const int b = i;
+        const double det = dx[a]*dy[b] - dy[a]*dx[b];
+
+        // Nearly parallel, so keep the scaled up corner
+        if (std::abs(det) < 1e-3)
+        {
+            quad.corners[i] = Coord(std::lround(cx[i]), std::lround(cy[i]));
+            continue;
+        }
+
+        const double s = ((ox[b] - ox[a])*dy[b] - (oy[b] - oy[a])*dx[b])/det;
+        quad.corners[i] = Coord(std::lround(ox[a] + s*dx[a]), std::lround(oy[a] + s*dy[a]));
+    }
+
+    quad.area = polygonArea(std::vector<Coord>(quad.corners.begin(), quad.corners.end()));
+
+    return quad;
+}
+
+#endif
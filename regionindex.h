@@ -0,0 +1,451 @@
+/*
+ * Statistics about any rectangle of an image without looking at every pixel
+ *
+ *   RegionIndex<3> index(img);
+ *   std::array<std::uint64_t, 3> sums = index.sum(rect);
+ *   std::uint64_t white = index.white(rect);
+ *   index.minMax(rect, lo, hi);
+ *
+ * Sums (of values, squared values, white pixels, and pixels in each bin of a
+ * coarse grayscale histogram) are kept as summed-area tables, so each one is
+ * a few lookups per rectangle. The tables are 32 bit and are allowed to wrap
+ * around, since the difference of the four corners is still right as long as
+ * the actual sum fits in 32 bits. Rectangles big enough that it might not are
+ * added up in pieces.
+ *
+ * Minimums and maximums can't be done that way, so those are kept in a
+ * pyramid of 2x2, 4x4, 8x8, ... blocks. A rectangle is covered with the
+ * largest blocks that fit inside it, then smaller ones along the edges, which
+ * is proportional to the perimeter rather than the area.
+ *
+ * Rectangles are half open like PixelBuffer::view(), i.e. br isn't included,
+ * and are clamped to the image. The index refers to the image's pixels, so
+ * the image must outlive it and not change.
+ */
+
+#ifndef H_REGIONINDEX
+#define H_REGIONINDEX
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+
+#include "rect.h"
+#include "pixels.h"
+#include "pixelbuffer.h"
+
+template<int N>
+class RegionIndex
+{
+    static_assert(N == 1 || N == 3 || N == 4, "Must have 1, 3, or 4 channels");
+
+public:
+    typedef std::array<unsigned char, N> Pixel;
+
+private:
+    int w;
+    int h;
+    int bins;
+    PixelView<N> pixels;
+
+    // Summed-area tables with (w+1)*(h+1) entries, the first row and column
+    // being zero. Value (x,y) is the sum of everything above and left of it.
+    std::vector<std::uint32_t> sums;    // N per entry
+    std::vector<std::uint32_t> squares; // N per entry, if requested
+    std::vector<std::uint32_t> whites;
+    std::vector<std::uint32_t> hist;    // bins per entry, if requested
+
+    // Level k has the minimum and maximum of each 2^k by 2^k block, starting
+    // at level 1 since level 0 is just the pixels
+    struct Level
+    {
+        int w;
+        int h;
+        std::vector<Pixel> min;
+        std::vector<Pixel> max;
+    };
+
+    std::vector<Level> levels;
+
+public:
+    // Squared values are only needed for variances and the histogram for
+    // thresholds, so those are only computed if asked for. histogram_bins
+    // must divide 256, e.g. 16 bins of 16 shades each.
+    explicit RegionIndex(const Pixels<N>& img, bool squared = false,
+            int histogram_bins = 0);
+
+    int width()  const { return w; }
+    int height() const { return h; }
+
+    // Number of pixels in the rectangle within the image
+    std::uint64_t area(const Rect& rect) const;
+
+    // Number of pixels that aren't img.black()
+    std::uint64_t white(const Rect& rect) const;
+
+    // Sum of each channel and of each channel squared
+    std::array<std::uint64_t, N> sum(const Rect& rect) const;
+    std::array<std::uint64_t, N> sumSquares(const Rect& rect) const;
+
+    // Minimum and maximum of each channel, which are 255 and 0 if the
+    // rectangle is empty
+    void minMax(const Rect& rect, Pixel& lo, Pixel& hi) const;
+
+    // Grayscale histogram, where bin i counts averages of the channels from
+    // i*256/bins up to (i+1)*256/bins
+    std::vector<std::uint64_t> grayHistogram(const Rect& rect) const;
+
+private:
+    // Clamp to the image, returning false if nothing is left
+    bool clamp(const Rect& rect, int& x0, int& y0, int& x1, int& y1) const;
+
+    // Sum from a table with count values per entry, where each pixel adds at
+    // most max to the sum
+    std::uint64_t tableSum(const std::vector<std::uint32_t>& table, int count,
+            int index, int x0, int y0, int x1, int y1, std::uint32_t max) const;
+
+    // Look up one rectangle in a table, which is only right if the real sum
+    // fits in 32 bits
+    std::uint32_t corners(const std::vector<std::uint32_t>& table, int count,
+            int index, int x0, int y0, int x1, int y1) const;
+
+    void minMaxLevel(int level, int x0, int y0, int x1, int y1,
+            Pixel& lo, Pixel& hi) const;
+};
+
+/*
+ * Implementation
+ */
+
+template<int N>
+RegionIndex<N>::RegionIndex(const Pixels<N>& img, bool squared, int histogram_bins)
+    : w(img.width()), h(img.height()), bins(histogram_bins), pixels(img.ref())
+{
+    if (bins < 0 || bins > 256 || (bins > 0 && 256%bins != 0))
+        throw std::runtime_error("histogram bins must divide 256");
+
+    const std::size_t entries = static_cast<std::size_t>(w+1)*(h+1);
+    const int bin_size = (bins > 0)?256/bins:1;
+    const unsigned char shade = img.grayShade();
+
+    sums.assign(entries*N, 0);
+    whites.assign(entries, 0);
+
+    if (squared)
+        squares.assign(entries*N, 0);
+
+    if (bins > 0)
+        hist.assign(entries*bins, 0);
+
+    // Running sums along the row added to the row above
+    std::array<std::uint32_t, N> row_sum;
+    std::array<std::uint32_t, N> row_squares;
+    std::vector<std::uint32_t> row_hist(bins);
+
+    for (int y = 0; y < h; ++y)
+    {
+        const Pixel* row = pixels[y];
+        const std::size_t above = static_cast<std::size_t>(y)*(w+1);
+        const std::size_t here = above + (w+1);
+
+        row_sum.fill(0);
+        row_squares.fill(0);
+        std::fill(row_hist.begin(), row_hist.end(), 0);
+        std::uint32_t row_white = 0;
+
+        for (int x = 0; x < w; ++x)
+        {
+            int gray = 0;
+
+            for (int c = 0; c < N; ++c)
+            {
+                const std::uint32_t v = row[x][c];
+                gray += v;
+
+                row_sum[c] += v;
+                row_squares[c] += v*v;
+            }
+
+            gray /= N;
+
+            // Same as Pixels::black()
+            if (gray >= shade)
+                ++row_white;
+
+            if (bins > 0)
+                ++row_hist[gray/bin_size];
+
+            for (int c = 0; c < N; ++c)
+                sums[(here+x+1)*N + c] = sums[(above+x+1)*N + c] + row_sum[c];
+
+            if (squared)
+                for (int c = 0; c < N; ++c)
+                    squares[(here+x+1)*N + c] = squares[(above+x+1)*N + c] + row_squares[c];
+
+            for (int b = 0; b < bins; ++b)
+                hist[(here+x+1)*bins + b] = hist[(above+x+1)*bins + b] + row_hist[b];
+
+            whites[here+x+1] = whites[above+x+1] + row_white;
+        }
+    }
+
+    // Pyramid of block minimums and maximums, each level from the one below
+    for (int size = 2, level = 1; size/2 < std::max(w, h); size *= 2, ++level)
+    {
+        Level next;
+        next.w = (w + size - 1)/size;
+        next.h = (h + size - 1)/size;
+        next.min.assign(static_cast<std::size_t>(next.w)*next.h, make_array<N, unsigned char>(255));
+        next.max.assign(static_cast<std::size_t>(next.w)*next.h, make_array<N, unsigned char>(0));
+
+        for (int by = 0; by < next.h; ++by)
+        {
+            for (int bx = 0; bx < next.w; ++bx)
+            {
+                Pixel& lo = next.min[by*next.w + bx];
+                Pixel& hi = next.max[by*next.w + bx];
+
+                // The four (or fewer, at the edges) blocks below this one
+                for (int y = 2*by; y < 2*by+2; ++y)
+                {
+                    for (int x = 2*bx; x < 2*bx+2; ++x)
+                    {
+                        if (level == 1)
+                        {
+                            if (x >= w || y >= h)
+                                continue;
+
+                            for (int c = 0; c < N; ++c)
+                            {
+                                lo[c] = std::min(lo[c], pixels[y][x][c]);
+                                hi[c] = std::max(hi[c], pixels[y][x][c]);
+                            }
+                        }
+                        else
+                        {
+                            const Level& below = levels.back();
+
+                            if (x >= below.w || y >= below.h)
+                                continue;
+
+                            for (int c = 0; c < N; ++c)
+                            {
+                                lo[c] = std::min(lo[c], below.min[y*below.w + x][c]);
+                                hi[c] = std::max(hi[c], below.max[y*below.w + x][c]);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        levels.push_back(std::move(next));
+    }
+}
+
+template<int N>
+bool RegionIndex<N>::clamp(const Rect& rect, int& x0, int& y0, int& x1, int& y1) const
+{
+    x0 = std::max(rect.tl.x, 0);
+    y0 = std::max(rect.tl.y, 0);
+    x1 = std::min(rect.br.x, w);
+    y1 = std::min(rect.br.y, h);
+
+    return x0 < x1 && y0 < y1;
+}
+
+template<int N>
+std::uint32_t RegionIndex<N>::corners(const std::vector<std::uint32_t>& table,
+        int count, int index, int x0, int y0, int x1, int y1) const
+{
+    const std::size_t stride = w+1;
+
+    // Wraps around the same way the table did when it was built
+    return table[(y1*stride + x1)*count + index] - table[(y0*stride + x1)*count + index]
+         - table[(y1*stride + x0)*count + index] + table[(y0*stride + x0)*count + index];
+}
+
+template<int N>
+std::uint64_t RegionIndex<N>::tableSum(const std::vector<std::uint32_t>& table,
+        int count, int index, int x0, int y0, int x1, int y1, std::uint32_t max) const
+{
+    // Largest number of pixels that can't overflow
+    const std::uint64_t limit = std::max<std::uint64_t>(1, 0xffffffffu/std::max<std::uint32_t>(1, max));
+    const std::uint64_t rw = x1 - x0;
+    const std::uint64_t rh = y1 - y0;
+
+    if (rw*rh <= limit)
+        return corners(table, count, index, x0, y0, x1, y1);
+
+    // Split into pieces that each can't overflow
+    const int piece_w = std::min(rw, limit);
+    const int piece_h = std::max<std::uint64_t>(1, limit/piece_w);
+    std::uint64_t total = 0;
+
+    for (int y = y0; y < y1; y += piece_h)
+        for (int x = x0; x < x1; x += piece_w)
+            total += corners(table, count, index, x, y,
+                    std::min(x1, x + piece_w), std::min(y1, y + piece_h));
+
+    return total;
+}
+
+template<int N>
+std::uint64_t RegionIndex<N>::area(const Rect& rect) const
+{
+    int x0, y0, x1, y1;
+
+    if (!clamp(rect, x0, y0, x1, y1))
+        return 0;
+
+    return static_cast<std::uint64_t>(x1-x0)*(y1-y0);
+}
+
+template<int N>
+std::uint64_t RegionIndex<N>::white(const Rect& rect) const
+{
+    int x0, y0, x1, y1;
+
+    if (!clamp(rect, x0, y0, x1, y1))
+        return 0;
+
+    return tableSum(whites, 1, 0, x0, y0, x1, y1, 1);
+}
+
+template<int N>
+std::array<std::uint64_t, N> RegionIndex<N>::sum(const Rect& rect) const
+{
+    std::array<std::uint64_t, N> result{};
+    int x0, y0, x1, y1;
+
+    if (clamp(rect, x0, y0, x1, y1))
+        for (int c = 0; c < N; ++c)
+            result[c] = tableSum(sums, N, c, x0, y0, x1, y1, 255);
+
+    return result;
+}
+
+template<int N>
+std::array<std::uint64_t, N> RegionIndex<N>::sumSquares(const Rect& rect) const
+{
+    if (squares.empty())
+        throw std::runtime_error("region index wasn't built with squared values");
+
+    std::array<std::uint64_t, N> result{};
+    int x0, y0, x1, y1;
+
+    if (clamp(rect, x0, y0, x1, y1))
+        for (int c = 0; c < N; ++c)
+            result[c] = tableSum(squares, N, c, x0, y0, x1, y1, 255*255);
+
+    return result;
+}
+
+template<int N>
+std::vector<std::uint64_t> RegionIndex<N>::grayHistogram(const Rect& rect) const
+{
+    if (bins == 0)
+        throw std::runtime_error("region index wasn't built with a histogram");
+
+    std::vector<std::uint64_t> result(bins, 0);
+    int x0, y0, x1, y1;
+
+    if (clamp(rect, x0, y0, x1, y1))
+        for (int b = 0; b < bins; ++b)
+            result[b] = tableSum(hist, bins, b, x0, y0, x1, y1, 1);
+
+    return result;
+}
+
+template<int N>
+void RegionIndex<N>::minMax(const Rect& rect, Pixel& lo, Pixel& hi) const
+{
+    lo.fill(255);
+    hi.fill(0);
+
+    int x0, y0, x1, y1;
+
+    if (!clamp(rect, x0, y0, x1, y1))
+        return;
+
+    // Start with the largest blocks that could fit
+    int level = 0;
+
+    while (level < static_cast<int>(levels.size()) &&
+            (2 << level) <= std::min(x1-x0, y1-y0))
+        ++level;
+
+    minMaxLevel(level, x0, y0, x1, y1, lo, hi);
+}
+
+template<int N>
+void RegionIndex<N>::minMaxLevel(int level, int x0, int y0, int x1, int y1,
+        Pixel& lo, Pixel& hi) const
+{
+    if (x0 >= x1 || y0 >= y1)
+        return;
+
+    if (level == 0)
+    {
+        for (int y = y0; y < y1; ++y)
+        {
+            const Pixel* row = pixels[y];
+
+            for (int x = x0; x < x1; ++x)
+            {
+                for (int c = 0; c < N; ++c)
+                {
+                    lo[c] = std::min(lo[c], row[x][c]);
+                    hi[c] = std::max(hi[c], row[x][c]);
+                }
+            }
+        }
+
+        return;
+    }
+
+    // Blocks completely inside the rectangle
+    const int size = 1 << level;
+    const int bx0 = (x0 + size - 1) >> level;
+    const int by0 = (y0 + size - 1) >> level;
+    const int bx1 = x1 >> level;
+    const int by1 = y1 >> level;
+
+    if (bx0 >= bx1 || by0 >= by1)
+    {
+        minMaxLevel(level-1, x0, y0, x1, y1, lo, hi);
+        return;
+    }
+
+    const Level& blocks = levels[level-1];
+
+    for (int by = by0; by < by1; ++by)
+    {
+        for (int bx = bx0; bx < bx1; ++bx)
+        {
+            const Pixel& block_lo = blocks.min[by*blocks.w + bx];
+            const Pixel& block_hi = blocks.max[by*blocks.w + bx];
+
+            for (int c = 0; c < N; ++c)
+            {
+                lo[c] = std::min(lo[c], block_lo[c]);
+                hi[c] = std::max(hi[c], block_hi[c]);
+            }
+        }
+    }
+
+    // What's left are strips along the edges narrower than a block
+    const int ix0 = bx0 << level;
+    const int iy0 = by0 << level;
+    const int ix1 = bx1 << level;
+    const int iy1 = by1 << level;
+
+    minMaxLevel(level-1, x0, y0, x1, iy0, lo, hi);   // Top
+    minMaxLevel(level-1, x0, iy1, x1, y1, lo, hi);   // Bottom
+    minMaxLevel(level-1, x0, iy0, ix0, iy1, lo, hi); // Left
+    minMaxLevel(level-1, ix1, iy0, x1, iy1, lo, hi); // Right
+}
+
+#endif
@@ -9,6 +9,8 @@
 
 #include "rect.h"
 #include "pixels.h"
+#include "threadpool.h"
+#include "regionindex.h"
 
 // Is a particular region of an image "interesting", part of the background
 // that we will look at further later
@@ -23,10 +25,10 @@ bool interesting(Pixels<N>& img, const Rect& rect)
     int maxX = rect.br.x;
     int maxY = rect.br.y;
 
-    const std::vector<std::vector<std::array<unsigned char, N>>>& ref = img.ref();
+    const typename Pixels<N>::PixelArray& ref = img.ref();
 
     // Local threshold value
-    const Histogram<N> histWhole(ref, rect);
+    const Histogram<N> histWhole(ref.view(rect));
     unsigned char hist_thresh = histWhole.threshold(GRAY_SHADE);
 
     /*
@@ -58,6 +60,8 @@ bool interesting(Pixels<N>& img, const Rect& rect)
 
     for (int y = minY; y < maxY; ++y)
     {
+        const std::array<unsigned char, N>* row = ref[y];
+
         for (int x = minX; x < maxX; ++x, ++total)
         {
             // White
@@ -65,7 +69,7 @@ bool interesting(Pixels<N>& img, const Rect& rect)
                 ++white;
 
             // Grayscale
-            const std::array<unsigned char, N>& values = ref[y][x];
+            const std::array<unsigned char, N>& values = row[x];
 
             for (int i = 0; i < N && i < 3; ++i)
             {
@@ -153,7 +157,7 @@ bool interesting(Pixels<N>& img, const Rect& rect)
 
     for (int i = 0; i < 4; ++i)
     {
-        const Histogram<N> hist(ref, rects[i]);
+        const Histogram<N> hist(ref.view(rects[i]));
 
         // Standard deviation of grayscale and each channel
         double stdev_gray = hist.stdevGrayNorm();
@@ -306,20 +310,89 @@ bool interesting(Pixels<N>& img, const Rect& rect)
     return false;
 }
 
+// Same as above, but looking up everything in the index rather than going
+// through the pixels
+template<int N>
+bool interesting(const RegionIndex<N>& index, const Rect& rect)
+{
+    double grayThresh = 20; // Max difference in averages among channels
+    double similarThresh = 15; // Max differences if max-min pixels in any channel
+    double whiteThresh = 0.90; // What is considered "white"
+
+    // Like above, alpha is left out of the min, max, and sums
+    const std::uint64_t total = index.area(rect);
+    const std::uint64_t white = index.white(rect);
+    const std::array<std::uint64_t, N> sums = index.sum(rect);
+
+    typename RegionIndex<N>::Pixel lo;
+    typename RegionIndex<N>::Pixel hi;
+    index.minMax(rect, lo, hi);
+
+    std::array<std::uint64_t, N> valuesSum{};
+    std::array<int, N> minValue;
+    std::array<int, N> maxValue{};
+    std::fill(minValue.begin(), minValue.end(), 255);
+
+    for (int i = 0; i < N && i < 3; ++i)
+    {
+        valuesSum[i] = sums[i];
+        minValue[i] = lo[i];
+        maxValue[i] = hi[i];
+    }
+
+    bool isWhite = 1.0*white/total > whiteThresh;
+    bool isSimilar = true;
+    bool isGray = false;
+
+    for (int i = 0; i < N; ++i)
+    {
+        int diff = maxValue[i] - minValue[i];
+
+        if (diff < 0 || diff > similarThresh)
+        {
+            isSimilar = false;
+            break;
+        }
+    }
+
+    double maxAvg = 0;
+    double minAvg = 255;
+
+    for (int i = 0; i < N; ++i)
+    {
+        double avg = 1.0*valuesSum[i]/total;
+
+        if (avg > maxAvg)
+            maxAvg = avg;
+        if (avg < minAvg)
+            minAvg = avg;
+    }
+
+    double diff = maxAvg - minAvg;
+
+    if (diff >= 0 && diff < grayThresh)
+        isGray = true;
+
+    return isWhite && isGray && isSimilar;
+}
+
 // The recursive part
 //
-// Returned are temporary regions, the final regions are saved to finalRegions,
+// Interesting regions without interesting regions in them are appended to
+// found, in the same order as if this were done one region at a time. Returns
+// whether anything was found in this region.
+//
+// Quadrants at least parallel pixels on each side are looked at in separate
+// tasks, each with its own results, which are then appended in order.
 template<int N>
-std::vector<Rect> regionRecursive(Pixels<N>& img, std::vector<Rect>& finalRegions,
-        const Rect& rect, int small)
+bool regionRecursive(const RegionIndex<N>& index, std::vector<Rect>& found,
+        const Rect& rect, int small, int parallel, ThreadPool& pool)
 {
-    std::vector<Rect> regions;
-
     // Rectangular region we're looking at, make sure they are within bounds
     int minX = std::max(rect.tl.x, 0);
     int minY = std::max(rect.tl.y, 0);
-    int maxX = std::min(rect.br.x, img.width()-1);
-    int maxY = std::min(rect.br.y, img.height()-1);
+    int maxX = std::min(rect.br.x, index.width()-1);
+    int maxY = std::min(rect.br.y, index.height()-1);
 
     // Split this into 4 sections (if we used floor it would be more than 4 due
     // to rounding issues)
@@ -328,50 +401,66 @@ std::vector<Rect> regionRecursive(Pixels<N>& img, std::vector<Rect>& finalRegion
 
     // Exit condition, if too small
     if (newX < small || newY < small)
-        return regions;
+        return false;
 
     // Looking at smaller regions
+    std::vector<Rect> quadrants;
+
     for (int y = minY; y < maxY; y+=newY)
-    {
         for (int x = minX; x < maxX; x+=newX)
+            quadrants.push_back(Rect(Coord(x, y), Coord(x + newX, y + newY)));
+
+    bool any = false;
+
+    if (newX >= parallel && newY >= parallel)
+    {
+        std::vector<std::vector<Rect>> results(quadrants.size());
+        std::vector<char> anyWithin(quadrants.size(), false);
+        TaskGroup group(pool);
+
+        for (std::size_t i = 0; i < quadrants.size(); ++i)
         {
-            // New region
-            Rect rect(Coord(x, y), Coord(x + newX, y + newY));
-
-            // Look at the regions below this
-            std::vector<Rect> newRegions = regionRecursive(
-                    img, regions, rect, small);
-
-            // TODO: we don't actually use this anywhere, make this function
-            // return bool for whether or not we are done or found interesting
-            // regions
-            regions.insert(
-                    regions.end(),
-                    std::make_move_iterator(newRegions.begin()),
-                    std::make_move_iterator(newRegions.end()));
+            group.run([&, i]()
+            {
+                anyWithin[i] = regionRecursive(index, results[i],
+                        quadrants[i], small, parallel, pool);
+            });
+        }
+
+        group.wait();
+
+        for (std::size_t i = 0; i < quadrants.size(); ++i)
+        {
+            found.insert(found.end(), results[i].begin(), results[i].end());
+            any = any || anyWithin[i];
         }
     }
+    else
+    {
+        for (const Rect& quadrant : quadrants)
+            if (regionRecursive(index, found, quadrant, small, parallel, pool))
+                any = true;
+    }
 
     // If this region is interesting and we didn't find any interesting ones
     // within this one, append it to the list of final regions
-    if (regions.empty() && interesting(img, rect))
+    if (!any && interesting(index, rect))
     {
-        finalRegions.push_back(rect);
-
-        // Debugging
-        img.mark(Coord(minX, minY));
-        img.mark(Coord(minX, maxY));
-        img.mark(Coord(maxX, minY));
-        img.mark(Coord(maxX, maxY));
+        found.push_back(rect);
+        return true;
     }
 
-    return regions;
+    return any;
 }
 
 // Recursively look at smaller and smaller regions in the image to determine if
 // we've found some "interesting" region
+//
+// Regions are split in parallel until they're smaller than parallel pixels on
+// a side.
 template<int N>
-std::vector<Rect> findRegions(Pixels<N>& img)
+std::vector<Rect> findRegions(Pixels<N>& img, int parallel = 256,
+        ThreadPool& pool = ThreadPool::global())
 {
     std::vector<Rect> regions;
 
@@ -382,8 +471,25 @@ std::vector<Rect> findRegions(Pixels<N>& img)
     // about 50% to be black. This means we need a few to check.
     int small = 4;
 
+    // Everything the recursion needs to know about each region
+    const RegionIndex<N> index(img);
+
     // Start recursion
-    regionRecursive(img, regions, all, small);
+    regionRecursive(index, regions, all, small, parallel, pool);
+
+    // Debugging, done afterwards since marking isn't thread safe
+    for (const Rect& rect : regions)
+    {
+        int minX = std::max(rect.tl.x, 0);
+        int minY = std::max(rect.tl.y, 0);
+        int maxX = std::min(rect.br.x, img.width()-1);
+        int maxY = std::min(rect.br.y, img.height()-1);
+
+        img.mark(Coord(minX, minY));
+        img.mark(Coord(minX, maxY));
+        img.mark(Coord(maxX, minY));
+        img.mark(Coord(maxX, maxY));
+    }
 
     return regions;
 }
@@ -0,0 +1,176 @@
+#include <cstdio>
+#include <iomanip>
+
+// For the peak memory use
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "stats.h"
+
+// Only counted when allocations.cpp's operator new is linked in
+static thread_local long long allocations = 0;
+
+void countAllocation()
+{
+    ++allocations;
+}
+
+long long allocationCount()
+{
+    return allocations;
+}
+
+long peakRSS()
+{
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+
+    // Already in kilobytes on Linux
+    return usage.ru_maxrss;
+}
+
+StageStats& Stats::stage(const std::string& name)
+{
+    for (StageStats& s : stages)
+        if (s.name == name)
+            return s;
+
+    stages.push_back(StageStats(name));
+    return stages.back();
+}
+
+void Stats::count(const std::string& stage_name, const std::string& name, long long n)
+{
+    StageStats& s = stage(stage_name);
+
+    for (std::pair<std::string, long long>& c : s.counts)
+    {
+        if (c.first == name)
+        {
+            c.second += n;
+            return;
+        }
+    }
+
+    s.counts.push_back(std::make_pair(name, n));
+}
+
+// Quoted, with anything that would end the string escaped
+static std::string jsonString(const std::string& s)
+{
+    std::string quoted = "\"";
+
+    for (const char c : s)
+    {
+        if (c == '"' || c == '\\')
+        {
+            quoted += '\\';
+            quoted += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            char escaped[7];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            quoted += escaped;
+        }
+        else
+        {
+            quoted += c;
+        }
+    }
+
+    return quoted + "\"";
+}
+
+// Only quoted if it has to be, with quotes doubled
+static std::string csvString(const std::string& s)
+{
+    if (s.find_first_of(",\"\r\n") == std::string::npos)
+        return s;
+
+    std::string quoted = "\"";
+
+    for (const char c : s)
+    {
+        if (c == '"')
+            quoted += '"';
+
+        quoted += c;
+    }
+
+    return quoted + "\"";
+}
+
+void Stats::writeJSON(std::ostream& os, unsigned int uid, const std::string& filename) const
+{
+    os << "{\"page\": " << uid << ", \"file\": " << jsonString(filename)
+       << ", \"stages\": [";
+
+    for (std::vector<StageStats>::size_type i = 0; i < stages.size(); ++i)
+    {
+        const StageStats& s = stages[i];
+
+        os << ((i > 0)?", ":"")
+           << "{\"name\": " << jsonString(s.name)
+           << ", \"seconds\": " << std::fixed << std::setprecision(6) << s.seconds
+           << ", \"allocations\": " << s.allocations
+           << ", \"peak_rss_kb\": " << s.peak_rss_kb;
+
+        for (const std::pair<std::string, long long>& c : s.counts)
+            os << ", " << jsonString(c.first) << ": " << c.second;
+
+        os << "}";
+    }
+
+    os << "]}";
+}
+
+void Stats::writeCSVHeader(std::ostream& os)
+{
+    os << "page,file,stage,name,value\n";
+}
+
+void Stats::writeCSV(std::ostream& os, unsigned int uid, const std::string& filename) const
+{
+    const std::string file = csvString(filename);
+
+    for (const StageStats& s : stages)
+    {
+        const std::string prefix = std::to_string(uid) + "," + file + "," + csvString(s.name) + ",";
+
+        os << prefix << "seconds," << std::fixed << std::setprecision(6) << s.seconds << "\n"
+           << prefix << "allocations," << s.allocations << "\n"
+           << prefix << "peak_rss_kb," << s.peak_rss_kb << "\n";
+
+        for (const std::pair<std::string, long long>& c : s.counts)
+            os << prefix << csvString(c.first) << "," << c.second << "\n";
+    }
+}
+
+StageTimer::StageTimer(Stats& stats, const std::string& name)
+    :stats(stats), name(name), start(std::chrono::steady_clock::now()),
+     start_allocations(allocationCount())
+{
+}
+
+StageTimer::~StageTimer()
+{
+    stop();
+}
+
+void StageTimer::stop()
+{
+    if (!running)
+        return;
+
+    running = false;
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    StageStats& s = stats.stage(name);
+
+    s.seconds += elapsed.count();
+    s.allocations += allocationCount() - start_allocations;
+    s.peak_rss_kb = peakRSS();
+}
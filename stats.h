@@ -0,0 +1,92 @@
+/*
+ * Time, memory, and counts for each stage of working on a page
+ *
+ *   Stats stats;
+ *
+ *   {
+ *       StageTimer timer(stats, "blobs");
+ *       const Blobs blobs(img);
+ *       stats.count("blobs", "blobs", blobs.size());
+ *   }
+ *
+ *   stats.writeJSON(std::cout, uid, filename);
+ *
+ * A timer records the wall time from when it's made until it goes out of
+ * scope or is stopped, how many times operator new was called on this thread
+ * meanwhile, and the peak memory use of the whole process so far. Timing the
+ * same stage again adds to it, e.g. for each outline on a page. Work a stage
+ * hands off to the thread pool is in the time but not in the allocations.
+ */
+
+#ifndef H_STATS
+#define H_STATS
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <utility>
+#include <iostream>
+
+struct StageStats
+{
+    std::string name;
+    double seconds = 0;
+    long long allocations = 0;
+    long peak_rss_kb = 0;
+    std::vector<std::pair<std::string, long long>> counts;
+
+    StageStats(const std::string& n)
+        :name(n) { }
+};
+
+class Stats
+{
+    // In the order they were first timed or counted
+    std::vector<StageStats> stages;
+
+public:
+    // The stage with this name, added if it's not there yet
+    StageStats& stage(const std::string& name);
+
+    // Add n to a count kept for a stage, e.g. the number of blobs
+    void count(const std::string& stage, const std::string& name, long long n);
+
+    bool empty() const { return stages.empty(); }
+
+    // One JSON object for the page, or a CSV row for each number with the
+    // columns in writeCSVHeader
+    void writeJSON(std::ostream& os, unsigned int uid, const std::string& filename) const;
+    void writeCSV(std::ostream& os, unsigned int uid, const std::string& filename) const;
+    static void writeCSVHeader(std::ostream& os);
+};
+
+class StageTimer
+{
+    Stats& stats;
+    std::string name;
+    std::chrono::steady_clock::time_point start;
+    long long start_allocations;
+    bool running = true;
+
+public:
+    StageTimer(Stats& stats, const std::string& name);
+    ~StageTimer();
+
+    // Record it now rather than when going out of scope
+    void stop();
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+};
+
+// Times operator new has been called on this thread, which is always zero
+// unless allocations.cpp is linked in
+long long allocationCount();
+
+// Called by allocations.cpp's operator new
+void countAllocation();
+
+// Most memory the process has used so far, in kilobytes
+long peakRSS();
+
+#endif
@@ -0,0 +1,233 @@
+#include <algorithm>
+
+#include "threadpool.h"
+
+thread_local ThreadPool* ThreadPool::current_pool = nullptr;
+thread_local int ThreadPool::current_queue = 0;
+
+ThreadPool::ThreadPool(int threads)
+    : queued(0)
+{
+    if (threads < 1)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // All the queues have to exist before any worker starts looking at them
+    for (int i = 0; i < threads+1; ++i)
+        queues.push_back(std::unique_ptr<Queue>(new Queue));
+
+    for (int i = 0; i < threads; ++i)
+        workers.push_back(std::thread(&ThreadPool::work, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::unique_lock<std::mutex> lck(lock);
+        stopping = true;
+    }
+
+    changed.notify_all();
+
+    for (std::thread& t : workers)
+        t.join();
+}
+
+ThreadPool& ThreadPool::global()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+int ThreadPool::home() const
+{
+    if (current_pool == this)
+        return current_queue;
+
+    return workers.size();
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+    Queue& q = *queues[home()];
+
+    {
+        std::unique_lock<std::mutex> lck(q.lock);
+        q.tasks.push_back(std::move(task));
+    }
+
+    ++queued;
+    notify(false);
+}
+
+void ThreadPool::notify(bool all)
+{
+    // Taking the lock means anyone about to sleep either already saw the
+    // change or is now waiting and will get the notification
+    {
+        std::unique_lock<std::mutex> lck(lock);
+    }
+
+    if (all)
+        changed.notify_all();
+    else
+        changed.notify_one();
+}
+
+bool ThreadPool::runOne(int index)
+{
+    if (queued == 0)
+        return false;
+
+    std::function<void()> task;
+    const int count = queues.size();
+
+    // Newest from our own queue, otherwise the oldest from the others,
+    // starting with the next one over so not everyone goes to the same place
+    for (int i = 0; i < count && !task; ++i)
+    {
+        Queue& q = *queues[(index + i)%count];
+        std::unique_lock<std::mutex> lck(q.lock);
+
+        if (q.tasks.empty())
+            continue;
+
+        if (i == 0)
+        {
+            task = std::move(q.tasks.back());
+            q.tasks.pop_back();
+        }
+        else
+        {
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+        }
+    }
+
+    if (!task)
+        return false;
+
+    --queued;
+    task();
+
+    return true;
+}
+
+void ThreadPool::work(int index)
+{
+    current_pool = this;
+    current_queue = index;
+
+    while (true)
+    {
+        if (runOne(index))
+            continue;
+
+        std::unique_lock<std::mutex> lck(lock);
+        changed.wait(lck, [this]() { return stopping || queued > 0; });
+
+        // Finish what's queued before exiting
+        if (stopping && queued == 0)
+            return;
+    }
+}
+
+TaskGroup::TaskGroup(ThreadPool& pool)
+    : pool(pool), pending(0)
+{
+}
+
+TaskGroup::~TaskGroup()
+{
+    // Tasks refer to this group, so they have to finish first
+    try
+    {
+        wait();
+    }
+    catch (...)
+    {
+    }
+}
+
+void TaskGroup::run(std::function<void()> task)
+{
+    ++pending;
+
+    // The group may be gone as soon as pending reaches zero, so don't go
+    // through it to get to the pool after that
+    ThreadPool* p = &pool;
+
+    pool.submit([this, p, task]()
+    {
+        try
+        {
+            task();
+        }
+        catch (...)
+        {
+            std::unique_lock<std::mutex> lck(error_lock);
+
+            if (!error)
+                error = std::current_exception();
+        }
+
+        if (--pending == 0)
+            p->notify(true);
+    });
+}
+
+void TaskGroup::wait()
+{
+    const int index = pool.home();
+
+    while (pending > 0)
+    {
+        // Help out rather than sitting around. This might be a task from some
+        // other group, but that one has to finish at some point too.
+        if (pool.runOne(index))
+            continue;
+
+        std::unique_lock<std::mutex> lck(pool.lock);
+        pool.changed.wait(lck, [this]() { return pending == 0 || pool.queued > 0; });
+    }
+
+    std::unique_lock<std::mutex> lck(error_lock);
+
+    if (error)
+    {
+        std::exception_ptr e = error;
+        error = nullptr;
+        std::rethrow_exception(e);
+    }
+}
+
+void parallelFor(int begin, int end, int grain,
+        const std::function<void(int, int)>& f, ThreadPool& pool)
+{
+    if (end <= begin)
+        return;
+
+    grain = std::max(1, grain);
+
+    // A few more pieces than threads so uneven pieces balance out, but
+    // never smaller than the grain
+    const int pieces = std::max(1, std::min((end-begin)/grain, 4*(pool.size()+1)));
+
+    // Not worth handing off
+    if (pieces == 1)
+    {
+        f(begin, end);
+        return;
+    }
+
+    TaskGroup group(pool);
+
+    for (int i = 0; i < pieces; ++i)
+    {
+        const int start = begin + static_cast<long long>(end-begin)*i/pieces;
+        const int stop  = begin + static_cast<long long>(end-begin)*(i+1)/pieces;
+
+        group.run([&f, start, stop]() { f(start, stop); });
+    }
+
+    group.wait();
+}
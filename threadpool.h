@@ -0,0 +1,129 @@
+/*
+ * A fixed set of worker threads to run small tasks on
+ *
+ *   TaskGroup group;
+ *   group.run([&]() { left = work(0, half); });
+ *   group.run([&]() { right = work(half, size); });
+ *   group.wait();
+ *
+ *   parallelFor(0, h, 64, [&](int start, int end) { ... rows start to end ... });
+ *
+ * Waiting on a group runs queued tasks rather than just sleeping, so tasks may
+ * start groups of their own and wait on them without running out of threads.
+ * If a task throws, the exception is rethrown from wait().
+ *
+ * Each worker has its own queue. Tasks started from a worker go on its queue
+ * and it runs the newest first, which keeps recursive work (like splitting an
+ * image into quadrants) depth first and in cache. A worker that runs out
+ * takes the oldest task from someone else's queue, which tends to be the
+ * biggest piece of work left. Tasks started from other threads go on a shared
+ * queue that the workers also take from.
+ */
+
+#ifndef H_THREADPOOL
+#define H_THREADPOOL
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <exception>
+#include <condition_variable>
+
+class ThreadPool
+{
+    struct Queue
+    {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::thread> workers;
+
+    // One for each worker and then the shared one at the end
+    std::vector<std::unique_ptr<Queue>> queues;
+
+    // Tasks in all the queues, so idle threads know whether to look
+    std::atomic<int> queued;
+    bool stopping = false;
+
+    // Only for sleeping when there's nothing to do. Threads waiting on a
+    // group sleep on this too, since they need to wake up both when there are
+    // new tasks and when the group finishes.
+    std::mutex lock;
+    std::condition_variable changed;
+
+    // Which pool the current thread works for and which queue is its own
+    static thread_local ThreadPool* current_pool;
+    static thread_local int current_queue;
+
+    friend class TaskGroup;
+
+public:
+    // Defaults to one thread per core
+    explicit ThreadPool(int threads = 0);
+    ~ThreadPool();
+
+    // Number of worker threads
+    int size() const { return workers.size(); }
+
+    // Add a task to the queue. Use a TaskGroup if you need to know when it's
+    // done.
+    void submit(std::function<void()> task);
+
+    // Shared by everything that doesn't need its own pool
+    static ThreadPool& global();
+
+private:
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void work(int index);
+
+    // The queue this thread should use, the shared one if it isn't a worker
+    int home() const;
+
+    // Run one task, first from our own queue and then from anyone else's.
+    // Returns false if there wasn't anything to run.
+    bool runOne(int index);
+
+    // Wake up anything sleeping on changed
+    void notify(bool all);
+};
+
+// A set of tasks that can be waited on together
+class TaskGroup
+{
+    ThreadPool& pool;
+    std::atomic<int> pending;
+
+    std::mutex error_lock;
+    std::exception_ptr error;
+
+public:
+    explicit TaskGroup(ThreadPool& pool = ThreadPool::global());
+
+    // Waits for anything still running
+    ~TaskGroup();
+
+    void run(std::function<void()> task);
+
+    // Block until all of the tasks have finished, running any queued tasks
+    // in the meantime
+    void wait();
+
+private:
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+};
+
+// Call f(start, end) on pieces of [begin, end) of at least grain items,
+// returning once they're all done
+void parallelFor(int begin, int end, int grain,
+        const std::function<void(int, int)>& f,
+        ThreadPool& pool = ThreadPool::global());
+
+#endif
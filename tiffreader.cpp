@@ -0,0 +1,147 @@
+#include "tiffreader.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <tiffio.h>
+
+// Without these libtiff prints every problem to stderr, but they're already
+// reported as exceptions
+static void openQuietly()
+{
+    TIFFSetErrorHandler(nullptr);
+    TIFFSetWarningHandler(nullptr);
+}
+
+TiffReader::TiffReader(const std::string& filename, int page)
+    : filename(filename)
+{
+    openQuietly();
+    tif = TIFFOpen(filename.c_str(), "r");
+
+    if (!tif)
+        throw std::runtime_error("couldn't open TIFF \"" + filename + "\"");
+
+    std::uint32_t width = 0;
+    std::uint32_t height = 0;
+
+    if (!TIFFSetDirectory(tif, page) ||
+        !TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &width) ||
+        !TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &height))
+    {
+        TIFFClose(tif);
+        throw std::runtime_error("couldn't read page " + std::to_string(page+1) +
+                " of \"" + filename + "\"");
+    }
+
+    // Same limit as Pixels, since the rows end up in one
+    if (width > 0x7fffffff/4 || height > 0x7fffffff)
+    {
+        TIFFClose(tif);
+        throw std::runtime_error("use a smaller image, can't store dimensions in int");
+    }
+
+    w = width;
+    h = height;
+    tiled = TIFFIsTiled(tif);
+
+    if (tiled)
+    {
+        std::uint32_t tw = 0;
+        std::uint32_t th = 0;
+        TIFFGetField(tif, TIFFTAG_TILEWIDTH, &tw);
+        TIFFGetField(tif, TIFFTAG_TILELENGTH, &th);
+
+        tile_w = std::max<std::uint32_t>(1, tw);
+        chunk_rows = std::max<std::uint32_t>(1, th);
+    }
+    else
+    {
+        std::uint32_t rows = 0;
+
+        // The default is the whole image in one strip
+        if (!TIFFGetField(tif, TIFFTAG_ROWSPERSTRIP, &rows) || rows > height)
+            rows = height;
+
+        chunk_rows = std::max<std::uint32_t>(1, rows);
+    }
+}
+
+TiffReader::~TiffReader()
+{
+    TIFFClose(tif);
+}
+
+int TiffReader::pages(const std::string& filename)
+{
+    openQuietly();
+    TIFF* tif = TIFFOpen(filename.c_str(), "r");
+
+    if (!tif)
+        throw std::runtime_error("couldn't open TIFF \"" + filename + "\"");
+
+    const int count = TIFFNumberOfDirectories(tif);
+    TIFFClose(tif);
+
+    return count;
+}
+
+void TiffReader::load(int y)
+{
+    const int top = y/chunk_rows*chunk_rows;
+    const int rows = std::min(chunk_rows, h - top);
+
+    if (tiled)
+    {
+        // Each tile comes out on its own, so put them side by side
+        std::vector<std::uint32_t> tile(static_cast<std::size_t>(tile_w)*chunk_rows);
+        chunk.resize(static_cast<std::size_t>(w)*rows);
+
+        for (int x = 0; x < w; x += tile_w)
+        {
+            if (!TIFFReadRGBATile(tif, x, top, tile.data()))
+                throw std::runtime_error("couldn't decode \"" + filename + "\"");
+
+            // Partial tiles at the bottom are still at the top of the tile, so
+            // the last row is chunk_rows-rows from the bottom of it
+            const int columns = std::min(tile_w, w - x);
+
+            for (int i = 0; i < rows; ++i)
+            {
+                const std::uint32_t* in = &tile[static_cast<std::size_t>(chunk_rows-1-i)*tile_w];
+                std::copy(in, in + columns, &chunk[static_cast<std::size_t>(rows-1-i)*w + x]);
+            }
+        }
+    }
+    else
+    {
+        chunk.resize(static_cast<std::size_t>(w)*chunk_rows);
+
+        if (!TIFFReadRGBAStrip(tif, top, chunk.data()))
+            throw std::runtime_error("couldn't decode \"" + filename + "\"");
+    }
+
+    chunk_top = top;
+    chunk_bottom = top + rows;
+}
+
+void TiffReader::read(unsigned char* out, std::ptrdiff_t stride, int rows)
+{
+    if (rows > h - next)
+        throw std::runtime_error("reading past the end of \"" + filename + "\"");
+
+    for (int i = 0; i < rows; ++i, ++next, out += stride)
+    {
+        if (next < chunk_top || next >= chunk_bottom)
+            load(next);
+
+        // Bottom row first
+        const std::uint32_t* in = &chunk[static_cast<std::size_t>(chunk_bottom-1-next)*w];
+
+        for (int x = 0; x < w; ++x)
+        {
+            out[3*x]   = TIFFGetR(in[x]);
+            out[3*x+1] = TIFFGetG(in[x]);
+            out[3*x+2] = TIFFGetB(in[x]);
+        }
+    }
+}
@@ -0,0 +1,73 @@
+/*
+ * Read a TIFF a few rows at a time rather than all at once
+ *
+ *   TiffReader tiff("scan.tif", 0);
+ *   PixelBuffer<3> rows(tiff.width(), 64);
+ *
+ *   for (int y = 0; y < tiff.height(); y += 64)
+ *       tiff.read(rows.row(0), rows.stride(), std::min(64, tiff.height()-y));
+ *
+ * Each page of a multi-page TIFF is opened separately, starting at zero. Rows
+ * are gone through in order. libtiff decodes a strip (or a row of tiles) at a
+ * time into RGB, so besides what's asked for, this only holds on to one strip,
+ * which for most scans is a few rows but may be the whole page if the file was
+ * written as just one strip.
+ */
+
+#ifndef H_TIFFREADER
+#define H_TIFFREADER
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+struct tiff;
+
+class TiffReader
+{
+    struct tiff* tif = nullptr;
+    std::string filename;
+
+    int w = 0;
+    int h = 0;
+
+    // Rows that libtiff decodes at once, and for tiled images how wide a
+    // tile is
+    int chunk_rows = 0;
+    int tile_w = 0;
+    bool tiled = false;
+
+    // The chunk last decoded, bottom row first as libtiff gives it, and which
+    // rows of the image it has
+    std::vector<std::uint32_t> chunk;
+    int chunk_top = 0;
+    int chunk_bottom = 0;
+
+    // Next row to hand out
+    int next = 0;
+
+public:
+    // Throws std::runtime_error if the file or page can't be opened
+    TiffReader(const std::string& filename, int page);
+    ~TiffReader();
+
+    // Pages in the file, throwing std::runtime_error if it can't be opened
+    static int pages(const std::string& filename);
+
+    int width() const { return w; }
+    int height() const { return h; }
+
+    // Copy the next rows as 8-bit RGB, each one stride bytes after the one
+    // before it. Throws std::runtime_error if they can't be decoded.
+    void read(unsigned char* out, std::ptrdiff_t stride, int rows);
+
+private:
+    TiffReader(const TiffReader&) = delete;
+    TiffReader& operator=(const TiffReader&) = delete;
+
+    // Decode the strip or row of tiles with this row in it
+    void load(int y);
+};
+
+#endif
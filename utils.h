@@ -3,6 +3,7 @@
  */
 
 #include <array>
+#include <atomic>
 
 // Useful for initiailizing a vector of arrays
 //
@@ -13,3 +14,27 @@ std::array<T, N> make_array(const T& v) {
     a.fill(v);
     return a;
 }
+
+// A std::atomic that can be copied, so that a class can cache something in
+// one without having to write out its own copy constructor. Each load and
+// store is atomic, but copying isn't atomic as a whole.
+template<class T>
+class CopyableAtomic
+{
+    std::atomic<T> value;
+
+public:
+    CopyableAtomic(T v = T())
+        : value(v) { }
+    CopyableAtomic(const CopyableAtomic& other)
+        : value(other.load()) { }
+
+    CopyableAtomic& operator=(const CopyableAtomic& other)
+    {
+        store(other.load());
+        return *this;
+    }
+
+    T load() const { return value.load(std::memory_order_relaxed); }
+    void store(T v) { value.store(v, std::memory_order_relaxed); }
+};